@@ -7,6 +7,7 @@
  *     docunation <file.c>              # Document a single file
  *     docunation -j <file.c>           # Output JSON
  *     docunation -h <file.c>           # Output HTML
+ *     docunation -R <dir> -O <out> [--jobs N]   # Document a tree
  * 
  * Extracts:
  *     - Functions (signatures, docstrings from preceding comments)
@@ -16,24 +17,59 @@
  *     - Global variables
  * 
  * Standards:
- *     - ISO C17
+ *     - ISO C17, with POSIX.1-2008 (builds with -std=c17 -Wpedantic)
  *     - IEEE 754 (numeric constants)
  * 
  * Build:
- *     cc -o docunation docunation.c -O2
+ *     cc -o docunation docunation.c -O2 -pthread
+ *     cc -c -fPIC -DDOCUNATION_LIBRARY docunation.c -O2   # see docunation.h
  * 
  * (c) 2026 Triple A Family Holdings LLC
  */
 
+/* POSIX.1-2008 on top of ISO C17, plus the system extensions that madvise,
+ * inotify and usleep need; these must precede the first #include */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#if defined(__APPLE__) && !defined(_DARWIN_C_SOURCE)
+#define _DARWIN_C_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "docunation.h"
+
+/* A library build has no main(), so the command-line code goes unused */
+#ifdef DOCUNATION_LIBRARY
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
 
 /* ═══════════════════════════════════════════════════════════════════════════
  * CONFIGURATION
@@ -43,19 +79,35 @@
 #define MAX_LINE 4096
 #define MAX_NAME 256
 #define MAX_DOC 8192
-#define MAX_SIG 8192
-#define MAX_NODES 2048
 #define MAX_PARAMS 32
 #define MAX_PATH_LEN 8192
-
-/* Safe node increment macro */
-#define ADD_NODE(p) do { \
-    if ((p)->doc->node_count >= MAX_NODES - 1) { \
-        fprintf(stderr, "Warning: max nodes (%d) reached, truncating\n", MAX_NODES); \
-        return; \
-    } \
-    (p)->doc->node_count++; \
-} while(0)
+#define COND_MAX_DEPTH 64
+#define ARENA_MIN_CAP 4096
+#define NODES_MIN_CAP 64
+#define OUTBUF_CAP (1 << 20)
+#define MANIFEST_NAME ".docunation-manifest"
+#define SURFACE_NAME ".docunation-surface"
+#define IGNORE_NAME ".docunationignore"
+#define CORPUS_NAME "corpus.ndjson"
+#define PACK_NAME "docs.pack"
+#define PACK_INDEX_NAME "docs.pack.idx"
+#define SEARCH_DIR "search"
+#define SEARCH_CHUNK 1024
+#define MERGE_NAME "symbols.json"
+#define MERGE_TOKENS 512
+#define INDEX_DIR "index"
+#define INDEX_PAGE_ROWS 1000
+#define STREAM_CHUNK (1 << 20)
+#define BULK_CHUNK 1024
+#define DISCOVERY_MAX_FDS 64
+#define WRITE_QUEUE_BYTES (64 << 20)
+#define WRITE_BATCH 32
+#define STATS_TOP 10
+#define WATCH_SETTLE_MS 50
+#define WATCH_POLL_MS 1000
+#define INTERN_SHARD_BITS 6
+#define INTERN_SHARDS (1 << INTERN_SHARD_BITS)
+#define INTERN_CHUNK (64 << 10)
 
 /* ═══════════════════════════════════════════════════════════════════════════
  * ANSI COLORS
@@ -70,9 +122,9 @@
 #define COL_MAGENTA "\033[95m"
 #define COL_CYAN    "\033[96m"
 
-static int use_color = 1;
-
-#define C(code) (use_color ? code : "")
+/* Renderers take an explicit color flag so concurrent bulk workers never
+ * share mutable state */
+#define C(code) (color ? code : "")
 
 /* ═══════════════════════════════════════════════════════════════════════════
  * NODE TYPES
@@ -93,31 +145,249 @@ static const char *node_type_names[] = {
     "function", "struct", "union", "enum", "typedef", "macro", "variable", "include"
 };
 
+/* Rendered sections, in output order */
+typedef enum {
+    SECTION_INCLUDES,
+    SECTION_MACROS,
+    SECTION_DATA,
+    SECTION_TYPES,
+    SECTION_FUNCTIONS,
+    SECTION_COUNT
+} Section;
+
+/* Section each node type is listed under, indexed by NodeType */
+static const Section node_sections[] = {
+    SECTION_FUNCTIONS, SECTION_TYPES, SECTION_TYPES, SECTION_TYPES,
+    SECTION_TYPES, SECTION_MACROS, SECTION_DATA, SECTION_INCLUDES
+};
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * ARENA
+ *
+ * Each document owns one growable byte arena. Node strings are stored as
+ * (offset, length) slices so that growing the arena never invalidates them.
+ * A slice either indexes the arena or, when src is set, the document's
+ * source text directly; single-line constructs are never copied at all.
+ * Slices carry their length and are not NUL-terminated.
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+typedef struct {
+    uint32_t off;
+    uint32_t len : 31;
+    uint32_t src : 1;    /* off indexes the source text, not the arena */
+} Slice;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} Arena;
+
+/* Make room for extra bytes; returns 0 on success */
+static int arena_reserve(Arena *a, size_t extra) {
+    if (a->len + extra <= a->cap) return 0;
+    size_t cap = a->cap ? a->cap : ARENA_MIN_CAP;
+    while (cap < a->len + extra) cap *= 2;
+    if (cap > UINT32_MAX) return -1;
+    char *data = realloc(a->data, cap);
+    if (!data) return -1;
+    a->data = data;
+    a->cap = cap;
+    return 0;
+}
+
+/* Copy len bytes of s into the arena; returns an empty slice on failure */
+static Slice arena_strn(Arena *a, const char *s, size_t len) {
+    Slice out = { 0, 0, 0 };
+    if (!s || len == 0 || len > INT32_MAX || arena_reserve(a, len + 1) != 0) return out;
+    memcpy(a->data + a->len, s, len);
+    a->data[a->len + len] = '\0';
+    out.off = (uint32_t)a->len;
+    out.len = (uint32_t)len;
+    a->len += len + 1;
+    return out;
+}
+
+static Slice arena_str(Arena *a, const char *s) {
+    return arena_strn(a, s, s ? strlen(s) : 0);
+}
+
+/* Append raw bytes at the top of the arena; pair with arena_seal() */
+static void arena_append(Arena *a, const char *s, size_t len) {
+    if (len == 0 || arena_reserve(a, len + 1) != 0) return;
+    memcpy(a->data + a->len, s, len);
+    a->len += len;
+}
+
+/* Close a string built with arena_append() since mark */
+static Slice arena_seal(Arena *a, size_t mark) {
+    Slice out = { 0, 0, 0 };
+    size_t len = a->len - mark;
+    if (len == 0 || len > INT32_MAX || arena_reserve(a, 1) != 0) {
+        a->len = mark;
+        return out;
+    }
+    a->data[a->len++] = '\0';
+    out.off = (uint32_t)mark;
+    out.len = (uint32_t)len;
+    return out;
+}
+
+static void arena_free(Arena *a) {
+    free(a->data);
+    a->data = NULL;
+    a->len = a->cap = 0;
+}
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * DOC NODE STRUCTURE
  * ═══════════════════════════════════════════════════════════════════════════ */
 
 typedef struct {
-    char name[MAX_NAME];
+    Slice name;
+    Slice signature;
+    Slice docstring;
+    Slice return_type;
     NodeType type;
     int line;
-    char docstring[MAX_DOC];
-    char signature[MAX_SIG];
-    char return_type[MAX_NAME];
     int is_static;
     int is_inline;
     int is_extern;
+    int has_body;        /* a function or aggregate definition, not a declaration */
+    uint32_t start;      /* source bytes [start, end), a body included */
+    uint32_t end;
+    int column;          /* of start; end_line and end_column locate end */
+    int end_line;
+    int end_column;
+    Slice condition;     /* the #if branches it lies in, joined by " && " */
+    int inactive;        /* in a branch the -D/-U set rules out */
 } DocNode;
 
+/* A name given with -D or -U. Names given with neither are unknown, so
+ * #if branches that depend on them are neither taken nor ruled out. */
+typedef struct {
+    char *name;
+    long long value;
+    int defined;         /* 0 for -U */
+    int has_value;       /* the name expands to the integer value */
+} Define;
+
+typedef struct {
+    Define *items;
+    int count;
+    int skip_inactive;   /* pass over ruled-out branches instead of documenting them */
+} DefineSet;
+
 typedef struct {
     char filepath[MAX_LINE];
     char module_name[MAX_NAME];
-    char docstring[MAX_DOC];
-    DocNode nodes[MAX_NODES];
+    Slice docstring;
+    DocNode *nodes;
     int node_count;
+    int node_cap;
+    Arena arena;
+    const char *src;     /* source text, mapped or read whole */
+    size_t src_len;
+    int src_mapped;
+    int src_moving;      /* src is a sliding window: slices must copy */
+    const DefineSet *defines;    /* for evaluating #if, or NULL */
+    uint32_t *order;     /* node indices grouped by section, in source order */
+    uint32_t section_start[SECTION_COUNT + 1];
     char timestamp[64];
+    int truncated;       /* comments cut at MAX_DOC, or the path at MAX_LINE */
+    uint32_t *newlines;  /* offset of every newline in the source, in order */
+    size_t newline_count;
+    size_t newline_cap;
 } DOCUNATION;
 
+/* Resolve a slice to its first byte; the slice length bounds it */
+static const char *doc_str(const DOCUNATION *doc, Slice s) {
+    if (!s.len) return "";
+    return (s.src ? doc->src : doc->arena.data) + s.off;
+}
+
+/* Slice of source text [s, e), copied when the source will not stay put */
+static Slice src_slice(DOCUNATION *doc, const char *s, const char *e) {
+    if (doc->src_moving) return arena_strn(&doc->arena, s, (size_t)(e - s));
+    Slice out = { (uint32_t)(s - doc->src), (uint32_t)(e - s), 1 };
+    return out;
+}
+
+/* Narrow a slice to [s, e), which must lie within doc_str(doc, base) */
+static Slice sub_slice(const DOCUNATION *doc, Slice base, const char *s, const char *e) {
+    Slice out = { base.off + (uint32_t)(s - doc_str(doc, base)), (uint32_t)(e - s), base.src };
+    return out;
+}
+
+#define DSTR(doc, s) doc_str((doc), (s))
+
+/* printf arguments for a slice; pair with "%.*s" */
+#define SARG(doc, s) (int)(s).len, doc_str((doc), (s))
+
+/* Number of nodes in a section */
+#define SECTION_SIZE(doc, sec) ((doc)->section_start[(sec) + 1] - (doc)->section_start[sec])
+
+/* Loop over the nodes of one section, declaring n for the body */
+#define FOR_SECTION(doc, sec, n) \
+    for (const uint32_t *n##_it = (doc)->order + (doc)->section_start[sec], \
+                        *n##_end = (doc)->order + (doc)->section_start[(sec) + 1]; \
+         n##_it < n##_end; n##_it++) \
+        for (DocNode *n = &(doc)->nodes[*n##_it]; n; n = NULL)
+
+/* Group node indices by section with one counting pass and one placing
+ * pass, so each renderer section walks a compact list of its own nodes */
+static int index_sections(DOCUNATION *doc) {
+    uint32_t count[SECTION_COUNT] = { 0 };
+    for (int i = 0; i < doc->node_count; i++) count[node_sections[doc->nodes[i].type]]++;
+
+    uint32_t next[SECTION_COUNT];
+    doc->section_start[0] = 0;
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        next[s] = doc->section_start[s];
+        doc->section_start[s + 1] = doc->section_start[s] + count[s];
+    }
+
+    uint32_t *order = realloc(doc->order, ((size_t)doc->node_count + 1) * sizeof(uint32_t));
+    if (!order) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return -1;
+    }
+    doc->order = order;
+    for (int i = 0; i < doc->node_count; i++) {
+        doc->order[next[node_sections[doc->nodes[i].type]]++] = (uint32_t)i;
+    }
+    return 0;
+}
+
+static void release_source(DOCUNATION *doc) {
+    if (!doc->src) return;
+#ifndef _WIN32
+    if (doc->src_mapped) munmap((void *)doc->src, doc->src_len);
+    else
+#endif
+    free((void *)doc->src);
+    doc->src = NULL;
+    doc->src_len = 0;
+}
+
+/* Heap and mapped bytes a document holds: its source and its parse */
+static uint64_t doc_footprint(const DOCUNATION *doc) {
+    return sizeof(DOCUNATION) + doc->src_len + doc->arena.cap +
+           (uint64_t)doc->node_cap * sizeof(DocNode) +
+           (doc->order ? ((uint64_t)doc->node_count + 1) * sizeof(uint32_t) : 0) +
+           doc->newline_cap * sizeof(uint32_t);
+}
+
+static void free_document(DOCUNATION *doc) {
+    if (!doc) return;
+    release_source(doc);
+    arena_free(&doc->arena);
+    free(doc->nodes);
+    free(doc->order);
+    free(doc->newlines);
+    free(doc);
+}
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * STRING UTILITIES
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -148,25 +418,48 @@ static void safe_strcpy(char *dest, const char *src, size_t size) {
     dest[size - 1] = '\0';
 }
 
-static void safe_append(char *dest, const char *src, size_t size) {
-    if (size == 0 || !src) return;
-    size_t dest_len = strlen(dest);
-    if (dest_len >= size - 1) return;
-    size_t remaining = size - dest_len - 1;
-    size_t copy_len = strlen(src);
-    if (copy_len > remaining) copy_len = remaining;
-    memcpy(dest + dest_len, src, copy_len);
-    dest[dest_len + copy_len] = '\0';
+/* Check if character is identifier char */
+static int is_ident_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/* Find needle within [s, e) */
+static const char *span_find(const char *s, const char *e, const char *needle) {
+    size_t n = strlen(needle);
+    if (s >= e || (size_t)(e - s) < n) return NULL;
+    const char *last = e - n;
+    while (s <= last) {
+        const char *hit = memchr(s, needle[0], (size_t)(last - s) + 1);
+        if (!hit) return NULL;
+        if (memcmp(hit, needle, n) == 0) return hit;
+        s = hit + 1;
+    }
+    return NULL;
 }
 
-/* Check if string starts with prefix */
-static int starts_with(const char *str, const char *prefix) {
-    return strncmp(str, prefix, strlen(prefix)) == 0;
+/* Find c within [s, e) */
+static const char *span_chr(const char *s, const char *e, char c) {
+    return s < e ? memchr(s, c, (size_t)(e - s)) : NULL;
 }
 
-/* Check if character is identifier char */
-static int is_ident_char(char c) {
-    return isalnum((unsigned char)c) || c == '_';
+/* Check if [s, e) contains any byte of set */
+static int span_has_any(const char *s, const char *e, const char *set) {
+    for (; *set; set++) {
+        if (span_chr(s, e, *set)) return 1;
+    }
+    return 0;
+}
+
+/* Check if [s, e) starts with prefix */
+static int span_starts(const char *s, const char *e, const char *prefix) {
+    size_t n = strlen(prefix);
+    return (size_t)(e - s) >= n && memcmp(s, prefix, n) == 0;
+}
+
+/* Narrow [*s, *e) to exclude surrounding whitespace */
+static void span_trim(const char **s, const char **e) {
+    while (*s < *e && isspace((unsigned char)**s)) (*s)++;
+    while (*e > *s && isspace((unsigned char)(*e)[-1])) (*e)--;
 }
 
 /* Extract module name from filepath */
@@ -210,6 +503,28 @@ static void sanitize_rel_path(const char *rel, char *safe, size_t size) {
     safe[idx] = '\0';
 }
 
+/* 64-bit FNV-1a hash of a byte range */
+static uint64_t fnv1a64(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Modification time of a stat result in nanoseconds */
+static int64_t stat_mtime_ns(const struct stat *st) {
+#if defined(__APPLE__)
+    return (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    return (int64_t)st->st_mtime * 1000000000;
+#else
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
+
 static int ensure_dir(const char *path) {
     if (!path || !*path) return -1;
     struct stat st;
@@ -224,42 +539,391 @@ static int ensure_dir(const char *path) {
     return -1;
 }
 
+/* ═══════════════════════════════════════════════════════════════════════════
+ * OUTPUT BUFFER
+ *
+ * Renderers append to a buffer bound to an open file. A document that fits
+ * in OUTBUF_CAP goes out with a single fwrite, and a larger one is flushed
+ * each time the buffer fills. A buffer is reused from one document to the
+ * next, so steady-state rendering does not allocate. Escaping is table
+ * driven: runs of bytes that need no escape are copied in one piece.
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    FILE *sink;          /* where full buffers go */
+    const char *spill;   /* unbound: file to open once the buffer fills */
+    int failed;          /* an allocation or write failed */
+} OutBuf;
+
+/* Write out and empty the buffer */
+static void ob_drain(OutBuf *b) {
+    if (b->len && fwrite(b->data, 1, b->len, b->sink) != b->len) b->failed = 1;
+    b->len = 0;
+}
+
+/* Make room for extra more bytes, draining to the sink first */
+static int ob_reserve(OutBuf *b, size_t extra) {
+    if (b->failed) return -1;
+    if (b->cap - b->len >= extra) return 0;
+    if (b->len && !b->sink && b->spill) {
+        b->sink = fopen(b->spill, "w");
+        if (!b->sink) {
+            fprintf(stderr, "Error: Cannot write '%s'\n", b->spill);
+            b->failed = 1;
+            return -1;
+        }
+    }
+    if (b->len && b->sink) {
+        ob_drain(b);
+        if (b->failed) return -1;
+        if (b->cap >= extra) return 0;
+    }
+    size_t cap = b->cap ? b->cap : OUTBUF_CAP;
+    while (cap - b->len < extra) {
+        if (cap > SIZE_MAX / 2) {
+            b->failed = 1;
+            return -1;
+        }
+        cap *= 2;
+    }
+    char *data = realloc(b->data, cap);
+    if (!data) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        b->failed = 1;
+        return -1;
+    }
+    b->data = data;
+    b->cap = cap;
+    return 0;
+}
+
+static void ob_write(OutBuf *b, const char *s, size_t n) {
+    if (!n || ob_reserve(b, n) != 0) return;
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+}
+
+/* Append a string literal without measuring it */
+#define OB_LIT(b, lit) ob_write((b), (lit), sizeof(lit) - 1)
+
+static void ob_str(OutBuf *b, const char *s) {
+    ob_write(b, s, strlen(s));
+}
+
+/* Append n copies of c */
+static void ob_fill(OutBuf *b, char c, size_t n) {
+    if (ob_reserve(b, n) != 0) return;
+    memset(b->data + b->len, c, n);
+    b->len += n;
+}
+
+static void ob_printf(OutBuf *b, const char *fmt, ...) {
+    if (ob_reserve(b, 1) != 0) return;
+    va_list ap;
+    va_start(ap, fmt);
+    size_t room = b->cap - b->len;
+    int n = vsnprintf(b->data + b->len, room, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n >= room) {
+        if (ob_reserve(b, (size_t)n + 1) != 0) return;
+        va_start(ap, fmt);
+        vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+    }
+    b->len += (size_t)n;
+}
+
+/* Second byte of a JSON escape: 'u' means \u00XX, 0 means copy as is */
+static const char json_escape[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    ['"'] = '"', ['\\'] = '\\',
+};
+
+/* Append [s, s + n) escaped for a JSON string */
+static void ob_json(OutBuf *b, const char *s, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+    const char *e = s + n;
+    while (s < e) {
+        const char *run = s;
+        while (s < e && !json_escape[(unsigned char)*s]) s++;
+        ob_write(b, run, (size_t)(s - run));
+        if (s >= e) break;
+        unsigned char c = (unsigned char)*s++;
+        if (json_escape[c] == 'u') {
+            char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+            ob_write(b, esc, sizeof(esc));
+        } else {
+            char esc[2] = { '\\', json_escape[c] };
+            ob_write(b, esc, sizeof(esc));
+        }
+    }
+}
+
+static const char *const html_entity[256] = {
+    ['<'] = "&lt;", ['>'] = "&gt;", ['&'] = "&amp;", ['"'] = "&quot;",
+};
+
+/* Append [s, s + n) escaped for HTML text or a quoted attribute */
+static void ob_html(OutBuf *b, const char *s, size_t n) {
+    const char *e = s + n;
+    while (s < e) {
+        const char *run = s;
+        while (s < e && !html_entity[(unsigned char)*s]) s++;
+        ob_write(b, run, (size_t)(s - run));
+        if (s >= e) break;
+        ob_str(b, html_entity[(unsigned char)*s++]);
+    }
+}
+
+/* Direct output to an open stream */
+static void ob_bind(OutBuf *b, FILE *sink) {
+    b->sink = sink;
+    b->spill = NULL;
+    b->len = 0;
+    b->failed = 0;
+}
+
+/* Render into memory, falling back to writing path directly if the output
+ * outgrows the buffer; the caller checks b->sink afterwards */
+static void ob_defer(OutBuf *b, const char *path) {
+    ob_bind(b, NULL);
+    b->spill = path;
+}
+
+/* Write out what is left; returns -1 if anything was lost */
+static int ob_finish(OutBuf *b) {
+    if (!b->failed) ob_drain(b);
+    if (fflush(b->sink) != 0) b->failed = 1;
+    b->sink = NULL;
+    b->len = 0;
+    return b->failed ? -1 : 0;
+}
+
+/* Create or truncate path and direct output to it */
+static int ob_open(OutBuf *b, const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Cannot write '%s'\n", path);
+        return -1;
+    }
+    ob_bind(b, out);
+    return 0;
+}
+
+/* Finish and close the file opened by ob_open() */
+static int ob_close(OutBuf *b, const char *path) {
+    FILE *out = b->sink;
+    int rc = ob_finish(b);
+    if (fclose(out) != 0) rc = -1;
+    if (rc != 0) fprintf(stderr, "Error: Cannot write '%s'\n", path);
+    return rc;
+}
+
+/* Start an empty buffer at cap bytes rather than OUTBUF_CAP */
+static void ob_presize(OutBuf *b, size_t cap) {
+    if (b->cap || !(b->data = malloc(cap))) return;
+    b->cap = cap;
+}
+
+static void ob_free(OutBuf *b) {
+    free(b->data);
+    memset(b, 0, sizeof(*b));
+}
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * C PARSER - Type Definition (needed early for forward decl)
+ *
+ * The parser walks the document's source text in place. Each line is a span
+ * of the source; nothing is copied until a construct spans several lines.
  * ═══════════════════════════════════════════════════════════════════════════ */
 
+/* Keywords the line classifier cares about */
+typedef enum {
+    KW_NONE,
+    KW_STATIC,
+    KW_INLINE,
+    KW_EXTERN,
+    KW_TYPEDEF,
+    KW_STRUCT,
+    KW_UNION,
+    KW_ENUM,
+    KW_CONST,
+    KW_SIZEOF,
+    KW_CONTROL,   /* if, else, do, while, for, switch, return */
+    KW_TYPE       /* builtin type names */
+} Keyword;
+
+#define KWF(k) (1u << (k))
+
+/* What one lexer pass learned about a line. "Head" facts only cover the
+ * text before the line's first '{', so a one-line body never counts. */
+typedef struct {
+    unsigned kw;              /* KWF() bits of keywords in the head */
+    Keyword first;            /* keyword of the first token */
+    int first_is_type;        /* first token names a type */
+    int idents_before_paren;  /* identifiers before the first '(' */
+    int star_before_paren;    /* '*' before the first '(' (pointer return) */
+    int has_paren;
+    int has_assign;
+    int has_arrow;
+    int has_member;           /* '.' member access, not "..." or a number */
+    int has_bracket;
+    NodeType agg_type;        /* valid when agg_decl is set */
+    int agg_decl;             /* struct/union/enum [tag] then '{', ';' or EOL */
+    int decl_only;            /* only identifiers and '*': a return type line */
+    int depth;                /* brace depth at the start of the line */
+    int in_comment;           /* line starts inside a block comment */
+} LineInfo;
+
+/* One open #if group. Its text in Parser.cond_text runs from start, " && "
+ * included, to the next group's; the current branch's own condition
+ * begins at own, after the negated conditions of the branches before it. */
+typedef struct {
+    uint32_t start;
+    uint32_t own;
+    uint8_t state;       /* COND_TRUE, COND_FALSE or COND_UNKNOWN */
+    uint8_t taken;       /* an earlier branch was known true */
+    uint8_t maybe;       /* an earlier branch might have been taken */
+    uint8_t guard;       /* an include guard, which adds no condition */
+    int events;          /* Parser.cond_events when it opened */
+    int nodes;           /* Parser.node_total when it opened */
+} CondFrame;
+
+enum { COND_FALSE, COND_TRUE, COND_UNKNOWN };
+
+/* Called with each completed node when streaming; the node and its strings
+ * are only valid for the duration of the call */
+typedef void (*NodeSink)(void *ctx, DOCUNATION *doc, const DocNode *node);
+
 typedef struct Parser {
-    FILE *fp;
-    char line[MAX_LINE];
+    const char *cur;        /* next unread byte */
+    const char *end;        /* end of the source text */
+    const char *raw;        /* current line as read, leading space kept */
+    const char *ls;         /* current line, trimmed */
+    const char *le;
     int line_num;
-    char pending_comment[MAX_DOC];
+    LineInfo info;          /* classification of the current line */
+    int depth;              /* brace depth after the current line */
+    int linkage;            /* open extern "C" blocks, which add no depth */
+    int in_comment;         /* inside a block comment */
+    int in_directive;       /* inside a continued preprocessor line */
+    int mid_line;           /* cur resumes the current line after a skipped body */
+    int prev_decl_only;     /* previous top-level line was a bare return type */
+    const char *comment;    /* pending comment's raw text, or NULL; see hold_comment() */
+    const char *comment_first;
+    const char *comment_end;
+    Slice comment_doc;      /* its cleaned text, once claimed */
+    int comment_cleaned;
     int pending_comment_line;
+    char comment_buf[MAX_DOC];  /* a streamed comment's bytes, as the window slides */
+    int node_total;         /* nodes committed so far */
     DOCUNATION *doc;
+    struct SourceStream *stream;   /* refills the source window, if streaming */
+    NodeSink sink;          /* receives each node instead of doc->nodes */
+    void *sink_ctx;
+    size_t arena_keep;      /* arena bytes that outlive a sunk node */
+    int open_node;          /* 1 + index of the node whose body is open, or 0 */
+    CondFrame conds[COND_MAX_DEPTH];   /* open #if groups, innermost last */
+    int cond_depth;         /* open groups, the untracked beyond COND_MAX_DEPTH too */
+    int cond_dead;          /* tracked groups in a branch known false */
+    int cond_events;        /* conditional directives and #defines read */
+    size_t cond_len;
+    Slice cond_slice;       /* cond_text in the arena, while cond_cached */
+    int cond_cached;
+    char cond_text[MAX_LINE];
 } Parser;
 
-static void output_text(DOCUNATION *doc, FILE *out);
-static void output_json(DOCUNATION *doc, FILE *out);
-static void output_html(DOCUNATION *doc, FILE *out);
+/* Prepare the next node slot, growing the node vector if needed */
+static DocNode *next_node(Parser *p) {
+    DOCUNATION *doc = p->doc;
+    /* A sunk node's strings are spent once the next one starts */
+    if (p->sink) doc->arena.len = p->arena_keep;
+    if (doc->node_count >= doc->node_cap) {
+        int cap = doc->node_cap ? doc->node_cap * 2 : NODES_MIN_CAP;
+        DocNode *nodes = realloc(doc->nodes, (size_t)cap * sizeof(DocNode));
+        if (!nodes) {
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            return NULL;
+        }
+        doc->nodes = nodes;
+        doc->node_cap = cap;
+    }
+    DocNode *node = &doc->nodes[doc->node_count];
+    memset(node, 0, sizeof(DocNode));
+    node->start = (uint32_t)(p->ls - doc->src);
+    return node;
+}
+
+/* Tag a node with the #if branches it lies in */
+static void cond_annotate(Parser *p, DocNode *node) {
+    node->inactive = p->cond_dead > 0;
+    if (!p->cond_len) return;
+    /* A sunk node's strings do not outlive it */
+    if (!p->cond_cached || p->sink) {
+        p->cond_slice = arena_strn(&p->doc->arena, p->cond_text, p->cond_len);
+        p->cond_cached = 1;
+    }
+    node->condition = p->cond_slice;
+}
+
+/* Commit the node prepared by next_node(), or hand it to the sink. The
+ * node ends with its last line unless that line opened a body, which
+ * close_node() adds once skipped. Only top-level nodes open bodies. */
+static void add_node(Parser *p) {
+    DOCUNATION *doc = p->doc;
+    DocNode *node = &doc->nodes[doc->node_count];
+    node->end = (uint32_t)(p->le - doc->src);
+    if (p->cond_depth) cond_annotate(p, node);
+    p->node_total++;
+    if (p->sink) {
+        p->sink(p->sink_ctx, doc, node);
+        return;
+    }
+    doc->node_count++;
+    if (p->depth > 0 && node->type != NODE_MACRO && node->type != NODE_INCLUDE) {
+        p->open_node = doc->node_count;
+    }
+}
+
+/* Extend the node whose body just closed to the closing brace */
+static void close_node(Parser *p) {
+    DocNode *node = &p->doc->nodes[p->open_node - 1];
+    const char *end = p->mid_line ? p->cur : p->le;
+    node->end = (uint32_t)(end - p->doc->src);
+    p->open_node = 0;
+}
+
+static void output_text(DOCUNATION *doc, OutBuf *out, int color);
+static void output_json(DOCUNATION *doc, OutBuf *out);
+typedef struct HtmlLinks HtmlLinks;
+static void output_html(DOCUNATION *doc, OutBuf *out, const HtmlLinks *links);
+static void output_ndjson(DOCUNATION *doc, OutBuf *out);
 
 /* ═══════════════════════════════════════════════════════════════════════════
  * COMMENT PARSING
  * ═══════════════════════════════════════════════════════════════════════════ */
 
 /* Clean a comment block, removing star prefixes and delimiters */
-static void clean_comment(const char *raw, char *cleaned, size_t size) {
+static void clean_comment(const char *raw, size_t len, char *cleaned, size_t size) {
     const char *p = raw;
+    const char *stop = raw + len;
     char *out = cleaned;
     char *end = cleaned + size - 1;
     int at_line_start = 1;
     
     /* Skip opening delimiter */
-    if (starts_with(p, "/**")) p += 3;
-    else if (starts_with(p, "/*")) p += 2;
-    else if (starts_with(p, "//")) p += 2;
+    if (span_starts(p, stop, "/**")) p += 3;
+    else if (span_starts(p, stop, "/*")) p += 2;
+    else if (span_starts(p, stop, "//")) p += 2;
     
-    while (*p && out < end) {
+    while (p < stop && out < end) {
         /* Skip closing delimiter */
-        if (starts_with(p, "*/")) {
+        if (span_starts(p, stop, "*/")) {
             p += 2;
             continue;
         }
@@ -274,10 +938,10 @@ static void clean_comment(const char *raw, char *cleaned, size_t size) {
         
         /* Skip leading whitespace and * at line start */
         if (at_line_start) {
-            while (*p == ' ' || *p == '\t') p++;
-            if (*p == '*' && *(p+1) != '/') {
+            while (p < stop && (*p == ' ' || *p == '\t')) p++;
+            if (p < stop && *p == '*' && (p + 1 >= stop || p[1] != '/')) {
                 p++;
-                if (*p == ' ') p++;
+                if (p < stop && *p == ' ') p++;
             }
             at_line_start = 0;
             continue;
@@ -291,986 +955,8021 @@ static void clean_comment(const char *raw, char *cleaned, size_t size) {
     trim(cleaned);
 }
 
-/* ═══════════════════════════════════════════════════════════════════════════
- * C PARSER - Functions
- * ═══════════════════════════════════════════════════════════════════════════ */
-
-/* Read next non-empty line */
-static int next_line(Parser *p) {
-    while (fgets(p->line, MAX_LINE, p->fp)) {
-        p->line_num++;
-        char *trimmed = trim(p->line);
-        if (strlen(trimmed) > 0) {
-            return 1;
-        }
+/* Make [s, end) the pending comment, uncleaned until a node claims it. Of
+ * the first line only [s, first_end) counts; each later line counts whole
+ * while the text stays under MAX_DOC. A streamed line is copied, since the
+ * window may slide before the claim. */
+static void hold_comment(Parser *p, const char *s, const char *first_end, const char *end) {
+    if (p->doc->src_moving && s != p->comment_buf) {
+        size_t len = (size_t)(end - s);
+        if (len > MAX_DOC - 1) len = MAX_DOC - 1;
+        memcpy(p->comment_buf, s, len);
+        s = p->comment_buf;
+        first_end = end = s + len;
     }
-    return 0;
+    p->comment = s;
+    p->comment_first = first_end;
+    p->comment_end = end;
+    p->comment_cleaned = 0;
+    p->pending_comment_line = p->line_num;
 }
 
-/* Parse a block comment */
-static void parse_block_comment(Parser *p) {
-    char buf[MAX_DOC] = {0};
-    
-    /* Copy current line */
-    safe_append(buf, p->line, MAX_DOC);
-    
-    /* Check if comment ends on same line */
-    if (strstr(p->line, "*/")) {
-        clean_comment(buf, p->pending_comment, MAX_DOC);
-        p->pending_comment_line = p->line_num;
-        return;
-    }
-    
-    /* Read until end of comment */
-    while (fgets(p->line, MAX_LINE, p->fp)) {
-        p->line_num++;
-        if (strlen(buf) + strlen(p->line) < MAX_DOC - 1) {
-            safe_append(buf, p->line, MAX_DOC);
+/* The pending comment's cleaned text, cleaned in place in the arena the
+ * first time it is claimed; empty when there is none */
+static Slice claim_comment(Parser *p) {
+    Slice out = { 0, 0, 0 };
+    if (!p->comment) return out;
+    if (p->comment_cleaned) return p->comment_doc;
+    p->comment_cleaned = 1;
+    p->comment_doc = out;
+
+    Arena *a = &p->doc->arena;
+    const char *s = p->comment;
+    const char *first = p->comment_first;
+    const char *end = p->comment_end;
+    size_t len = (size_t)(first - s);
+    size_t room = (size_t)(end - s) < len + MAX_DOC ? (size_t)(end - s) : len + MAX_DOC;
+    if (room > INT32_MAX || arena_reserve(a, room + 1) != 0) return out;
+    char *buf = a->data + a->len;
+    memcpy(buf, s, len);
+    const char *nl = memchr(first, '\n', (size_t)(end - first));
+    for (const char *line = nl ? nl + 1 : end; line < end;) {
+        nl = memchr(line, '\n', (size_t)(end - line));
+        const char *next = nl ? nl + 1 : end;
+        size_t line_len = (size_t)(next - line);
+        if (len + line_len < MAX_DOC - 1) {
+            memcpy(buf + len, line, line_len);
+            len += line_len;
         }
-        if (strstr(p->line, "*/")) break;
+        line = next;
     }
-    
-    clean_comment(buf, p->pending_comment, MAX_DOC);
-    p->pending_comment_line = p->line_num;
+
+    /* Cleaning only drops bytes, so it can write over its own input */
+    clean_comment(buf, len, buf, MAX_DOC);
+    len = strlen(buf);
+    if (len == 0) return out;
+    out.off = (uint32_t)a->len;
+    out.len = (uint32_t)len;
+    a->len += len + 1;
+    p->comment_doc = out;
+    return out;
 }
 
-/* Parse a function declaration/definition */
-static void parse_function(Parser *p, const char *start, int is_static, int is_inline, int is_extern) {
-    (void)start;
-    DocNode *node = &p->doc->nodes[p->doc->node_count];
-    memset(node, 0, sizeof(DocNode));
-    
-    node->type = NODE_FUNCTION;
-    node->line = p->line_num;
-    node->is_static = is_static;
-    node->is_inline = is_inline;
-    node->is_extern = is_extern;
-    
-    /* Build full signature */
-    char sig[MAX_SIG] = {0};
-    safe_append(sig, p->line, MAX_SIG);
-    
-    /* If line doesn't end with { or ;, read more */
-    while (!strchr(sig, '{') && !strchr(sig, ';')) {
-        if (!fgets(p->line, MAX_LINE, p->fp)) break;
-        p->line_num++;
-        char *trimmed = trim(p->line);
-        safe_append(sig, " ", MAX_SIG);
-        safe_append(sig, trimmed, MAX_SIG);
-    }
-    
-    /* Clean up signature - remove body */
-    char *brace = strchr(sig, '{');
-    if (brace) *brace = '\0';
-    char *semi = strchr(sig, ';');
-    if (semi) *semi = '\0';
-    
-    /* Trim and save signature */
-    safe_strcpy(node->signature, trim(sig), MAX_SIG);
-    
-    /* Extract function name (last identifier before '(') */
-    char *paren = strchr(sig, '(');
-    if (paren) {
-        *paren = '\0';
-        /* Walk backwards to find name */
-        char *name_end = paren - 1;
-        while (name_end > sig && isspace((unsigned char)*name_end)) name_end--;
-        char *name_start = name_end;
-        while (name_start > sig && is_ident_char(*(name_start-1))) name_start--;
-        
-        int len = name_end - name_start + 1;
-        if (len > 0 && len < MAX_NAME) {
-            strncpy(node->name, name_start, len);
-            node->name[len] = '\0';
+/* Attach the pending comment to a node and consume it */
+static void take_pending_comment(Parser *p, DocNode *node) {
+    node->docstring = claim_comment(p);
+    p->comment = NULL;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * LEXER
+ *
+ * Every line is lexed exactly once, as it is read. One pass over its bytes
+ * classifies the tokens the parser needs and keeps the brace depth, skipping
+ * string and character literals, comments and preprocessor lines.
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/* Classify an identifier: switch on length, then compare once */
+static Keyword classify_keyword(const char *s, size_t len) {
+#define KW_IS(word) (memcmp(s, word, len) == 0)
+    switch (len) {
+    case 2:
+        if (KW_IS("if") || KW_IS("do")) return KW_CONTROL;
+        break;
+    case 3:
+        if (KW_IS("int")) return KW_TYPE;
+        if (KW_IS("for")) return KW_CONTROL;
+        break;
+    case 4:
+        switch (s[0]) {
+        case 'v': if (KW_IS("void")) return KW_TYPE; break;
+        case 'c': if (KW_IS("char")) return KW_TYPE; break;
+        case 'l': if (KW_IS("long")) return KW_TYPE; break;
+        case 'e':
+            if (KW_IS("enum")) return KW_ENUM;
+            if (KW_IS("else")) return KW_CONTROL;
+            break;
+        case 'b': if (KW_IS("bool")) return KW_TYPE; break;
         }
-        
-        /* Extract return type */
-        *name_start = '\0';
-        safe_strcpy(node->return_type, trim(sig), MAX_NAME);
-    }
-    
-    /* Copy docstring if comment was on previous line */
-    if (p->pending_comment_line == node->line - 1 || 
-        p->pending_comment_line == node->line) {
-        safe_strcpy(node->docstring, p->pending_comment, MAX_DOC);
-        p->pending_comment[0] = '\0';
+        break;
+    case 5:
+        switch (s[0]) {
+        case 'c': if (KW_IS("const")) return KW_CONST; break;
+        case 'u': if (KW_IS("union")) return KW_UNION; break;
+        case 's': if (KW_IS("short")) return KW_TYPE; break;
+        case 'f': if (KW_IS("float")) return KW_TYPE; break;
+        case 'w': if (KW_IS("while")) return KW_CONTROL; break;
+        case '_': if (KW_IS("_Bool")) return KW_TYPE; break;
+        }
+        break;
+    case 6:
+        switch (s[0]) {
+        case 's':
+            if (KW_IS("static")) return KW_STATIC;
+            if (KW_IS("struct")) return KW_STRUCT;
+            if (KW_IS("sizeof")) return KW_SIZEOF;
+            if (KW_IS("signed")) return KW_TYPE;
+            if (KW_IS("size_t")) return KW_TYPE;
+            if (KW_IS("switch")) return KW_CONTROL;
+            break;
+        case 'i': if (KW_IS("inline")) return KW_INLINE; break;
+        case 'e': if (KW_IS("extern")) return KW_EXTERN; break;
+        case 'd': if (KW_IS("double")) return KW_TYPE; break;
+        case 'r': if (KW_IS("return")) return KW_CONTROL; break;
+        }
+        break;
+    case 7:
+        if (KW_IS("typedef")) return KW_TYPEDEF;
+        break;
+    case 8:
+        if (KW_IS("unsigned")) return KW_TYPE;
+        if (KW_IS("__inline")) return KW_INLINE;
+        break;
+    case 10:
+        if (KW_IS("__inline__")) return KW_INLINE;
+        break;
     }
-    
-    ADD_NODE(p);
+    return KW_NONE;
+#undef KW_IS
 }
 
-/* Parse a struct/union/enum */
-static void parse_aggregate(Parser *p, NodeType type) {
-    DocNode *node = &p->doc->nodes[p->doc->node_count];
-    memset(node, 0, sizeof(DocNode));
-    
-    node->type = type;
-    node->line = p->line_num;
-    
-    /* Extract name */
-    const char *keyword = (type == NODE_STRUCT) ? "struct" :
-                          (type == NODE_UNION) ? "union" : "enum";
-    char *kw_pos = strstr(p->line, keyword);
-    if (kw_pos) {
-        char *name_start = kw_pos + strlen(keyword);
-        while (*name_start && isspace((unsigned char)*name_start)) name_start++;
-        
-        char *name_end = name_start;
-        while (*name_end && is_ident_char(*name_end)) name_end++;
-        
-        int len = name_end - name_start;
-        if (len > 0 && len < MAX_NAME) {
-            strncpy(node->name, name_start, len);
-            node->name[len] = '\0';
+/* Skip a string or character literal starting at s; returns the byte after */
+static const char *skip_literal(const char *s, const char *e) {
+    char quote = *s++;
+    while (s < e) {
+        if (*s == '\\') {
+            s += 2;
+            continue;
         }
+        if (*s++ == quote) break;
     }
-    
-    /* If anonymous, use placeholder */
-    if (node->name[0] == '\0') {
-        snprintf(node->name, MAX_NAME, "(anonymous %s)", keyword);
-    }
-    
-    /* Build signature */
-    safe_strcpy(node->signature, trim(p->line), MAX_SIG);
-    
-    /* Copy docstring */
-    if (p->pending_comment_line == node->line - 1) {
-        safe_strcpy(node->docstring, p->pending_comment, MAX_DOC);
-        p->pending_comment[0] = '\0';
-    }
-    
-    ADD_NODE(p);
+    return s < e ? s : e;
 }
 
-/* Parse a typedef */
-static void parse_typedef(Parser *p) {
-    DocNode *node = &p->doc->nodes[p->doc->node_count];
-    memset(node, 0, sizeof(DocNode));
-    
-    node->type = NODE_TYPEDEF;
-    node->line = p->line_num;
-    
-    /* Build full typedef (may span lines) */
-    char sig[MAX_SIG] = {0};
-    safe_append(sig, p->line, MAX_SIG);
-    
-    while (!strchr(sig, ';')) {
-        if (!fgets(p->line, MAX_LINE, p->fp)) break;
-        p->line_num++;
-        char *trimmed = trim(p->line);
-        safe_append(sig, " ", MAX_SIG);
-        safe_append(sig, trimmed, MAX_SIG);
-    }
-    
-    /* Remove trailing semicolon */
-    char *semi = strchr(sig, ';');
-    if (semi) *semi = '\0';
-    
-    /* Extract name (last identifier before ;) */
-    char *end = sig + strlen(sig) - 1;
-    while (end > sig && isspace((unsigned char)*end)) end--;
-    char *name_start = end;
-    while (name_start > sig && is_ident_char(*(name_start-1))) name_start--;
-    
-    int len = end - name_start + 1;
-    if (len > 0 && len < MAX_NAME) {
-        strncpy(node->name, name_start, len);
-        node->name[len] = '\0';
-    }
-    
-    safe_strcpy(node->signature, trim(sig), MAX_SIG);
-    
-    /* Copy docstring */
-    if (p->pending_comment_line == node->line - 1) {
-        safe_strcpy(node->docstring, p->pending_comment, MAX_DOC);
-        p->pending_comment[0] = '\0';
+/* Lex the current line into p->info and carry brace/comment state forward */
+static void lex_line(Parser *p) {
+    LineInfo *li = &p->info;
+    memset(li, 0, sizeof(*li));
+    li->depth = p->depth;
+    li->in_comment = p->in_comment;
+
+    const char *s = p->ls;
+    const char *e = p->le;
+    int directive = p->in_directive || (s < e && *s == '#');
+    int head = 1;          /* before the first '{' */
+    int tokens = 0;
+    int agg_state = 0;     /* 1: saw struct/union/enum, 2: saw its tag, -1: neither */
+    int linkage = 0;       /* extern "C" */
+    int decl_only = 1;
+
+    while (s < e) {
+        char c = *s;
+        if (p->in_comment) {
+            const char *close = span_find(s, e, "*/");
+            if (!close) break;
+            p->in_comment = 0;
+            s = close + 2;
+            continue;
+        }
+        if (is_ident_char(c) && !isdigit((unsigned char)c)) {
+            const char *start = s;
+            while (s < e && is_ident_char(*s)) s++;
+            if (!head) continue;
+            size_t len = (size_t)(s - start);
+            Keyword kw = classify_keyword(start, len);
+            if (++tokens == 1) {
+                li->first = kw;
+                li->first_is_type = kw == KW_TYPE || kw == KW_CONST ||
+                                    (len > 2 && start[len - 2] == '_' && start[len - 1] == 't');
+            }
+            if (kw != KW_NONE && kw != KW_TYPE && kw != KW_CONTROL) li->kw |= KWF(kw);
+            if (!li->has_paren) li->idents_before_paren++;
+            if (agg_state == 0 && (kw == KW_STRUCT || kw == KW_UNION || kw == KW_ENUM)) {
+                agg_state = 1;
+                li->agg_type = kw == KW_STRUCT ? NODE_STRUCT :
+                               kw == KW_UNION ? NODE_UNION : NODE_ENUM;
+            } else if (agg_state == 1 && kw == KW_NONE) {
+                agg_state = 2;
+            } else if (agg_state > 0) {
+                agg_state = -1;
+            }
+            continue;
+        }
+        if (isdigit((unsigned char)c)) {
+            /* Numbers, including 1.5e3 and 0x1F, so '.' is not member access */
+            while (s < e && (is_ident_char(*s) || *s == '.')) s++;
+            continue;
+        }
+        if (!isspace((unsigned char)c) && c != '*') decl_only = 0;
+        switch (c) {
+        case '"':
+        case '\'':
+            if (c == '"' && tokens == 1 && li->first == KW_EXTERN) linkage = 1;
+            s = skip_literal(s, e);
+            continue;
+        case '/':
+            if (s + 1 < e && s[1] == '/') {
+                s = e;
+                continue;
+            }
+            if (s + 1 < e && s[1] == '*') {
+                p->in_comment = 1;
+                s += 2;
+                continue;
+            }
+            break;
+        case '{':
+            if (directive) break;
+            if (head && agg_state > 0) li->agg_decl = 1;
+            head = 0;
+            if (linkage && p->depth == 0) p->linkage++;
+            else p->depth++;
+            break;
+        case '}':
+            if (directive) break;
+            if (p->depth > 0) p->depth--;
+            else if (p->linkage > 0) p->linkage--;
+            break;
+        case ';':
+            if (head && agg_state > 0) li->agg_decl = 1;
+            break;
+        case '(':
+            if (head) {
+                li->has_paren = 1;
+                if (agg_state > 0) agg_state = -1;
+            }
+            break;
+        case '=':
+            if (s + 1 < e && s[1] == '=') {
+                s += 2;
+                continue;
+            }
+            if (head) li->has_assign = 1;
+            break;
+        case '<':
+        case '>':
+        case '!':
+            /* Comparison operators are not assignments */
+            if (s + 1 < e && s[1] == '=') {
+                s += 2;
+                continue;
+            }
+            break;
+        case '-':
+            if (head && s + 1 < e && s[1] == '>') {
+                li->has_arrow = 1;
+                s += 2;
+                continue;
+            }
+            break;
+        case '.':
+            if (s + 2 < e && s[1] == '.' && s[2] == '.') {
+                s += 3;
+                continue;
+            }
+            if (head && !(s + 1 < e && isdigit((unsigned char)s[1]))) li->has_member = 1;
+            break;
+        case '[':
+            if (head) li->has_bracket = 1;
+            break;
+        case '*':
+            if (head && !li->has_paren) li->star_before_paren = 1;
+            if (agg_state > 0) agg_state = -1;
+            break;
+        default:
+            if (!isspace((unsigned char)c) && agg_state > 0) agg_state = -1;
+            break;
+        }
+        s++;
     }
-    
-    ADD_NODE(p);
+
+    /* A tag declaration may continue with its '{' on the next line */
+    if (head && agg_state > 0) li->agg_decl = 1;
+    li->decl_only = decl_only && tokens > 0 && !directive &&
+                    li->first != KW_CONTROL && li->first != KW_TYPEDEF;
+
+    /* A closing brace in column 0 ends any top-level construct; resync
+     * depth there so unbalanced #if branches cannot hide the rest */
+    if (!directive && !li->in_comment && p->raw[0] == '}') p->depth = 0;
+
+    p->in_directive = directive && e > p->ls && e[-1] == '\\';
 }
 
-/* Parse a #define macro */
-static void parse_macro(Parser *p) {
-    DocNode *node = &p->doc->nodes[p->doc->node_count];
-    memset(node, 0, sizeof(DocNode));
-    
-    node->type = NODE_MACRO;
-    node->line = p->line_num;
-    
-    /* Build full macro (may have line continuations) */
-    /* Find actual #define in line (may have leading spaces) */
-    char *def = strstr(p->line, "#define");
-    if (!def) return;
-    
-    char sig[MAX_SIG] = {0};
-    safe_strcpy(sig, def, MAX_SIG);
-    
-    while (1) {
-        size_t sig_len = strlen(sig);
-        int has_backslash = (sig_len > 0 && sig[sig_len - 1] == '\\');
-        int penultimate_backslash = (sig_len > 1 && sig[sig_len - 2] == '\\');
-        if (!has_backslash && !penultimate_backslash) {
-            break;
+/* ═══════════════════════════════════════════════════════════════════════════
+ * SOURCE WINDOW
+ *
+ * A streamed source is parsed through a window over its input. The parser
+ * only ever sees whole lines: p->end stops after the last newline read, and
+ * the partial line beyond it waits for the next refill. Refilling slides the
+ * unread tail to the front of the buffer, which moves every pointer into it,
+ * so slices taken while streaming copy into the arena (see src_slice()).
+ * The window grows only to fit the longest line.
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+typedef struct SourceStream {
+    int fd;
+    size_t len;          /* bytes held in doc->src, exposed or not */
+    size_t cap;
+    int eof;
+} SourceStream;
+
+/* Slide the window past the consumed input and read more; returns 0 when
+ * nothing is left */
+static int stream_refill(Parser *p) {
+    SourceStream *st = p->stream;
+    DOCUNATION *doc = p->doc;
+    char *buf = (char *)doc->src;
+    size_t keep = st->len - (size_t)(p->cur - buf);
+    if (keep) memmove(buf, p->cur, keep);
+    st->len = keep;
+
+    size_t scanned = keep;   /* the kept partial line has no newline */
+    const char *last_nl = NULL;
+    while (!last_nl && !st->eof) {
+        if (st->len == st->cap) {
+            if (st->cap > INT32_MAX / 2) {
+                fprintf(stderr, "Error: input line too long\n");
+                st->eof = 1;
+                break;
+            }
+            char *grown = realloc(buf, st->cap * 2);
+            if (!grown) {
+                fprintf(stderr, "Error: Cannot allocate memory\n");
+                st->eof = 1;
+                break;
+            }
+            buf = grown;
+            st->cap *= 2;
+            doc->src = buf;
         }
-        if (has_backslash) {
-            sig[sig_len - 1] = ' ';
+        ssize_t n = read(st->fd, buf + st->len, st->cap - st->len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n < 0) fprintf(stderr, "Error: Cannot read input: %s\n", strerror(errno));
+            st->eof = 1;
+            break;
         }
-        if (!fgets(p->line, MAX_LINE, p->fp)) break;
-        p->line_num++;
-        char *trimmed = trim(p->line);
-        if (strlen(sig) + strlen(trimmed) < MAX_SIG - 1) {
-            safe_append(sig, trimmed, MAX_SIG);
+        st->len += (size_t)n;
+        for (const char *c = buf + st->len; c > buf + scanned; c--) {
+            if (c[-1] == '\n') {
+                last_nl = c;
+                break;
+            }
         }
+        scanned = st->len;
     }
-    
-    /* Extract name */
-    char *name_start = sig + 7;  /* Skip "#define" */
-    while (*name_start && isspace((unsigned char)*name_start)) name_start++;
-    char *name_end = name_start;
-    while (*name_end && (is_ident_char(*name_end) || *name_end == '(')) {
-        if (*name_end == '(') break;  /* Function-like macro */
-        name_end++;
-    }
-    
-    int len = name_end - name_start;
-    if (len > 0 && len < MAX_NAME) {
-        strncpy(node->name, name_start, len);
-        node->name[len] = '\0';
-    }
-    
-    safe_strcpy(node->signature, trim(sig), MAX_SIG);
-    
-    /* Copy docstring */
-    if (p->pending_comment_line == node->line - 1) {
-        safe_strcpy(node->docstring, p->pending_comment, MAX_DOC);
-        p->pending_comment[0] = '\0';
+
+    doc->src_len = st->len;
+    p->cur = buf;
+    p->end = last_nl ? last_nl : buf + st->len;
+    return p->end > p->cur;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * BODY SKIPPING
+ *
+ * Nothing inside a function body or initializer is documented except macros,
+ * so body lines are never lexed. skip_body() scans ahead for the few bytes
+ * that can change the brace depth or hide a brace from it - braces, quotes,
+ * comments and '#' - sixteen bytes at a time where SSE2 is available, and
+ * counts the newlines it passes so line numbers stay exact.
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/* 1: byte that matters inside a body, 2: newline */
+static const unsigned char body_class[256] = {
+    ['{'] = 1, ['}'] = 1, ['"'] = 1, ['\''] = 1, ['/'] = 1, ['#'] = 1,
+    ['\n'] = 2,
+};
+
+/* Count newlines in [s, e) */
+static int count_newlines(const char *s, const char *e) {
+    int n = 0;
+    while (s < e && (s = memchr(s, '\n', (size_t)(e - s))) != NULL) {
+        n++;
+        s++;
     }
-    
-    ADD_NODE(p);
+    return n;
 }
 
-/* Parse an #include */
-static void parse_include(Parser *p) {
-    DocNode *node = &p->doc->nodes[p->doc->node_count];
-    memset(node, 0, sizeof(DocNode));
-    
-    node->type = NODE_INCLUDE;
-    node->line = p->line_num;
-    
-    /* Extract filename */
-    char *start = strchr(p->line, '<');
-    char *end = NULL;
-    if (start) {
-        start++;
-        end = strchr(start, '>');
-    } else {
-        start = strchr(p->line, '"');
-        if (start) {
-            start++;
-            end = strchr(start, '"');
+/* Next byte in [s, e) that matters inside a body; newlines passed over are
+ * added to *lines */
+static const char *body_next(const char *s, const char *e, int *lines) {
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i lb = _mm_set1_epi8('{');
+    const __m128i rb = _mm_set1_epi8('}');
+    const __m128i dq = _mm_set1_epi8('"');
+    const __m128i sq = _mm_set1_epi8('\'');
+    const __m128i sl = _mm_set1_epi8('/');
+    const __m128i hs = _mm_set1_epi8('#');
+    while (e - s >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)s);
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lb), _mm_cmpeq_epi8(v, rb)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, dq), _mm_cmpeq_epi8(v, sq)));
+        m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, sl), _mm_cmpeq_epi8(v, hs)));
+        unsigned hit = (unsigned)_mm_movemask_epi8(m);
+        unsigned nls = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (hit) {
+            int i = __builtin_ctz(hit);
+            *lines += __builtin_popcount(nls & ((1u << i) - 1));
+            return s + i;
         }
+        *lines += __builtin_popcount(nls);
+        s += 16;
     }
-    
-    if (start && end && end > start) {
-        int len = end - start;
-        if (len < MAX_NAME) {
-            strncpy(node->name, start, len);
-            node->name[len] = '\0';
-        }
+#endif
+    for (; s < e; s++) {
+        unsigned char k = body_class[(unsigned char)*s];
+        if (k == 1) return s;
+        if (k == 2) (*lines)++;
     }
-    
-    safe_strcpy(node->signature, trim(p->line), MAX_SIG);
-    ADD_NODE(p);
+    return e;
 }
 
-/* Parse a static/const variable or constant */
-static void parse_variable(Parser *p, const char *line, int is_static) {
-    DocNode *node = &p->doc->nodes[p->doc->node_count];
-    memset(node, 0, sizeof(DocNode));
-    
-    node->type = NODE_VARIABLE;
-    node->line = p->line_num;
-    node->is_static = is_static;
-    
-    /* Build full declaration (may span multiple lines) */
-    char sig[MAX_SIG] = {0};
-    safe_strcpy(sig, line, MAX_SIG);
-    
-    /* If we have an array initializer, read until } or ; */
-    if (strchr(sig, '{') && !strchr(sig, '}')) {
-        while (fgets(p->line, MAX_LINE, p->fp)) {
-            p->line_num++;
-            if (strlen(sig) + strlen(p->line) < MAX_SIG - 10) {
-                safe_append(sig, " ", MAX_SIG);
+/* Skip from p->cur to the brace closing the open body, stopping early at a
+ * preprocessor line so the parser still sees it. Leaves the parser exactly
+ * as lexing every skipped line would have: depth, comment state and line
+ * number, with p->cur resuming just after the closing brace. */
+static void skip_body(Parser *p) {
+    const char *src = p->doc->src;
+    const char *s = p->cur;
+    const char *e = p->end;
+    int depth = p->depth;
+    int lines = 0;
+
+    for (;;) {
+        while (s < e) {
+            if (p->in_comment) {
+                const char *close = span_find(s, e, "*/");
+                const char *stop = close ? close + 2 : e;
+                lines += count_newlines(s, stop);
+                if (close) p->in_comment = 0;
+                s = stop;
+                continue;
             }
-            if (strchr(p->line, '}') || strchr(p->line, ';')) {
+            s = body_next(s, e, &lines);
+            if (s >= e) break;
+
+            const char *eol = memchr(s, '\n', (size_t)(e - s));
+            if (!eol) eol = e;
+            switch (*s) {
+            case '"':
+            case '\'':
+                /* Literals end with their line, as in lex_line() */
+                s = skip_literal(s, eol);
+                continue;
+            case '/':
+                if (s + 1 < e && s[1] == '/') {
+                    s = eol;
+                    continue;
+                }
+                if (s + 1 < e && s[1] == '*') {
+                    p->in_comment = 1;
+                    s += 2;
+                    continue;
+                }
+                break;
+            case '#': {
+                const char *t = s;
+                while (t > src && t[-1] != '\n' && isspace((unsigned char)t[-1])) t--;
+                if (t == src || t[-1] == '\n') {
+                    /* Hand the directive line back to the parser */
+                    p->cur = t;
+                    p->depth = depth;
+                    p->line_num += lines;
+                    return;
+                }
                 break;
             }
-        }
-    }
-    
-    /* Extract variable name:
-     * Look for identifier before [ or = */
-    const char *s = line;
-    
-    /* Skip leading type keywords */
-    if (strncmp(s, "static ", 7) == 0) s += 7;
-    while (*s && isspace((unsigned char)*s)) s++;
-    if (strncmp(s, "const ", 6) == 0) s += 6;
-    while (*s && isspace((unsigned char)*s)) s++;
-    
-    /* Skip the type (int, char, struct, etc.) */
-    while (*s && (is_ident_char(*s) || *s == ' ' || *s == '*')) {
-        /* Stop at = or [ */
-        if (*s == '=' || *s == '[') break;
-        /* Look for last identifier before = or [ */
-        if (isspace((unsigned char)*s) && *(s+1) && is_ident_char(*(s+1))) {
-            s++;
-            const char *name_start = s;
-            const char *name_end = s;
-            while (*name_end && is_ident_char(*name_end)) name_end++;
-            
-            /* Check if next non-space char is [ or = */
-            const char *c = name_end;
-            while (*c && isspace((unsigned char)*c)) c++;
-            if (*c == '[' || *c == '=' || *c == ';') {
-                int len = name_end - name_start;
-                if (len > 0 && len < MAX_NAME) {
-                    strncpy(node->name, name_start, len);
-                    node->name[len] = '\0';
+            case '{':
+                depth++;
+                break;
+            case '}':
+                /* A column-0 brace closes the body whatever the depth says */
+                if (--depth <= 0 || s == src || s[-1] == '\n') {
+                    p->cur = s + 1;
+                    p->depth = 0;
+                    p->mid_line = 1;
+                    p->line_num += lines + 1;
+                    return;
                 }
                 break;
             }
+            s++;
         }
-        s++;
+
+        /* Out of window with the body still open: slide it and carry on */
+        p->cur = e;
+        if (!p->stream || !stream_refill(p)) break;
+        src = p->doc->src;
+        s = p->cur;
+        e = p->end;
     }
-    
-    /* Simplified signature (just the declaration, not the value) */
-    char *eq = strstr(sig, " = ");
-    char *br = strchr(sig, '{');
-    if (eq) *eq = '\0';
-    else if (br) *br = '\0';
-    
-    safe_strcpy(node->signature, trim(sig), MAX_SIG);
-    
-    /* Copy docstring */
-    if (p->pending_comment_line == node->line - 1) {
-        safe_strcpy(node->docstring, p->pending_comment, MAX_DOC);
-        p->pending_comment[0] = '\0';
+    p->depth = depth;
+    p->line_num += lines;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * PREPROCESSOR CONDITIONALS
+ *
+ * Open #if groups are kept on a stack. Each branch is evaluated against the
+ * -D/-U set in three-valued logic: a name the set does not mention is
+ * unknown, so is everything computed from it, and only branches the set
+ * decides are ruled out. Nodes carry the conditions they lie under; with
+ * skip_inactive, ruled-out branches are passed over by a scan that stops
+ * only at directive lines, and nothing in them is documented.
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/* A value in #if arithmetic; unknown when it depends on an unknown name */
+typedef struct {
+    int64_t v;
+    int known;
+} CondValue;
+
+typedef struct {
+    const char *s;       /* NUL-terminated at e */
+    const char *e;
+    const DefineSet *defines;
+    int depth;           /* operand nesting, bounded */
+    int bad;             /* not an expression */
+} CondLexer;
+
+static const Define *define_find(const DefineSet *set, const char *name, size_t len) {
+    if (!set) return NULL;
+    for (int i = 0; i < set->count; i++) {
+        const char *d = set->items[i].name;
+        if (strncmp(d, name, len) == 0 && d[len] == '\0') return &set->items[i];
     }
-    
-    ADD_NODE(p);
+    return NULL;
 }
 
-/* Main parser loop */
-static void parse_file(Parser *p) {
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    strftime(p->doc->timestamp, sizeof(p->doc->timestamp), 
-             "%Y-%m-%dT%H:%M:%S", t);
-    
-    while (next_line(p)) {
-        char *line = ltrim(p->line);
-        
-        /* Block comment */
-        if (starts_with(line, "/*")) {
-            parse_block_comment(p);
-            
-            /* Check if this is file-level doc (first comment) */
-            if (p->doc->node_count == 0 && p->doc->docstring[0] == '\0') {
-                safe_strcpy(p->doc->docstring, p->pending_comment, MAX_DOC);
-            }
-            continue;
+/* Record -D NAME[=VALUE] (defined) or -U NAME, replacing an earlier mention
+ * of the name. A value that is not an integer leaves the macro defined with
+ * an unknown value. */
+static int define_add(DefineSet *set, const char *arg, int defined) {
+    size_t len = strcspn(arg, "=");
+    if (!len || (!defined && arg[len])) {
+        fprintf(stderr, "Error: -%c needs a macro name, got '%s'\n", defined ? 'D' : 'U', arg);
+        return -1;
+    }
+    Define *d = (Define *)define_find(set, arg, len);
+    if (!d) {
+        char *name = malloc(len + 1);
+        Define *items = name ? realloc(set->items, (size_t)(set->count + 1) * sizeof(Define)) : NULL;
+        if (!items) {
+            free(name);
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            return -1;
         }
-        
-        /* Line comment */
-        if (starts_with(line, "//")) {
-            clean_comment(line, p->pending_comment, MAX_DOC);
-            p->pending_comment_line = p->line_num;
-            continue;
+        memcpy(name, arg, len);
+        name[len] = '\0';
+        set->items = items;
+        d = &set->items[set->count++];
+        d->name = name;
+    }
+    d->defined = defined;
+    d->value = 0;
+    d->has_value = 0;
+    if (defined) {
+        const char *v = arg[len] == '=' ? arg + len + 1 : "1";
+        char *end;
+        errno = 0;
+        long long n = strtoll(v, &end, 0);
+        while (*end == 'u' || *end == 'U' || *end == 'l' || *end == 'L') end++;
+        if (end != v && !*end && errno == 0) {
+            d->value = n;
+            d->has_value = 1;
         }
-        
-        /* Preprocessor */
-        if (line[0] == '#') {
-            if (starts_with(line, "#include")) {
-                parse_include(p);
-            } else if (starts_with(line, "#define")) {
-                parse_macro(p);
+    }
+    return 0;
+}
+
+static void define_set_free(DefineSet *set) {
+    for (int i = 0; i < set->count; i++) free(set->items[i].name);
+    free(set->items);
+    set->items = NULL;
+    set->count = 0;
+}
+
+/* What a parse depends on besides the source: 0 when nothing is set */
+static uint64_t defines_fingerprint(const DefineSet *set) {
+    if (!set || (!set->count && !set->skip_inactive)) return 0;
+    uint64_t h = fnv1a64(&set->skip_inactive, sizeof(set->skip_inactive));
+    for (int i = 0; i < set->count; i++) {
+        const Define *d = &set->items[i];
+        int64_t fields[3] = { d->defined, d->has_value, d->value };
+        h = (h ^ fnv1a64(d->name, strlen(d->name) + 1)) * 0x100000001b3ULL;
+        h = (h ^ fnv1a64(fields, sizeof(fields))) * 0x100000001b3ULL;
+    }
+    return h ? h : 1;
+}
+
+/* Skip spaces and comments */
+static void cond_space(CondLexer *lx) {
+    for (;;) {
+        while (lx->s < lx->e && isspace((unsigned char)*lx->s)) lx->s++;
+        if (lx->e - lx->s < 2 || lx->s[0] != '/' || (lx->s[1] != '*' && lx->s[1] != '/')) return;
+        const char *close = lx->s[1] == '*' ? span_find(lx->s + 2, lx->e, "*/") : NULL;
+        lx->s = close ? close + 2 : lx->e;
+    }
+}
+
+static CondValue cond_expr(CondLexer *lx);
+
+/* A name, number, parenthesized expression or unary operation */
+static CondValue cond_unary(CondLexer *lx) {
+    CondValue v = { 0, 0 };
+    cond_space(lx);
+    if (lx->s >= lx->e || lx->depth >= 4 * COND_MAX_DEPTH) {
+        lx->bad = 1;
+        return v;
+    }
+    lx->depth++;
+    char c = *lx->s;
+    if (c == '(') {
+        lx->s++;
+        v = cond_expr(lx);
+        cond_space(lx);
+        if (lx->s < lx->e && *lx->s == ')') lx->s++;
+        else lx->bad = 1;
+    } else if (c == '!' || c == '~' || c == '-' || c == '+') {
+        lx->s++;
+        v = cond_unary(lx);
+        if (c == '!') v.v = !v.v;
+        else if (c == '~') v.v = ~v.v;
+        else if (c == '-') v.v = (int64_t)(0 - (uint64_t)v.v);
+    } else if (isdigit((unsigned char)c)) {
+        char *end;
+        v.v = (int64_t)strtoull(lx->s, &end, 0);
+        v.known = 1;
+        lx->s = end;
+        while (lx->s < lx->e && strchr("uUlL", *lx->s)) lx->s++;
+        if (lx->s < lx->e && (is_ident_char(*lx->s) || *lx->s == '.')) lx->bad = 1;
+    } else if (c == '\'') {
+        const char *end = skip_literal(lx->s, lx->e);
+        v.known = end - lx->s == 3 && lx->s[1] != '\\';
+        v.v = (unsigned char)lx->s[1];
+        lx->s = end;
+    } else if (is_ident_char(c)) {
+        const char *name = lx->s;
+        while (lx->s < lx->e && is_ident_char(*lx->s)) lx->s++;
+        size_t len = (size_t)(lx->s - name);
+        cond_space(lx);
+        int paren = lx->s < lx->e && *lx->s == '(';
+        if (len == 7 && memcmp(name, "defined", 7) == 0) {
+            if (paren) {
+                lx->s++;
+                cond_space(lx);
             }
+            name = lx->s;
+            while (lx->s < lx->e && is_ident_char(*lx->s)) lx->s++;
+            len = (size_t)(lx->s - name);
+            cond_space(lx);
+            if (paren && lx->s < lx->e && *lx->s == ')') lx->s++;
+            else if (paren) lx->bad = 1;
+            const Define *d = len ? define_find(lx->defines, name, len) : NULL;
+            if (!len) lx->bad = 1;
+            if (d) v = (CondValue){ d->defined, 1 };
+        } else if (paren) {
+            /* A function-like macro or __has_include(): unknown */
+            int depth = 0;
+            for (; lx->s < lx->e; lx->s++) {
+                if (*lx->s == '(') depth++;
+                else if (*lx->s == ')' && --depth == 0) break;
+            }
+            if (lx->s < lx->e) lx->s++;
+        } else {
+            const Define *d = define_find(lx->defines, name, len);
+            if (d && !d->defined) v = (CondValue){ 0, 1 };
+            else if (d && d->has_value) v = (CondValue){ d->value, 1 };
+        }
+    } else {
+        lx->bad = 1;
+    }
+    lx->depth--;
+    return v;
+}
+
+/* Precedence of the binary operator at lx->s, tighter binding higher, and
+ * its length; 0 when there is none */
+static int cond_binop(const CondLexer *lx, int *len) {
+    char c = lx->s < lx->e ? lx->s[0] : '\0';
+    char d = lx->s + 1 < lx->e ? lx->s[1] : '\0';
+    *len = 2;
+    if (c == '|' && d == '|') return 1;
+    if (c == '&' && d == '&') return 2;
+    if ((c == '=' || c == '!') && d == '=') return 6;
+    if ((c == '<' || c == '>') && d == '=') return 7;
+    if ((c == '<' || c == '>') && d == c) return 8;
+    *len = 1;
+    switch (c) {
+    case '|': return 3;
+    case '^': return 4;
+    case '&': return 5;
+    case '<': case '>': return 7;
+    case '+': case '-': return 9;
+    case '*': case '/': case '%': return 10;
+    }
+    return 0;
+}
+
+static CondValue cond_apply(const char *op, int len, CondValue a, CondValue b) {
+    CondValue r = { 0, a.known && b.known };
+    /* A known operand can decide && and || alone */
+    if (len == 2 && op[0] == '&') {
+        if ((a.known && !a.v) || (b.known && !b.v)) return (CondValue){ 0, 1 };
+        r.v = a.v && b.v;
+        return r;
+    }
+    if (len == 2 && op[0] == '|') {
+        if ((a.known && a.v) || (b.known && b.v)) return (CondValue){ 1, 1 };
+        r.v = a.v || b.v;
+        return r;
+    }
+    if (!r.known) return r;
+    uint64_t ua = (uint64_t)a.v;
+    uint64_t ub = (uint64_t)b.v;
+    switch (op[0]) {
+    case '*': r.v = (int64_t)(ua * ub); break;
+    case '+': r.v = (int64_t)(ua + ub); break;
+    case '-': r.v = (int64_t)(ua - ub); break;
+    case '/':
+    case '%':
+        if (!b.v || (a.v == INT64_MIN && b.v == -1)) r.known = 0;
+        else r.v = op[0] == '/' ? a.v / b.v : a.v % b.v;
+        break;
+    case '<':
+    case '>':
+        if (len == 2 && op[1] == op[0]) {
+            if (b.v < 0 || b.v > 63) r.known = 0;
+            else r.v = op[0] == '<' ? (int64_t)(ua << b.v) : a.v >> b.v;
+        } else if (op[0] == '<') {
+            r.v = len == 2 ? a.v <= b.v : a.v < b.v;
+        } else {
+            r.v = len == 2 ? a.v >= b.v : a.v > b.v;
+        }
+        break;
+    case '=': r.v = a.v == b.v; break;
+    case '!': r.v = a.v != b.v; break;
+    case '&': r.v = a.v & b.v; break;
+    case '^': r.v = a.v ^ b.v; break;
+    case '|': r.v = a.v | b.v; break;
+    }
+    return r;
+}
+
+/* Operators binding at least as tightly as min_prec */
+static CondValue cond_binary(CondLexer *lx, int min_prec) {
+    CondValue a = cond_unary(lx);
+    for (;;) {
+        cond_space(lx);
+        int len;
+        int prec = cond_binop(lx, &len);
+        if (!prec || prec < min_prec) return a;
+        const char *op = lx->s;
+        lx->s += len;
+        a = cond_apply(op, len, a, cond_binary(lx, prec + 1));
+    }
+}
+
+static CondValue cond_expr(CondLexer *lx) {
+    CondValue c = cond_binary(lx, 1);
+    cond_space(lx);
+    if (lx->s >= lx->e || *lx->s != '?') return c;
+    lx->s++;
+    CondValue t = cond_expr(lx);
+    cond_space(lx);
+    if (lx->s >= lx->e || *lx->s != ':') {
+        lx->bad = 1;
+        return c;
+    }
+    lx->s++;
+    CondValue f = cond_expr(lx);
+    if (c.known) return c.v ? t : f;
+    if (t.known && f.known && t.v == f.v) return t;
+    return (CondValue){ 0, 0 };
+}
+
+/* COND_TRUE, COND_FALSE or COND_UNKNOWN for the #if expression [s, e),
+ * which must be followed by a NUL */
+static int cond_eval(const DefineSet *defines, const char *s, const char *e) {
+    CondLexer lx = { s, e, defines, 0, 0 };
+    CondValue v = cond_expr(&lx);
+    cond_space(&lx);
+    if (lx.bad || lx.s < lx.e || !v.known) return COND_UNKNOWN;
+    return v.v ? COND_TRUE : COND_FALSE;
+}
+
+static void cond_put(Parser *p, const char *s, size_t len) {
+    size_t room = sizeof(p->cond_text) - p->cond_len;
+    if (len > room) {
+        len = room;
+        p->doc->truncated++;
+    }
+    memcpy(p->cond_text + p->cond_len, s, len);
+    p->cond_len += len;
+}
+
+/* Is the condition text one operand: wholly in parentheses, or a name
+ * with no operator outside its call parentheses, such as defined(X)? */
+static int cond_operand(const char *s, size_t len) {
+    int depth = 0;
+    if (len && s[0] == '(') {
+        for (size_t i = 0; i < len; i++) {
+            if (s[i] == '(') depth++;
+            else if (s[i] == ')' && --depth == 0) return i + 1 == len;
+        }
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '(') depth++;
+        else if (s[i] == ')') depth--;
+        else if (!depth && !is_ident_char(s[i])) return 0;
+    }
+    return len > 0;
+}
+
+/* Append the negation of a condition */
+static void cond_put_not(Parser *p, const char *s, size_t len) {
+    if (len > 1 && s[0] == '!' && cond_operand(s + 1, len - 1)) {
+        cond_put(p, s + 1, len - 1);
+    } else if (cond_operand(s, len)) {
+        cond_put(p, "!", 1);
+        cond_put(p, s, len);
+    } else {
+        cond_put(p, "!(", 2);
+        cond_put(p, s, len);
+        cond_put(p, ")", 1);
+    }
+}
+
+/* Append an #if expression with comments dropped and spaces collapsed, in
+ * parentheses where joining it with && would change its meaning */
+static void cond_put_expr(Parser *p, const char *s, const char *e) {
+    char text[MAX_LINE];
+    size_t len = 0;
+    int gap = 0;
+    while (s < e) {
+        if (*s == '/' && s + 1 < e && (s[1] == '*' || s[1] == '/')) {
+            const char *close = s[1] == '*' ? span_find(s + 2, e, "*/") : NULL;
+            s = close ? close + 2 : e;
+            gap = 1;
             continue;
         }
-        
-        /* Check for keywords */
-        int is_static = (strstr(line, "static ") != NULL);
-        int is_inline = (strstr(line, "inline ") != NULL);
-        int is_extern = (strstr(line, "extern ") != NULL);
-        
-        /* Struct/Union/Enum */
-        if (strstr(line, "struct ") && !strstr(line, "typedef")) {
-            parse_aggregate(p, NODE_STRUCT);
+        if (isspace((unsigned char)*s)) {
+            gap = 1;
+            s++;
             continue;
         }
-        if (strstr(line, "union ") && !strstr(line, "typedef")) {
-            parse_aggregate(p, NODE_UNION);
+        const char *tok_end = *s == '"' || *s == '\'' ? skip_literal(s, e) : s + 1;
+        if (gap && len && len < sizeof(text)) text[len++] = ' ';
+        gap = 0;
+        for (; s < tok_end && len < sizeof(text); s++) text[len++] = *s;
+        s = tok_end;
+    }
+    if (!len) return;
+    int wrap = !cond_operand(text, len) && (memchr(text, '?', len) || span_find(text, text + len, "||"));
+    if (wrap) cond_put(p, "(", 1);
+    cond_put(p, text, len);
+    if (wrap) cond_put(p, ")", 1);
+}
+
+/* Append the condition of a branch: the expression [s, e) when negate is
+ * -1, or else the name [s, e) tested by #ifdef (0) or #ifndef (1) */
+static void cond_put_branch(Parser *p, const char *s, const char *e, int negate) {
+    if (negate < 0) {
+        cond_put_expr(p, s, e);
+        return;
+    }
+    cond_put(p, negate ? "!defined(" : "defined(", negate ? 9 : 8);
+    cond_put(p, s, (size_t)(e - s));
+    cond_put(p, ")", 1);
+}
+
+/* Count the groups in a branch known false, after the stack changed */
+static void cond_update(Parser *p) {
+    int tracked = p->cond_depth < COND_MAX_DEPTH ? p->cond_depth : COND_MAX_DEPTH;
+    int dead = 0;
+    for (int i = 0; i < tracked; i++) dead += p->conds[i].state == COND_FALSE;
+    p->cond_dead = dead;
+    p->cond_cached = 0;
+}
+
+/* Open a group whose first branch has the given state and condition, as
+ * for cond_put_branch() */
+static void cond_open(Parser *p, int state, const char *s, const char *e, int negate) {
+    if (p->cond_depth++ >= COND_MAX_DEPTH) return;
+    CondFrame *f = &p->conds[p->cond_depth - 1];
+    memset(f, 0, sizeof(*f));
+    f->start = (uint32_t)p->cond_len;
+    if (p->cond_len) cond_put(p, " && ", 4);
+    f->own = (uint32_t)p->cond_len;
+    cond_put_branch(p, s, e, negate);
+    f->state = (uint8_t)state;
+    f->taken = state == COND_TRUE;
+    f->maybe = state == COND_UNKNOWN;
+    f->events = p->cond_events;
+    f->nodes = p->node_total;
+    cond_update(p);
+}
+
+/* Move the innermost group to its next branch: #else when s is NULL */
+static void cond_branch(Parser *p, int state, const char *s, const char *e, int negate) {
+    if (!p->cond_depth || p->cond_depth > COND_MAX_DEPTH) return;
+    CondFrame *f = &p->conds[p->cond_depth - 1];
+    if (!f->guard) {
+        /* The branches so far, negated, then this one's own condition */
+        char own[MAX_LINE];
+        size_t own_len = p->cond_len - f->own;
+        memcpy(own, p->cond_text + f->own, own_len);
+        p->cond_len = f->own;
+        if (own_len) cond_put_not(p, own, own_len);
+        if (s && p->cond_len > f->start + (f->start ? 4 : 0)) cond_put(p, " && ", 4);
+        f->own = (uint32_t)p->cond_len;
+        if (s) cond_put_branch(p, s, e, negate);
+    }
+    if (!s) state = COND_TRUE;
+    int next = f->taken || state == COND_FALSE ? COND_FALSE : f->maybe ? COND_UNKNOWN : state;
+    f->taken |= next == COND_TRUE;
+    f->maybe |= next == COND_UNKNOWN;
+    f->state = (uint8_t)next;
+    cond_update(p);
+}
+
+static void cond_close(Parser *p) {
+    if (!p->cond_depth) return;
+    if (p->cond_depth-- <= COND_MAX_DEPTH) {
+        p->cond_len = p->conds[p->cond_depth].start;
+        cond_update(p);
+    }
+}
+
+/* #define name: right after an outermost #ifndef name, the group is an
+ * include guard and conditions nothing */
+static void cond_define(Parser *p, const char *name, size_t len) {
+    CondFrame *f = &p->conds[0];
+    if (p->cond_depth == 1 && !f->guard && f->events == p->cond_events && f->nodes == p->node_total &&
+        p->cond_len == len + 10 && memcmp(p->cond_text, "!defined(", 9) == 0 &&
+        memcmp(p->cond_text + 9, name, len) == 0) {
+        f->guard = 1;
+        p->cond_len = 0;
+        cond_update(p);
+    }
+    p->cond_events++;
+}
+
+/* With skip_inactive, pass over a ruled-out branch up to the next directive
+ * line, which the parser then reads. Only what can hide a directive is
+ * looked at: comments and literals. */
+static void skip_inactive(Parser *p) {
+    const char *src = p->doc->src;
+    const char *s = p->cur;
+    const char *e = p->end;
+    int lines = 0;
+
+    for (;;) {
+        while (s < e) {
+            if (p->in_comment) {
+                const char *close = span_find(s, e, "*/");
+                const char *stop = close ? close + 2 : e;
+                lines += count_newlines(s, stop);
+                if (close) p->in_comment = 0;
+                s = stop;
+                continue;
+            }
+            s = body_next(s, e, &lines);
+            if (s >= e) break;
+
+            const char *eol = memchr(s, '\n', (size_t)(e - s));
+            if (!eol) eol = e;
+            if (*s == '"' || *s == '\'') {
+                s = skip_literal(s, eol);
+                continue;
+            }
+            if (*s == '/' && s + 1 < e && s[1] == '/') {
+                s = eol;
+                continue;
+            }
+            if (*s == '/' && s + 1 < e && s[1] == '*') {
+                p->in_comment = 1;
+                s += 2;
+                continue;
+            }
+            if (*s == '#') {
+                const char *t = s;
+                while (t > src && t[-1] != '\n' && isspace((unsigned char)t[-1])) t--;
+                if (t == src || t[-1] == '\n') {
+                    p->cur = t;
+                    p->line_num += lines;
+                    return;
+                }
+            }
+            s++;
+        }
+
+        p->cur = e;
+        if (!p->stream || !stream_refill(p)) break;
+        src = p->doc->src;
+        s = p->cur;
+        e = p->end;
+    }
+    p->line_num += lines;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * C PARSER - Functions
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/* Advance to the next line, empty or not */
+static int read_line(Parser *p) {
+    if (p->cur >= p->end && !(p->stream && stream_refill(p))) return 0;
+    const char *nl = memchr(p->cur, '\n', (size_t)(p->end - p->cur));
+    p->raw = p->cur;
+    p->ls = p->cur;
+    p->le = nl ? nl : p->end;
+    p->cur = nl ? nl + 1 : p->end;
+    int resumed = p->mid_line;
+    if (resumed) p->mid_line = 0;
+    else p->line_num++;
+    span_trim(&p->ls, &p->le);
+    lex_line(p);
+    /* The rest of a line that began inside a body is part of that body */
+    if (resumed) p->info.depth = 1;
+    return 1;
+}
+
+/* Read next non-empty line */
+static int next_line(Parser *p) {
+    while (read_line(p)) {
+        if (p->le > p->ls) return 1;
+    }
+    return 0;
+}
+
+/* The current line, or the current line joined with the following ones by
+ * single spaces up to the first line containing a byte from stops. When
+ * balanced is set, a stop only counts once every brace opened since the
+ * first line has been closed again. */
+static Slice join_lines_until(Parser *p, const char *stops, int balanced) {
+    DOCUNATION *doc = p->doc;
+    int base = p->info.depth;
+#define JOIN_DONE() (span_has_any(p->ls, p->le, stops) && (!balanced || p->depth <= base))
+    if (JOIN_DONE()) return src_slice(doc, p->ls, p->le);
+
+    Arena *a = &doc->arena;
+    size_t mark = a->len;
+    arena_append(a, p->ls, (size_t)(p->le - p->ls));
+    while (read_line(p)) {
+        arena_append(a, " ", 1);
+        arena_append(a, p->ls, (size_t)(p->le - p->ls));
+        if (JOIN_DONE()) break;
+    }
+#undef JOIN_DONE
+    return arena_seal(a, mark);
+}
+
+/* Parse a block comment, measuring it for hold_comment() */
+static void parse_block_comment(Parser *p) {
+    /* A streamed window slides under the comment, so keep its bytes */
+    char *keep = p->doc->src_moving ? p->comment_buf : NULL;
+    const char *start = p->raw;
+    size_t len = (size_t)(p->le - p->raw);
+    int cut = len > MAX_DOC - 1;
+    if (cut) len = MAX_DOC - 1;
+    if (keep) memcpy(keep, p->raw, len);
+    const char *first_end = start + len;
+    const char *end = first_end;
+    
+    /* Read until end of comment unless it ends on the same line */
+    if (!span_find(p->ls, p->le, "*/")) {
+        while (read_line(p)) {
+            size_t line_len = (size_t)(p->cur - p->raw);
+            if (len + line_len < MAX_DOC - 1) {
+                if (keep) memcpy(keep + len, p->raw, line_len);
+                len += line_len;
+            } else {
+                cut = 1;
+            }
+            if (span_find(p->ls, p->le, "*/")) break;
+        }
+        end = p->cur;
+    }
+    p->doc->truncated += cut;
+    
+    if (keep) hold_comment(p, keep, keep + len, keep + len);
+    else hold_comment(p, start, first_end, end);
+}
+
+/* Parse a function declaration/definition */
+static void parse_function(Parser *p, int is_static, int is_inline, int is_extern) {
+    DocNode *node = next_node(p);
+    if (!node) return;
+    DOCUNATION *doc = p->doc;
+    
+    node->type = NODE_FUNCTION;
+    node->line = p->line_num;
+    node->is_static = is_static;
+    node->is_inline = is_inline;
+    node->is_extern = is_extern;
+    
+    /* Build full signature: read until { or ; */
+    Slice full = join_lines_until(p, "{;", 0);
+    const char *sig = doc_str(doc, full);
+    const char *sig_end = sig + full.len;
+    
+    /* Clean up signature - remove body */
+    const char *brace = span_chr(sig, sig_end, '{');
+    if (brace) sig_end = brace;
+    node->has_body = brace != NULL;
+    const char *semi = span_chr(sig, sig_end, ';');
+    if (semi) sig_end = semi;
+    
+    /* Trim and save signature */
+    span_trim(&sig, &sig_end);
+    node->signature = sub_slice(doc, full, sig, sig_end);
+    
+    /* Extract function name (last identifier before '(') */
+    const char *paren = span_chr(sig, sig_end, '(');
+    if (paren && paren > sig) {
+        /* Walk backwards to find name */
+        const char *name_end = paren - 1;
+        while (name_end > sig && isspace((unsigned char)*name_end)) name_end--;
+        const char *name_start = name_end;
+        while (name_start > sig && is_ident_char(*(name_start-1))) name_start--;
+        
+        if (name_end >= name_start) {
+            node->name = sub_slice(doc, full, name_start, name_end + 1);
+        }
+        
+        /* Extract return type */
+        const char *ret = sig;
+        const char *ret_end = name_start;
+        span_trim(&ret, &ret_end);
+        node->return_type = sub_slice(doc, full, ret, ret_end);
+    }
+    
+    /* Copy docstring if comment was on previous line */
+    if (p->pending_comment_line == node->line - 1 || 
+        p->pending_comment_line == node->line) {
+        take_pending_comment(p, node);
+    }
+    
+    add_node(p);
+}
+
+/* Parse a struct/union/enum */
+static void parse_aggregate(Parser *p, NodeType type) {
+    DocNode *node = next_node(p);
+    if (!node) return;
+    
+    node->type = type;
+    node->line = p->line_num;
+    
+    /* Extract name */
+    const char *keyword = (type == NODE_STRUCT) ? "struct" :
+                          (type == NODE_UNION) ? "union" : "enum";
+    const char *kw_pos = span_find(p->raw, p->le, keyword);
+    if (kw_pos) {
+        const char *name_start = kw_pos + strlen(keyword);
+        while (name_start < p->le && isspace((unsigned char)*name_start)) name_start++;
+        
+        const char *name_end = name_start;
+        while (name_end < p->le && is_ident_char(*name_end)) name_end++;
+        
+        if (name_end > name_start) node->name = src_slice(p->doc, name_start, name_end);
+    }
+    
+    /* If anonymous, use placeholder */
+    if (node->name.len == 0) {
+        char placeholder[64];
+        snprintf(placeholder, sizeof(placeholder), "(anonymous %s)", keyword);
+        node->name = arena_str(&p->doc->arena, placeholder);
+    }
+    
+    /* Build signature */
+    node->signature = src_slice(p->doc, p->ls, p->le);
+
+    /* A body opens on this line or the next; "struct name;" has none */
+    const char *next = p->le;
+    while (next < p->end && isspace((unsigned char)*next)) next++;
+    node->has_body = span_chr(p->ls, p->le, '{') != NULL || (next < p->end && *next == '{');
+    
+    /* Copy docstring */
+    if (p->pending_comment_line == node->line - 1) {
+        take_pending_comment(p, node);
+    }
+    
+    add_node(p);
+}
+
+/* Parse a typedef */
+static void parse_typedef(Parser *p) {
+    DocNode *node = next_node(p);
+    if (!node) return;
+    DOCUNATION *doc = p->doc;
+    
+    node->type = NODE_TYPEDEF;
+    node->line = p->line_num;
+    
+    /* Build full typedef (may span lines, including an aggregate body) */
+    Slice full = join_lines_until(p, ";", 1);
+    const char *sig = doc_str(doc, full);
+    const char *sig_end = sig + full.len;
+    
+    /* Remove trailing semicolon, which follows the body if there is one */
+    const char *body_end = sig_end;
+    while (body_end > sig && body_end[-1] != '}') body_end--;
+    const char *semi = span_chr(body_end, sig_end, ';');
+    if (semi) sig_end = semi;
+    
+    /* Extract name (last identifier before ;) */
+    const char *end = sig_end - 1;
+    while (end > sig && isspace((unsigned char)*end)) end--;
+    const char *name_start = end;
+    while (name_start > sig && is_ident_char(*(name_start-1))) name_start--;
+    
+    if (end >= name_start) node->name = sub_slice(doc, full, name_start, end + 1);
+    
+    span_trim(&sig, &sig_end);
+    node->signature = sub_slice(doc, full, sig, sig_end);
+    
+    /* Copy docstring */
+    if (p->pending_comment_line == node->line - 1) {
+        take_pending_comment(p, node);
+    }
+    
+    add_node(p);
+}
+
+/* Parse a #define macro */
+static void parse_macro(Parser *p) {
+    DocNode *node = next_node(p);
+    if (!node) return;
+    DOCUNATION *doc = p->doc;
+    
+    node->type = NODE_MACRO;
+    node->line = p->line_num;
+    
+    /* Find actual #define in line (may have leading spaces) */
+    const char *def = span_find(p->ls, p->le, "#define");
+    if (!def) return;
+    
+    /* Build full macro (may have line continuations) */
+    Slice full;
+    if (p->le[-1] != '\\') {
+        full = src_slice(doc, def, p->le);
+    } else {
+        Arena *a = &doc->arena;
+        size_t mark = a->len;
+        arena_append(a, def, (size_t)(p->le - def));
+        while (a->len > mark && a->data[a->len - 1] == '\\') {
+            a->data[a->len - 1] = ' ';
+            if (!read_line(p)) break;
+            arena_append(a, p->ls, (size_t)(p->le - p->ls));
+        }
+        full = arena_seal(a, mark);
+    }
+    const char *sig = doc_str(doc, full);
+    const char *sig_end = sig + full.len;
+    
+    /* Extract name */
+    const char *name_start = sig + 7;  /* Skip "#define" */
+    while (name_start < sig_end && isspace((unsigned char)*name_start)) name_start++;
+    const char *name_end = name_start;
+    while (name_end < sig_end && is_ident_char(*name_end)) {
+        name_end++;  /* Stops at '(' of a function-like macro */
+    }
+    
+    if (name_end > name_start) node->name = sub_slice(doc, full, name_start, name_end);
+    cond_define(p, name_start, (size_t)(name_end - name_start));
+    
+    span_trim(&sig, &sig_end);
+    node->signature = sub_slice(doc, full, sig, sig_end);
+    
+    /* Copy docstring */
+    if (p->pending_comment_line == node->line - 1) {
+        take_pending_comment(p, node);
+    }
+    
+    add_node(p);
+}
+
+/* Parse an #include */
+static void parse_include(Parser *p) {
+    DocNode *node = next_node(p);
+    if (!node) return;
+    
+    node->type = NODE_INCLUDE;
+    node->line = p->line_num;
+    
+    /* Extract filename */
+    const char *start = span_chr(p->ls, p->le, '<');
+    const char *end = NULL;
+    if (start) {
+        start++;
+        end = span_chr(start, p->le, '>');
+    } else {
+        start = span_chr(p->ls, p->le, '"');
+        if (start) {
+            start++;
+            end = span_chr(start, p->le, '"');
+        }
+    }
+    
+    if (start && end && end > start) {
+        node->name = src_slice(p->doc, start, end);
+    }
+    
+    node->signature = src_slice(p->doc, p->ls, p->le);
+    add_node(p);
+}
+
+/* Follow #if, #ifdef, #ifndef, #elif, #elifdef, #elifndef, #else and
+ * #endif; returns 0 for any other directive */
+static int parse_conditional(Parser *p) {
+    const char *s = p->ls + 1;
+    const char *e = p->le;
+    while (s < e && isspace((unsigned char)*s)) s++;
+    const char *kw = s;
+    while (s < e && is_ident_char(*s)) s++;
+#define DIRECTIVE_IS(word) ((size_t)(s - kw) == sizeof(word) - 1 && memcmp(kw, word, sizeof(word) - 1) == 0)
+    int opens = DIRECTIVE_IS("if") || DIRECTIVE_IS("ifdef") || DIRECTIVE_IS("ifndef");
+    int branch = DIRECTIVE_IS("elif") || DIRECTIVE_IS("elifdef") || DIRECTIVE_IS("elifndef");
+    int negate = DIRECTIVE_IS("ifdef") || DIRECTIVE_IS("elifdef") ? 0 :
+                 DIRECTIVE_IS("ifndef") || DIRECTIVE_IS("elifndef") ? 1 : -1;
+    if (DIRECTIVE_IS("else")) {
+        cond_branch(p, COND_TRUE, NULL, NULL, -1);
+    } else if (DIRECTIVE_IS("endif")) {
+        cond_close(p);
+    } else if (!opens && !branch) {
+        return 0;
+    }
+#undef DIRECTIVE_IS
+    p->cond_events++;
+
+    if (opens || branch) {
+        /* The expression, joined with its continuation lines */
+        Arena *a = &p->doc->arena;
+        size_t mark = a->len;
+        arena_append(a, s, (size_t)(e - s));
+        while (a->len > mark && a->data[a->len - 1] == '\\') {
+            a->data[a->len - 1] = ' ';
+            if (!read_line(p)) break;
+            arena_append(a, p->ls, (size_t)(p->le - p->ls));
+        }
+        arena_append(a, "", 1);
+        const char *x = a->len > mark ? a->data + mark : "";
+        const char *x_end = a->len > mark ? a->data + a->len - 1 : x;
+        const DefineSet *defines = p->doc->defines;
+        int state;
+        if (negate >= 0) {
+            while (x < x_end && isspace((unsigned char)*x)) x++;
+            const char *name = x;
+            while (x < x_end && is_ident_char(*x)) x++;
+            const Define *d = define_find(defines, name, (size_t)(x - name));
+            state = !d ? COND_UNKNOWN : d->defined != negate ? COND_TRUE : COND_FALSE;
+            x_end = x;
+            x = name;
+        } else {
+            state = cond_eval(defines, x, x_end);
+        }
+        if (opens) cond_open(p, state, x, x_end, negate);
+        else cond_branch(p, state, x, x_end, negate);
+        a->len = mark;
+    }
+    if (p->cond_dead && p->doc->defines && p->doc->defines->skip_inactive) skip_inactive(p);
+    return 1;
+}
+
+/* Parse a static/const variable or constant */
+static void parse_variable(Parser *p, int is_static) {
+    DocNode *node = next_node(p);
+    if (!node) return;
+    const char *line = p->ls;
+    const char *line_end = p->le;
+    
+    node->type = NODE_VARIABLE;
+    node->line = p->line_num;
+    node->is_static = is_static;
+    
+    /* Extract variable name:
+     * Look for identifier before [ or = */
+    const char *s = line;
+    
+    /* Skip leading type keywords */
+    if (span_starts(s, line_end, "static ")) s += 7;
+    while (s < line_end && isspace((unsigned char)*s)) s++;
+    if (span_starts(s, line_end, "const ")) s += 6;
+    while (s < line_end && isspace((unsigned char)*s)) s++;
+    
+    /* Skip the type (int, char, struct, etc.) */
+    while (s < line_end && (is_ident_char(*s) || *s == ' ' || *s == '*')) {
+        /* Look for last identifier before = or [ */
+        if (isspace((unsigned char)*s) && s + 1 < line_end && is_ident_char(*(s+1))) {
+            s++;
+            const char *name_start = s;
+            const char *name_end = s;
+            while (name_end < line_end && is_ident_char(*name_end)) name_end++;
+            
+            /* Check if next non-space char is [ or = */
+            const char *c = name_end;
+            while (c < line_end && isspace((unsigned char)*c)) c++;
+            if (c < line_end && (*c == '[' || *c == '=' || *c == ';')) {
+                node->name = src_slice(p->doc, name_start, name_end);
+                break;
+            }
+        }
+        s++;
+    }
+    
+    /* Simplified signature (just the declaration, not the value) */
+    const char *sig_end = span_find(line, line_end, " = ");
+    if (!sig_end) sig_end = span_chr(line, line_end, '{');
+    if (!sig_end) sig_end = line_end;
+    const char *sig = line;
+    span_trim(&sig, &sig_end);
+    node->signature = src_slice(p->doc, sig, sig_end);
+    
+    /* Copy docstring */
+    if (p->pending_comment_line == node->line - 1) {
+        take_pending_comment(p, node);
+    }
+    
+    /* If we have an array initializer, skip to its closing } or ; */
+    if (span_chr(line, line_end, '{') && !span_chr(line, line_end, '}')) {
+        while (read_line(p)) {
+            if (span_chr(p->ls, p->le, '}') || span_chr(p->ls, p->le, ';')) {
+                break;
+            }
+        }
+    }
+    
+    add_node(p);
+}
+
+/* Main parser loop */
+static void parse_file(Parser *p) {
+    for (;;) {
+        /* Fast-forward over whatever body the previous line left open */
+        if (p->depth > 0 && !p->in_directive) skip_body(p);
+        if (p->open_node && p->depth == 0) close_node(p);
+        if (!next_line(p)) break;
+        const LineInfo *li = &p->info;
+        const char *line = p->ls;
+        const char *end = p->le;
+        
+        /* Inside a body or the tail of a comment: nothing to document,
+         * though macros defined in a body are still file-wide */
+        if (li->in_comment || (li->depth > 0 && line[0] != '#')) continue;
+        int after_return_type = p->prev_decl_only;
+        p->prev_decl_only = 0;
+        
+        /* Block comment */
+        if (span_starts(line, end, "/*")) {
+            parse_block_comment(p);
+            
+            /* Check if this is file-level doc (first comment) */
+            if (p->node_total == 0 && p->doc->docstring.len == 0) {
+                p->doc->docstring = claim_comment(p);
+                p->arena_keep = p->doc->arena.len;
+            }
+            continue;
+        }
+        
+        /* Line comment */
+        if (span_starts(line, end, "//")) {
+            p->doc->truncated += end - line > MAX_DOC - 1;
+            hold_comment(p, line, end, end);
+            continue;
+        }
+        
+        /* Preprocessor; what a skipped branch holds is passed over */
+        if (line[0] == '#') {
+            if (parse_conditional(p)) continue;
+            if (p->cond_dead && p->doc->defines && p->doc->defines->skip_inactive) {
+                skip_inactive(p);
+            } else if (span_starts(line, end, "#include")) {
+                parse_include(p);
+            } else if (span_starts(line, end, "#define")) {
+                parse_macro(p);
+            }
+            continue;
+        }
+        
+        /* Check for keywords */
+        int is_static = (li->kw & KWF(KW_STATIC)) != 0;
+        int is_inline = (li->kw & KWF(KW_INLINE)) != 0;
+        int is_extern = (li->kw & KWF(KW_EXTERN)) != 0;
+        
+        /* Typedef */
+        if (li->first == KW_TYPEDEF) {
+            parse_typedef(p);
+            continue;
+        }
+        
+        /* Struct/Union/Enum declarations, not variables of those types */
+        if (li->agg_decl) {
+            parse_aggregate(p, li->agg_type);
+            continue;
+        }
+        
+        /* Function (has parentheses but not control statements) 
+         * Must start with a type, be static/inline/extern, or have a
+         * return type ahead of its name, possibly on the line before */
+        if (li->has_paren &&
+            li->first != KW_CONTROL &&
+            !(li->kw & KWF(KW_SIZEOF)) &&
+            !li->has_assign &&
+            !li->has_arrow &&
+            !li->has_member &&
+            (is_static || is_inline || is_extern ||
+             li->first_is_type ||
+             li->star_before_paren ||            /* pointer return */
+             li->idents_before_paren >= 2 ||
+             (after_return_type && li->idents_before_paren == 1))) {
+            parse_function(p, is_static, is_inline, is_extern);
+            continue;
+        }
+        
+        /* Static/const variables (not functions - no parens or has = sign) */
+        if ((is_static || li->first == KW_CONST) && 
+            !li->has_paren &&
+            !li->has_arrow &&
+            (li->has_assign || li->has_bracket)) {
+            parse_variable(p, is_static);
+            continue;
+        }
+        
+        /* Clear pending comment if not consumed */
+        if (p->pending_comment_line < p->line_num - 1) {
+            p->comment = NULL;
+        }
+        p->prev_decl_only = li->decl_only;
+    }
+    /* A body still open at the end of the source runs to it */
+    if (p->open_node) p->doc->nodes[p->open_node - 1].end = (uint32_t)p->doc->src_len;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * SOURCE INPUT
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/* Load a whole source file into the document: mapped read-only where the
+ * platform allows, otherwise read into one heap buffer */
+static int load_source(DOCUNATION *doc, const char *filename) {
+    int fd = strcmp(filename, "-") == 0 ? dup(STDIN_FILENO) : open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if ((uint64_t)st.st_size > INT32_MAX) {
+        fprintf(stderr, "Error: '%s' is too large\n", filename);
+        close(fd);
+        return -1;
+    }
+
+#ifndef _WIN32
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            doc->src = map;
+            doc->src_len = (size_t)st.st_size;
+            doc->src_mapped = 1;
+            close(fd);
+            return 0;
+        }
+    }
+#endif
+
+    size_t cap = st.st_size > 0 ? (size_t)st.st_size : 65536;
+    size_t len = 0;
+    char *buf = malloc(cap);
+    if (!buf) {
+        close(fd);
+        return -1;
+    }
+    for (;;) {
+        if (len == cap) {
+            if (cap > INT32_MAX / 2) break;
+            char *grown = realloc(buf, cap * 2);
+            if (!grown) break;
+            buf = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += (size_t)n;
+    }
+    close(fd);
+    doc->src = buf;
+    doc->src_len = len;
+    doc->src_mapped = 0;
+    return 0;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * DOCUMENT HELPERS
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+static void stamp_document(DOCUNATION *doc);
+
+/* Open a source and fill in everything but its nodes */
+static DOCUNATION *load_document(const char *filename) {
+    DOCUNATION *doc = calloc(1, sizeof(DOCUNATION));
+    if (!doc) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return NULL;
+    }
+    if (load_source(doc, filename) != 0) {
+        fprintf(stderr, "Error: Cannot open '%s'\n", filename);
+        free(doc);
+        return NULL;
+    }
+
+    safe_strcpy(doc->filepath, filename, MAX_LINE);
+    doc->truncated += strlen(filename) >= MAX_LINE;
+    if (strcmp(filename, "-") == 0) safe_strcpy(doc->module_name, "stdin", MAX_NAME);
+    else extract_module_name(filename, doc->module_name, MAX_NAME);
+    stamp_document(doc);
+    return doc;
+}
+
+/* Record the generation time */
+static void stamp_document(DOCUNATION *doc) {
+    time_t now = time(NULL);
+    struct tm *tm_info = NULL;
+#ifdef _WIN32
+    tm_info = localtime(&now);
+#else
+    struct tm tm_buf;
+    tm_info = localtime_r(&now, &tm_buf);
+#endif
+    if (tm_info) {
+        strftime(doc->timestamp, sizeof(doc->timestamp), "%Y-%m-%dT%H:%M:%S", tm_info);
+    } else {
+        safe_strcpy(doc->timestamp, "unknown", sizeof(doc->timestamp));
+    }
+}
+
+/* ─── Source locations ─────────────────────────────────────────────────── */
+
+/* Record the offset of every newline in the source, sixteen bytes at a time
+ * where SSE2 is available, reusing the table a previous parse left behind */
+static int index_newlines(DOCUNATION *doc) {
+    const char *src = doc->src;
+    size_t len = doc->src_len;
+    size_t i = 0;
+    doc->newline_count = 0;
+    for (;;) {
+        if (doc->newline_cap - doc->newline_count < 16) {
+            size_t cap = doc->newline_cap ? doc->newline_cap * 2 : 1024;
+            uint32_t *lines = realloc(doc->newlines, cap * sizeof(uint32_t));
+            if (!lines) {
+                fprintf(stderr, "Error: Cannot allocate memory\n");
+                return -1;
+            }
+            doc->newlines = lines;
+            doc->newline_cap = cap;
+        }
+        uint32_t *out = doc->newlines + doc->newline_count;
+#ifdef __SSE2__
+        /* At most 16 entries per block, which the check above leaves room for */
+        const __m128i nl = _mm_set1_epi8('\n');
+        if (len - i >= 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+            while (m) {
+                *out++ = (uint32_t)(i + (size_t)__builtin_ctz(m));
+                m &= m - 1;
+            }
+            doc->newline_count = (size_t)(out - doc->newlines);
+            i += 16;
+            continue;
+        }
+#endif
+        size_t stop = i + 16 < len ? i + 16 : len;
+        for (; i < stop; i++) {
+            if (src[i] == '\n') *out++ = (uint32_t)i;
+        }
+        doc->newline_count = (size_t)(out - doc->newlines);
+        if (i >= len) return 0;
+    }
+}
+
+/* 1-based line and byte column of a source offset */
+static void locate_offset(const DOCUNATION *doc, uint32_t off, int *line, int *column) {
+    size_t lo = 0, hi = doc->newline_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (doc->newlines[mid] < off) lo = mid + 1;
+        else hi = mid;
+    }
+    uint32_t bol = lo ? doc->newlines[lo - 1] + 1 : 0;
+    *line = (int)lo + 1;
+    *column = (int)(off - bol) + 1;
+}
+
+/* Fill in each node's column and end position from its byte range */
+static int locate_nodes(DOCUNATION *doc) {
+    if (index_newlines(doc) != 0) return -1;
+    for (int i = 0; i < doc->node_count; i++) {
+        DocNode *n = &doc->nodes[i];
+        int line;
+        locate_offset(doc, n->start, &line, &n->column);
+        locate_offset(doc, n->end, &n->end_line, &n->end_column);
+    }
+    return 0;
+}
+
+/* Parse a loaded document's source into nodes */
+static int parse_loaded(DOCUNATION *doc) {
+    Parser *parser = calloc(1, sizeof(Parser));
+    if (!parser) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return -1;
+    }
+    parser->cur = doc->src;
+    parser->end = doc->src + doc->src_len;
+    parser->doc = doc;
+    parse_file(parser);
+    free(parser);
+    if (locate_nodes(doc) != 0) return -1;
+    return index_sections(doc);
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * BINARY DOCUMENTS
+ *
+ * A parsed document can be written as a BinHeader, node_count fixed-width
+ * BinRecords in source order, then a pool of string bytes the records and
+ * the header index by (offset, length). Every string in the pool is
+ * followed by a NUL, so a reader that maps the file can use the strings,
+ * records and header in place. Integers are in the writer's byte order,
+ * which byte_order records. The format number changes with the layout.
+ * The same encoding backs the parse cache, the --link pass and the
+ * bin output format.
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+#define BIN_MAGIC "DOCUBIN\n"
+#define BIN_FORMAT 5
+#define BIN_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[8];           /* BIN_MAGIC */
+    uint32_t format;         /* BIN_FORMAT */
+    uint32_t byte_order;     /* BIN_BYTE_ORDER, as the writer stores it */
+    char version[16];        /* DOCUNATION_VERSION, NUL-padded */
+    uint64_t hash;           /* FNV-1a of the source */
+    uint64_t size;           /* source length */
+    uint32_t node_count;
+    uint32_t record_size;    /* sizeof(BinRecord); records follow the header */
+    uint32_t pool_off;       /* from the start of the file */
+    uint32_t pool_len;
+    uint32_t doc[2];         /* module docstring: pool offset, length */
+    uint32_t filepath[2];
+    uint32_t module_name[2];
+    uint32_t timestamp[2];
+} BinHeader;
+
+enum { BIN_STATIC = 1, BIN_INLINE = 2, BIN_EXTERN = 4, BIN_BODY = 8, BIN_INACTIVE = 16 };
+
+typedef struct {
+    uint32_t str[5][2];      /* name, signature, docstring, return type, condition: pool offset, length */
+    int32_t line;            /* 1-based; columns count bytes from 1 */
+    int32_t column;
+    int32_t end_line;        /* of end, the byte after the node */
+    int32_t end_column;
+    uint32_t start;          /* source byte range [start, end) */
+    uint32_t end;
+    uint8_t type;            /* NodeType, in node_type_names order */
+    uint8_t flags;           /* BIN_STATIC | BIN_INLINE | BIN_EXTERN | BIN_BODY | BIN_INACTIVE */
+    uint8_t pad[2];
+} BinRecord;
+
+static void bin_header_init(BinHeader *h, uint64_t hash, size_t size) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, BIN_MAGIC, sizeof(h->magic));
+    h->format = BIN_FORMAT;
+    h->byte_order = BIN_BYTE_ORDER;
+    safe_strcpy(h->version, DOCUNATION_VERSION, sizeof(h->version));
+    h->hash = hash;
+    h->size = size;
+    h->record_size = sizeof(BinRecord);
+}
+
+/* Place a string of len bytes and its NUL at *off in the pool */
+static void bin_place(uint32_t str[2], uint32_t *off, size_t len) {
+    str[0] = *off;
+    str[1] = (uint32_t)len;
+    *off += (uint32_t)len + 1;
+}
+
+static void bin_put(OutBuf *ob, const char *s, size_t len) {
+    ob_write(ob, s, len);
+    ob_write(ob, "", 1);
+}
+
+/* Serialize a parsed document into ob */
+static int bin_encode(const DOCUNATION *doc, uint64_t hash, OutBuf *ob) {
+    BinHeader h;
+    bin_header_init(&h, hash, doc->src_len);
+    h.node_count = (uint32_t)doc->node_count;
+    size_t filepath_len = strlen(doc->filepath);
+    size_t module_len = strlen(doc->module_name);
+    size_t stamp_len = strlen(doc->timestamp);
+    uint64_t pool = (uint64_t)doc->docstring.len + filepath_len + module_len + stamp_len + 4;
+    for (int i = 0; i < doc->node_count; i++) {
+        const DocNode *n = &doc->nodes[i];
+        pool += (uint64_t)n->name.len + n->signature.len + n->docstring.len + n->return_type.len +
+                n->condition.len + 5;
+    }
+    uint64_t pool_off = sizeof(h) + (uint64_t)h.node_count * sizeof(BinRecord);
+    if (pool_off + pool > UINT32_MAX) return -1;
+    h.pool_off = (uint32_t)pool_off;
+    h.pool_len = (uint32_t)pool;
+    uint32_t off = 0;
+    bin_place(h.doc, &off, doc->docstring.len);
+    bin_place(h.filepath, &off, filepath_len);
+    bin_place(h.module_name, &off, module_len);
+    bin_place(h.timestamp, &off, stamp_len);
+
+    ob_write(ob, (const char *)&h, sizeof(h));
+    for (int i = 0; i < doc->node_count; i++) {
+        const DocNode *n = &doc->nodes[i];
+        const Slice *strs[5] = { &n->name, &n->signature, &n->docstring, &n->return_type, &n->condition };
+        BinRecord r;
+        memset(&r, 0, sizeof(r));
+        for (int k = 0; k < 5; k++) bin_place(r.str[k], &off, strs[k]->len);
+        r.line = n->line;
+        r.column = n->column;
+        r.end_line = n->end_line;
+        r.end_column = n->end_column;
+        r.start = n->start;
+        r.end = n->end;
+        r.type = (uint8_t)n->type;
+        r.flags = (n->is_static ? BIN_STATIC : 0) | (n->is_inline ? BIN_INLINE : 0) |
+                  (n->is_extern ? BIN_EXTERN : 0) | (n->has_body ? BIN_BODY : 0) |
+                  (n->inactive ? BIN_INACTIVE : 0);
+        ob_write(ob, (const char *)&r, sizeof(r));
+    }
+    bin_put(ob, DSTR(doc, doc->docstring), doc->docstring.len);
+    bin_put(ob, doc->filepath, filepath_len);
+    bin_put(ob, doc->module_name, module_len);
+    bin_put(ob, doc->timestamp, stamp_len);
+    for (int i = 0; i < doc->node_count; i++) {
+        const DocNode *n = &doc->nodes[i];
+        bin_put(ob, DSTR(doc, n->name), n->name.len);
+        bin_put(ob, DSTR(doc, n->signature), n->signature.len);
+        bin_put(ob, DSTR(doc, n->docstring), n->docstring.len);
+        bin_put(ob, DSTR(doc, n->return_type), n->return_type.len);
+        bin_put(ob, DSTR(doc, n->condition), n->condition.len);
+    }
+    return ob->failed ? -1 : 0;
+}
+
+/* Does str[2] name a NUL-terminated string within a pool of len bytes? */
+static int bin_string_ok(const uint32_t str[2], const char *pool, uint32_t len) {
+    return (uint64_t)str[0] + str[1] < len && str[1] <= INT32_MAX && pool[str[0] + str[1]] == '\0';
+}
+
+/* Replace a document's nodes with an encoded parse of the same content
+ * (hash, and doc->src_len bytes); returns -1, leaving the document
+ * untouched, if buf does not hold one. The document keeps its own path,
+ * module name and timestamp. */
+static int bin_decode(DOCUNATION *doc, const char *buf, size_t len, uint64_t hash) {
+    BinHeader h;
+    BinHeader want;
+    bin_header_init(&want, hash, doc->src_len);
+    if (len < sizeof(h)) return -1;
+    memcpy(&h, buf, sizeof(h));
+    if (memcmp(h.magic, want.magic, sizeof(h.magic)) != 0 || h.format != want.format ||
+        h.byte_order != want.byte_order || h.record_size != want.record_size ||
+        memcmp(h.version, want.version, sizeof(h.version)) != 0 ||
+        h.hash != hash || h.size != doc->src_len ||
+        h.pool_off != sizeof(h) + (uint64_t)h.node_count * sizeof(BinRecord) ||
+        len != (uint64_t)h.pool_off + h.pool_len) {
+        return -1;
+    }
+
+    const char *records = buf + sizeof(h);
+    const char *pool = buf + h.pool_off;
+    if (!bin_string_ok(h.doc, pool, h.pool_len)) return -1;
+    int cap = h.node_count > NODES_MIN_CAP ? (int)h.node_count : NODES_MIN_CAP;
+    DocNode *nodes = calloc((size_t)cap, sizeof(DocNode));
+    Arena arena = { 0 };
+    if (!nodes || arena_reserve(&arena, (size_t)h.pool_len + 1) != 0) {
+        free(nodes);
+        arena_free(&arena);
+        return -1;
+    }
+    memcpy(arena.data, pool, h.pool_len);
+    arena.data[h.pool_len] = '\0';
+    arena.len = (size_t)h.pool_len + 1;
+
+    for (uint32_t i = 0; i < h.node_count; i++) {
+        BinRecord r;
+        memcpy(&r, records + (size_t)i * sizeof(r), sizeof(r));
+        DocNode *n = &nodes[i];
+        Slice *strs[5] = { &n->name, &n->signature, &n->docstring, &n->return_type, &n->condition };
+        int bad = r.type > NODE_INCLUDE;
+        for (int k = 0; k < 5; k++) {
+            if (!bin_string_ok(r.str[k], pool, h.pool_len)) bad = 1;
+            strs[k]->off = r.str[k][0];
+            strs[k]->len = r.str[k][1];
+        }
+        if (bad) {
+            free(nodes);
+            arena_free(&arena);
+            return -1;
+        }
+        n->type = (NodeType)r.type;
+        n->line = r.line;
+        n->column = r.column;
+        n->end_line = r.end_line;
+        n->end_column = r.end_column;
+        n->start = r.start;
+        n->end = r.end;
+        n->is_static = (r.flags & BIN_STATIC) != 0;
+        n->is_inline = (r.flags & BIN_INLINE) != 0;
+        n->is_extern = (r.flags & BIN_EXTERN) != 0;
+        n->has_body = (r.flags & BIN_BODY) != 0;
+        n->inactive = (r.flags & BIN_INACTIVE) != 0;
+    }
+
+    /* Every string now lives in the arena, so the source can go */
+    arena_free(&doc->arena);
+    free(doc->nodes);
+    doc->arena = arena;
+    doc->nodes = nodes;
+    doc->node_count = (int)h.node_count;
+    doc->node_cap = cap;
+    doc->docstring.off = h.doc[0];
+    doc->docstring.len = h.doc[1];
+    doc->docstring.src = 0;
+    release_source(doc);
+    return index_sections(doc);
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * PARSE CACHE
+ *
+ * With --cache-dir, parsed node sets are stored under the content hash and
+ * size of their source, so any run over identical text - in any tree, for
+ * any output directory - re-renders without parsing. A cache file is a
+ * binary document (see above); a cache directory belongs to one machine.
+ * Files are written to a temporary name and renamed into place, so
+ * concurrent runs can share a directory.
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+static void cache_path(const char *cache_dir, uint64_t hash, size_t size, char *path) {
+    snprintf(path, MAX_PATH_LEN, "%s/%016llx-%llx.dnc", cache_dir,
+             (unsigned long long)hash, (unsigned long long)size);
+}
+
+/* Store a parsed document's nodes; failure only costs a later re-parse */
+static int cache_store(const char *cache_dir, const DOCUNATION *doc, uint64_t hash) {
+    char path[MAX_PATH_LEN];
+    char tmp_path[MAX_PATH_LEN];
+    cache_path(cache_dir, hash, doc->src_len, path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.tmp-XXXXXX", cache_dir);
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) return -1;
+    FILE *out = fdopen(fd, "wb");
+    if (!out) {
+        close(fd);
+        remove(tmp_path);
+        return -1;
+    }
+
+    OutBuf ob = { 0 };
+    ob_bind(&ob, out);
+    int rc = bin_encode(doc, hash, &ob);
+    if (ob_finish(&ob) != 0) rc = -1;
+    ob_free(&ob);
+    if (fclose(out) != 0) rc = -1;
+    if (rc == 0 && rename(tmp_path, path) != 0) rc = -1;
+    if (rc != 0) remove(tmp_path);
+    return rc;
+}
+
+/* Read a whole small file into a heap buffer */
+static char *read_file(const char *path, size_t *len) {
+    FILE *in = fopen(path, "rb");
+    if (!in) return NULL;
+    struct stat st;
+    char *buf = NULL;
+    if (fstat(fileno(in), &st) == 0 && st.st_size > 0 && (uint64_t)st.st_size <= INT32_MAX) {
+        buf = malloc((size_t)st.st_size);
+        if (buf && fread(buf, 1, (size_t)st.st_size, in) != (size_t)st.st_size) {
+            free(buf);
+            buf = NULL;
+        }
+        *len = (size_t)st.st_size;
+    }
+    fclose(in);
+    return buf;
+}
+
+/* Replace a loaded document's nodes with a cached parse of the same
+ * content; returns -1, leaving the document untouched, on a miss */
+static int cache_load(const char *cache_dir, DOCUNATION *doc, uint64_t hash) {
+    char path[MAX_PATH_LEN];
+    cache_path(cache_dir, hash, doc->src_len, path);
+    size_t len = 0;
+    char *buf = read_file(path, &len);
+    if (!buf) return -1;
+    int rc = bin_decode(doc, buf, len, hash);
+    free(buf);
+    return rc;
+}
+
+/* Parse through the cache: reuse a stored parse of identical content, or
+ * parse and store it for next time. The key also covers -D, -U and
+ * --skip-inactive, which change what a parse of the same bytes holds. */
+static int parse_cached(const char *cache_dir, DOCUNATION *doc, uint64_t hash) {
+    hash ^= defines_fingerprint(doc->defines);
+    if (cache_load(cache_dir, doc, hash) == 0) return 0;
+    if (parse_loaded(doc) != 0) return -1;
+    cache_store(cache_dir, doc, hash);
+    return 0;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * GLOB MATCHING
+ *
+ * Bulk-mode filters are shell globs compiled once into a short op list:
+ * literal runs, '?', '[...]' classes (as 256-bit sets), '*' within one path
+ * component, '**' across components and '** /' for "any directories, or
+ * none". As in .gitignore, a pattern with no '/' matches an entry's name
+ * at any depth; one containing '/' matches the whole path relative to
+ * where it was given, and a trailing '/' restricts it to directories.
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+enum { GLOB_LIT, GLOB_ANY, GLOB_CLASS, GLOB_STAR, GLOB_GLOBSTAR, GLOB_ANYDIRS };
+
+typedef struct {
+    int op;
+    const char *lit;         /* GLOB_LIT: points into the pattern copy */
+    size_t len;
+    uint8_t set[32];         /* GLOB_CLASS members */
+} GlobOp;
+
+typedef struct {
+    char *text;              /* pattern copy the literal ops point into */
+    GlobOp *ops;
+    int op_count;
+    int match_path;          /* contains '/': match the relative path */
+    int dir_only;            /* ended in '/' */
+} Glob;
+
+typedef struct {
+    Glob *globs;
+    int count;
+    int cap;
+} GlobSet;
+
+/* Compile [...] at *s into set; returns 0, leaving *s alone, if unclosed */
+static int glob_class(const char **s, uint8_t *set) {
+    const char *p = *s + 1;
+    int negate = *p == '!' || *p == '^';
+    if (negate) p++;
+    memset(set, 0, 32);
+    const char *start = p;
+    while (*p && (*p != ']' || p == start)) {
+        unsigned char lo = (unsigned char)*p;
+        unsigned char hi = lo;
+        if (p[1] == '-' && p[2] && p[2] != ']') {
+            hi = (unsigned char)p[2];
+            p += 2;
+        }
+        for (unsigned c = lo; c <= hi; c++) set[c >> 3] |= (uint8_t)(1u << (c & 7));
+        p++;
+    }
+    if (*p != ']') return 0;
+    if (negate) {
+        for (int i = 0; i < 32; i++) set[i] = (uint8_t)~set[i];
+    }
+    set['/' >> 3] &= (uint8_t)~(1u << ('/' & 7));
+    *s = p + 1;
+    return 1;
+}
+
+static int glob_compile(Glob *g, const char *pattern) {
+    memset(g, 0, sizeof(*g));
+    size_t len = strlen(pattern);
+    if (len && pattern[len - 1] == '/') {
+        g->dir_only = 1;
+        len--;
+    }
+    if (len && pattern[0] == '/') {
+        g->match_path = 1;
+        pattern++;
+        len--;
+    }
+    g->text = malloc(len + 1);
+    g->ops = malloc((len + 1) * sizeof(GlobOp));
+    if (!g->text || !g->ops) {
+        free(g->text);
+        free(g->ops);
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return -1;
+    }
+    memcpy(g->text, pattern, len);
+    g->text[len] = '\0';
+    if (memchr(g->text, '/', len)) g->match_path = 1;
+
+    const char *s = g->text;
+    while (*s) {
+        GlobOp *op = &g->ops[g->op_count];
+        memset(op, 0, sizeof(*op));
+        if (s[0] == '*' && s[1] == '*' && (s == g->text || s[-1] == '/')) {
+            s += 2;
+            if (*s == '/') {
+                op->op = GLOB_ANYDIRS;
+                s++;
+            } else {
+                op->op = GLOB_GLOBSTAR;
+            }
+        } else if (*s == '*') {
+            while (*s == '*') s++;
+            op->op = GLOB_STAR;
+        } else if (*s == '?') {
+            op->op = GLOB_ANY;
+            s++;
+        } else if (*s == '[' && glob_class(&s, op->set)) {
+            op->op = GLOB_CLASS;
+        } else {
+            /* Extend a literal run up to the next special character */
+            op->op = GLOB_LIT;
+            if (*s == '\\' && s[1]) s++;
+            op->lit = s;
+            s++;
+            while (*s && !strchr("*?[\\", *s)) s++;
+            op->len = (size_t)(s - op->lit);
+        }
+        g->op_count++;
+    }
+    return 0;
+}
+
+static int glob_run(const Glob *g, int i, const char *s, const char *e) {
+    for (; i < g->op_count; i++) {
+        const GlobOp *op = &g->ops[i];
+        switch (op->op) {
+        case GLOB_LIT:
+            if ((size_t)(e - s) < op->len || memcmp(s, op->lit, op->len) != 0) return 0;
+            s += op->len;
+            break;
+        case GLOB_ANY:
+            if (s >= e || *s == '/') return 0;
+            s++;
+            break;
+        case GLOB_CLASS:
+            if (s >= e || !(op->set[(unsigned char)*s >> 3] & (1u << (*s & 7)))) return 0;
+            s++;
+            break;
+        case GLOB_STAR:
+            for (;; s++) {
+                if (glob_run(g, i + 1, s, e)) return 1;
+                if (s >= e || *s == '/') return 0;
+            }
+        case GLOB_GLOBSTAR:
+            for (;; s++) {
+                if (glob_run(g, i + 1, s, e)) return 1;
+                if (s >= e) return 0;
+            }
+        case GLOB_ANYDIRS:
+            /* Nothing, or any run of whole directories */
+            for (;;) {
+                if (glob_run(g, i + 1, s, e)) return 1;
+                const char *slash = memchr(s, '/', (size_t)(e - s));
+                if (!slash) return 0;
+                s = slash + 1;
+            }
+        }
+    }
+    return s == e;
+}
+
+/* Match an entry, given its path relative to the pattern's base and its name */
+static int glob_match(const Glob *g, const char *path, const char *name, int is_dir) {
+    if (g->dir_only && !is_dir) return 0;
+    const char *s = g->match_path ? path : name;
+    return glob_run(g, 0, s, s + strlen(s));
+}
+
+static int globset_add(GlobSet *set, const char *pattern) {
+    if (set->count == set->cap) {
+        int cap = set->cap ? set->cap * 2 : 8;
+        Glob *globs = realloc(set->globs, (size_t)cap * sizeof(Glob));
+        if (!globs) {
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            return -1;
+        }
+        set->globs = globs;
+        set->cap = cap;
+    }
+    if (glob_compile(&set->globs[set->count], pattern) != 0) return -1;
+    set->count++;
+    return 0;
+}
+
+static int globset_match(const GlobSet *set, const char *path, const char *name, int is_dir) {
+    for (int i = 0; i < set->count; i++) {
+        if (glob_match(&set->globs[i], path, name, is_dir)) return 1;
+    }
+    return 0;
+}
+
+static void globset_free(GlobSet *set) {
+    for (int i = 0; i < set->count; i++) {
+        free(set->globs[i].text);
+        free(set->globs[i].ops);
+    }
+    free(set->globs);
+    memset(set, 0, sizeof(*set));
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * STRING INTERNING
+ *
+ * Names that feed the cross-file structures, the --link symbol index and
+ * the --search names list, are interned once per run and held as 32-bit
+ * ids: a name repeated across files is stored once, and comparing two
+ * names is comparing two integers. A name's hash picks one of
+ * INTERN_SHARDS shards, each with its own lock, string chunks and
+ * open-addressing table, so workers rarely contend. The low
+ * INTERN_SHARD_BITS of an id name its shard and the rest number its
+ * strings from 1, so 0 is never an id. Interning takes the shard lock;
+ * finding and resolving ids is done without locks once the workers have
+ * joined.
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+typedef struct {
+    const char *str;         /* NUL-terminated, in the shard's chunks */
+    uint32_t len;
+    uint32_t hash;
+} InternString;
+
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t *slots;         /* ids by hash, 0 when empty */
+    size_t cap;              /* power of two */
+    InternString *strings;   /* by id number - 1 */
+    size_t count;
+    size_t alloc;
+    char **chunks;
+    size_t chunk_count;
+    size_t chunk_used;       /* bytes used in the last chunk */
+} InternShard;
+
+typedef struct {
+    InternShard shards[INTERN_SHARDS];
+} Interner;
+
+/* Shard of an id, and its number within the shard */
+#define INTERN_SHARD(id) ((id) & (INTERN_SHARDS - 1))
+#define INTERN_NUMBER(id) ((id) >> INTERN_SHARD_BITS)
+
+static uint32_t intern_hash(const char *str, size_t len) {
+    uint64_t h = fnv1a64(str, len);
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static Interner *interner_new(void) {
+    Interner *in = calloc(1, sizeof(Interner));
+    if (!in) return NULL;
+    for (int i = 0; i < INTERN_SHARDS; i++) pthread_mutex_init(&in->shards[i].lock, NULL);
+    return in;
+}
+
+static void interner_free(Interner *in) {
+    if (!in) return;
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        InternShard *s = &in->shards[i];
+        for (size_t c = 0; c < s->chunk_count; c++) free(s->chunks[c]);
+        free(s->chunks);
+        free(s->strings);
+        free(s->slots);
+        pthread_mutex_destroy(&s->lock);
+    }
+    free(in);
+}
+
+/* Copy a string into the shard's chunks; s->lock must be held */
+static const char *intern_copy(InternShard *s, const char *str, size_t len) {
+    if (s->chunk_count == 0 || s->chunk_used + len + 1 > INTERN_CHUNK) {
+        size_t size = len + 1 > INTERN_CHUNK ? len + 1 : INTERN_CHUNK;
+        char **chunks = realloc(s->chunks, (s->chunk_count + 1) * sizeof(char *));
+        char *chunk = chunks ? malloc(size) : NULL;
+        if (chunks) s->chunks = chunks;
+        if (!chunk) return NULL;
+        s->chunks[s->chunk_count++] = chunk;
+        s->chunk_used = 0;
+    }
+    char *out = s->chunks[s->chunk_count - 1] + s->chunk_used;
+    memcpy(out, str, len);
+    out[len] = '\0';
+    s->chunk_used += len + 1;
+    return out;
+}
+
+/* Slot for a string in a shard's table: its id, or the empty slot it
+ * belongs in */
+static uint32_t *intern_slot(const InternShard *s, uint32_t *slots, size_t cap, uint32_t hash,
+                             const char *str, size_t len) {
+    size_t i = (hash >> INTERN_SHARD_BITS) & (cap - 1);
+    for (;; i = (i + 1) & (cap - 1)) {
+        if (!slots[i]) return &slots[i];
+        const InternString *e = &s->strings[INTERN_NUMBER(slots[i]) - 1];
+        if (e->hash == hash && e->len == len && memcmp(e->str, str, len) == 0) return &slots[i];
+    }
+}
+
+static int intern_grow(InternShard *s) {
+    size_t cap = s->cap ? s->cap * 2 : 256;
+    uint32_t *slots = calloc(cap, sizeof(uint32_t));
+    if (!slots) return -1;
+    for (size_t i = 0; i < s->count; i++) {
+        const InternString *e = &s->strings[i];
+        *intern_slot(s, slots, cap, e->hash, e->str, e->len) =
+            (uint32_t)(i + 1) << INTERN_SHARD_BITS | INTERN_SHARD(e->hash);
+    }
+    free(s->slots);
+    s->slots = slots;
+    s->cap = cap;
+    return 0;
+}
+
+/* Id of a string, adding it if new; 0 if memory ran out */
+static uint32_t intern(Interner *in, const char *str, size_t len) {
+    uint32_t hash = intern_hash(str, len);
+    InternShard *s = &in->shards[INTERN_SHARD(hash)];
+    uint32_t id = 0;
+    pthread_mutex_lock(&s->lock);
+    if ((s->count + 1) * 4 > s->cap * 3 && intern_grow(s) != 0) goto done;
+    uint32_t *slot = intern_slot(s, s->slots, s->cap, hash, str, len);
+    if (*slot) {
+        id = *slot;
+        goto done;
+    }
+    if (s->count + 1 >= (size_t)1 << (32 - INTERN_SHARD_BITS)) goto done;
+    if (s->count == s->alloc) {
+        size_t alloc = s->alloc ? s->alloc * 2 : 256;
+        InternString *strings = realloc(s->strings, alloc * sizeof(InternString));
+        if (!strings) goto done;
+        s->strings = strings;
+        s->alloc = alloc;
+    }
+    const char *copy = intern_copy(s, str, len);
+    if (!copy) goto done;
+    s->strings[s->count].str = copy;
+    s->strings[s->count].len = (uint32_t)len;
+    s->strings[s->count].hash = hash;
+    s->count++;
+    id = *slot = (uint32_t)s->count << INTERN_SHARD_BITS | INTERN_SHARD(hash);
+done:
+    pthread_mutex_unlock(&s->lock);
+    return id;
+}
+
+/* Id of a string already interned, or 0; only once interning is over */
+static uint32_t intern_find(const Interner *in, const char *str, size_t len) {
+    uint32_t hash = intern_hash(str, len);
+    const InternShard *s = &in->shards[INTERN_SHARD(hash)];
+    if (!s->cap) return 0;
+    return *intern_slot(s, s->slots, s->cap, hash, str, len);
+}
+
+/* The string behind an id; only once interning is over */
+static const InternString *intern_get(const Interner *in, uint32_t id) {
+    return &in->shards[INTERN_SHARD(id)].strings[INTERN_NUMBER(id) - 1];
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * SYMBOL INDEX
+ *
+ * With --link, every externally visible name in the tree is recorded while
+ * the files are parsed. Names are interned, and the index keeps one entry
+ * per interned string, in per-shard arrays numbered like the interner's,
+ * under a lock per shard. A name keeps a single target: a node with a body
+ * beats a declaration, a non-extern node beats an extern one, then the
+ * first file by relative path wins, so the choice does not depend on
+ * which worker got there first. Once parsing is over the index is only
+ * read, without locks.
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+typedef struct {
+    uint32_t node;           /* index in the target file's document */
+    uint8_t type;            /* NodeType */
+    uint8_t is_extern;
+    uint8_t has_body;
+    const char *file;        /* output base name of the target's page; NULL if none */
+    const char *rel;         /* source path, for the tie-break */
+} Symbol;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Symbol *slots;           /* by id number - 1 */
+    size_t cap;
+} SymbolShard;
+
+typedef struct {
+    Interner *strings;
+    SymbolShard shards[INTERN_SHARDS];
+} SymbolIndex;
+
+static SymbolIndex *symbols_new(Interner *strings) {
+    SymbolIndex *idx = calloc(1, sizeof(SymbolIndex));
+    if (!idx) return NULL;
+    idx->strings = strings;
+    for (int i = 0; i < INTERN_SHARDS; i++) pthread_mutex_init(&idx->shards[i].lock, NULL);
+    return idx;
+}
+
+static void symbols_free(SymbolIndex *idx) {
+    if (!idx) return;
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        free(idx->shards[i].slots);
+        pthread_mutex_destroy(&idx->shards[i].lock);
+    }
+    free(idx);
+}
+
+/* Make room for id numbers up to number; s->lock must be held */
+static int symbol_reserve(SymbolShard *s, size_t number) {
+    if (number <= s->cap) return 0;
+    size_t cap = s->cap ? s->cap : 256;
+    while (cap < number) cap *= 2;
+    Symbol *slots = realloc(s->slots, cap * sizeof(Symbol));
+    if (!slots) return -1;
+    memset(slots + s->cap, 0, (cap - s->cap) * sizeof(Symbol));
+    s->slots = slots;
+    s->cap = cap;
+    return 0;
+}
+
+/* Reserved words and built-in type names never name a link target, even
+ * when the parser took one for a name, as with "void (*handler)(void);" */
+static int symbol_linkable(const char *name, size_t len) {
+    return classify_keyword(name, len) == KW_NONE;
+}
+
+/* Offer a node of the file rel, documented as base, as its name's target.
+ * Static names are interned too, since a page links to those itself. */
+static void symbols_add(SymbolIndex *idx, const DOCUNATION *doc, int node,
+                        const char *base, const char *rel) {
+    const DocNode *n = &doc->nodes[node];
+    if (n->type == NODE_INCLUDE || !n->name.len) return;
+    if (!symbol_linkable(DSTR(doc, n->name), n->name.len)) return;
+    uint32_t id = intern(idx->strings, DSTR(doc, n->name), n->name.len);
+    if (!id || n->is_static) return;
+    SymbolShard *s = &idx->shards[INTERN_SHARD(id)];
+    pthread_mutex_lock(&s->lock);
+    if (symbol_reserve(s, INTERN_NUMBER(id)) != 0) {
+        pthread_mutex_unlock(&s->lock);
+        return;
+    }
+    Symbol *sym = &s->slots[INTERN_NUMBER(id) - 1];
+    int rank = (n->has_body != 0) - sym->has_body;
+    if (!rank) rank = sym->is_extern - (n->is_extern != 0);
+    if (!sym->file || rank > 0 || (!rank && strcmp(rel, sym->rel) < 0)) {
+        sym->node = (uint32_t)node;
+        sym->type = (uint8_t)n->type;
+        sym->is_extern = n->is_extern != 0;
+        sym->has_body = n->has_body != 0;
+        sym->file = base;
+        sym->rel = rel;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* What a page's signatures may link to: names on the page itself, and in
+ * the index those of other pages */
+struct HtmlLinks {
+    const SymbolIndex *symbols;
+    const char *base;        /* this page's output base name */
+    int cross_file;          /* other pages are reachable by relative URL */
+};
+
+/* The target of an interned name once the index is complete */
+static const Symbol *symbols_find(const SymbolIndex *idx, uint32_t id) {
+    const SymbolShard *s = &idx->shards[INTERN_SHARD(id)];
+    if (INTERN_NUMBER(id) > s->cap) return NULL;
+    const Symbol *sym = &s->slots[INTERN_NUMBER(id) - 1];
+    return sym->file ? sym : NULL;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * BULK MODE
+ *
+ * Every worker both discovers and documents. Directories wait on one shared
+ * stack; a worker that takes one scans it through its directory fd, using
+ * d_type to avoid a stat per entry and fstatat/openat relative to the
+ * directory where it must look closer. Matching sources go straight onto
+ * the scanning worker's own deque, so parsing starts with the first file
+ * found. Workers pop from the tail of their own deque and steal from the
+ * head of the others once it runs dry, scanning a directory whenever no
+ * file is ready. Results are gathered after the join and written sorted by
+ * relative path, so output does not depend on scheduling.
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/* A documented name for the search index */
+typedef struct {
+    uint32_t id;         /* interned */
+    int32_t line;
+    uint8_t type;        /* NodeType */
+} SearchName;
+
+/* A function declared or defined by a file, for --merge */
+typedef struct {
+    uint64_t key;        /* hash of the normalized signature; see merge_key() */
+    uint32_t str[3][2];  /* name, signature, docstring: offset, length in the file's text */
+    int32_t line;
+    uint8_t defined;     /* has a body */
+} MergeDecl;
+
+/* Where a bulk run spends its time, for --stats */
+typedef enum {
+    PHASE_DISCOVER,
+    PHASE_LOAD,
+    PHASE_PARSE,
+    PHASE_RENDER,
+    PHASE_QUEUE,         /* handing outputs to writer threads, waits included */
+    PHASE_WRITE,
+    PHASE_COUNT
+} Phase;
+
+static const char *const phase_names[] = { "discover", "load", "parse", "render", "queue", "write" };
+
+/* One thread's share of a run: per phase, time taken, items handled
+ * (directories, files or outputs) and bytes (source loaded, output written) */
+typedef struct {
+    uint64_t ns[PHASE_COUNT];
+    uint64_t items[PHASE_COUNT];
+    uint64_t bytes[PHASE_COUNT];
+} ThreadStats;
+
+/* One source recorded by the previous run */
+typedef struct {
+    char *rel;
+    char *base;
+    uint64_t size;
+    int64_t mtime;       /* nanoseconds */
+    uint64_t hash;
+    const char *surface; /* its lines in the previous SURFACE_NAME, or NULL */
+    size_t surface_len;
+    int seen;            /* still present in this run */
+} ManifestEntry;
+
+/* Binary documents are only written when asked for */
+enum { FORMAT_TXT = 1, FORMAT_JSON = 2, FORMAT_HTML = 4, FORMAT_BIN = 8, FORMAT_DEFAULT = 7 };
+#define FORMAT_COUNT 4
+
+/* By FORMAT_* bit: output directory and extension, index label, and MIME
+ * type for the pack reader in index.html */
+static const char *const format_exts[] = { "txt", "json", "html", "bin" };
+static const char *const format_labels[] = { "Text", "JSON", "HTML", "Binary" };
+static const char *const format_mimes[] = {
+    "text/plain", "application/json", "text/html", "application/octet-stream"
+};
+
+typedef struct {
+    char *path;
+    const char *rel;     /* points into path */
+    char *base;          /* sanitized output name without extension */
+    uint64_t size;
+    int64_t mtime;       /* nanoseconds */
+    uint64_t hash;       /* FNV-1a of the contents */
+    const ManifestEntry *prev;
+    int ok;
+    int reused;          /* outputs from the previous run were kept */
+    int write_failed;    /* set by a writer, under the write queue lock */
+    uint64_t corpus_off; /* NDJSON block in the corpus spool */
+    size_t corpus_len;
+    uint64_t pack_off[FORMAT_COUNT];    /* each format's entry in the pack, by FORMAT_* bit */
+    size_t pack_len[FORMAT_COUNT];
+    char *parsed;        /* --link: encoded parse, held for the HTML pass */
+    size_t parsed_len;
+    uint64_t parsed_off; /* where it was spooled instead, when parsed is NULL */
+    SearchName *names;   /* --search: the names the file documents */
+    uint32_t name_count;
+    MergeDecl *decls;    /* --merge: the functions the file declares or defines */
+    uint32_t decl_count;
+    char *decl_text;     /* their strings */
+    int shard;           /* its IndexShard */
+    char *surface;       /* its symbols' lines for SURFACE_NAME, once parsed */
+    size_t surface_len;
+    char *changes;       /* --diff: its change records, as JSON */
+    size_t changes_len;
+    uint32_t changed[3]; /* --diff: symbols added, removed and modified */
+    uint64_t busy_ns;    /* --stats: loading, parsing and rendering it */
+    uint32_t nodes;
+    int truncated;       /* limits it hit, from DOCUNATION.truncated */
+} BulkFile;
+
+typedef struct {
+    int jobs;
+    int incremental;     /* keep outputs of sources unchanged since the last run */
+    const char *cache_dir;
+    unsigned formats;    /* FORMAT_* per-file outputs to write */
+    int single_json;     /* also write every source into one CORPUS_NAME */
+    int pack;            /* per-file outputs go into PACK_NAME instead of files */
+    int link;            /* cross-link HTML signatures through a symbol index */
+    int search;          /* write a client-side search index into SEARCH_DIR */
+    int merge;           /* write each function once, with its declarations, to MERGE_NAME */
+    int stats;           /* print where the run spent its time */
+    const char *stats_json;    /* write that report here as JSON */
+    GlobSet include;     /* when any are given, files must match one */
+    GlobSet exclude;     /* files and whole subtrees to leave out */
+    char **exts;         /* accepted suffixes such as ".c"; just ".c" if none */
+    int ext_count;
+    DefineSet defines;   /* -D and -U, for #if evaluation */
+    uint64_t max_mem;    /* --max-mem budget in bytes, or 0 for none */
+    const char *diff;    /* --diff: output directory of the run to compare with */
+} BulkOptions;
+
+/* Patterns from one directory's ignore file, chained to those above it */
+typedef struct IgnoreList {
+    const struct IgnoreList *parent;
+    struct IgnoreList *next;     /* every list of the run, for freeing */
+    size_t base_len;             /* length of the directory's relative path */
+    GlobSet globs;
+} IgnoreList;
+
+typedef struct {
+    BulkFile **items;
+    size_t head;         /* thieves take from here */
+    size_t tail;         /* owner pushes and pops here */
+    size_t cap;
+    pthread_mutex_t lock;
+} WorkDeque;
+
+/* One rendered output waiting for a writer; path and data follow it */
+typedef struct WriteJob {
+    struct WriteJob *next;
+    BulkFile *file;
+    char *path;
+    size_t len;
+    char data[];
+} WriteJob;
+
+/* --max-mem: bytes in flight across all threads. held counts what is only
+ * given back at the end of a pass: the threads' buffers and held parses. */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t room;     /* reservations given back */
+    uint64_t limit;          /* 0: no budget, nothing is counted */
+    uint64_t used;
+    uint64_t held;           /* part of used */
+    uint64_t peak;
+    uint64_t waits;
+    uint64_t wait_ns;
+} MemBudget;
+
+typedef struct WriteQueue WriteQueue;
+
+typedef struct {
+    WriteQueue *queue;
+    pthread_t thread;
+    ThreadStats *stats;      /* NULL without --stats */
+} WriterThread;
+
+struct WriteQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;    /* jobs queued, or closing */
+    pthread_cond_t room;     /* bytes dropped below WRITE_QUEUE_BYTES */
+    WriteJob *head;
+    WriteJob **tail;
+    size_t bytes;            /* queued and in flight */
+    MemBudget *budget;       /* charged for the jobs, lock taken inside lock */
+    int closing;
+    WriterThread *threads;
+    int count;               /* running writers; 0 writes synchronously */
+};
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    int used;
+} DirId;
+
+/* A directory waiting to be scanned */
+typedef struct {
+    char *path;
+    int fd;              /* opened relative to its parent, or -1 to open by path */
+    const IgnoreList *ignore;    /* innermost ignore file in effect */
+    int shard;           /* IndexShard of its files, or -1 for the root */
+} DirTask;
+
+/* The index pages of one top-level directory, or of the files at the root
+ * (name ""). The pages are written as soon as its last file is done. */
+typedef struct {
+    char *name;
+    BulkFile **files;    /* done so far */
+    size_t count;
+    size_t cap;
+    size_t dirs;         /* directories queued or being scanned */
+    size_t queued;       /* files found by finished scans */
+    size_t rows;         /* files on the pages written */
+    int streamed;        /* pages written while the run went on */
+} IndexShard;
+
+typedef struct BulkWorker BulkWorker;
+
+typedef struct {
+    const char *root;
+    size_t root_len;
+    const char *out_dir;
+    const BulkOptions *opts;
+    BulkFile *files;     /* gathered from the workers after the run */
+    size_t count;
+    WorkDeque *deques;
+    BulkWorker *workers;
+    int jobs;
+    ManifestEntry *manifest;
+    size_t manifest_count;
+    int manifest_found;      /* a manifest with a matching header was read */
+    char *surface_text;      /* the previous SURFACE_NAME, which entries point into */
+    int diff;                /* --diff: compare with the manifest instead of writing */
+
+    /* Discovery state, guarded by lock */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;     /* new directories or files, or discovery done */
+    DirTask *dirs;
+    size_t dir_count;
+    size_t dir_cap;
+    int scanning;            /* directories being scanned right now */
+    int held_fds;            /* queued directories holding an open fd */
+    IgnoreList *ignores;
+    DirId *linked;           /* directories scanned or reached through links */
+    size_t linked_count;
+    size_t linked_cap;       /* power of two, or 0 */
+    WriteQueue writes;
+    MemBudget budget;
+    int held_fd;             /* --max-mem --link: unlinked spool of parses, or -1 */
+    uint64_t held_len;       /* guarded by lock */
+    int corpus_fd;           /* unlinked spool of NDJSON blocks, or -1 */
+    uint64_t corpus_len;     /* guarded by lock */
+    int pack_fd;             /* pack being written, or -1 */
+    uint64_t pack_len;       /* guarded by lock */
+    Interner *strings;       /* names for --link and --search */
+    SymbolIndex *symbols;    /* --link */
+    ThreadStats *stats;      /* --stats: workers, then writers */
+    int writer_count;
+    BulkFile **link_files;   /* the HTML pass's work list */
+    size_t link_count;
+    size_t link_next;        /* guarded by lock */
+    IndexShard *shards;      /* guarded by lock; NULL when pages wait for the end */
+    size_t shard_count;
+    size_t shard_cap;
+    size_t discovered;       /* files found by finished scans, guarded by lock */
+    int shards_lost;         /* out of memory: shards are not exact */
+} BulkContext;
+
+/* Files a worker discovered live in its own fixed-size chunks, so their
+ * addresses stay put while other workers process them */
+struct BulkWorker {
+    BulkContext *ctx;
+    int id;
+    OutBuf out;          /* render buffer, reused across files */
+    size_t out_charged;  /* its capacity, as held in the budget */
+    ThreadStats *stats;  /* NULL without --stats */
+    BulkFile **chunks;
+    size_t chunk_count;
+    size_t last_used;    /* files used in the last chunk */
+};
+
+/* Each format's output path for one source, by FORMAT_* bit */
+typedef struct {
+    char path[FORMAT_COUNT][MAX_PATH_LEN];
+} OutputPaths;
+
+/* Output paths for a sanitized base name */
+static void bulk_output_paths(const char *out_dir, const char *base, OutputPaths *out) {
+    for (int k = 0; k < FORMAT_COUNT; k++) {
+        snprintf(out->path[k], MAX_PATH_LEN, "%s/%s/%s.%s", out_dir, format_exts[k], base,
+                 format_exts[k]);
+    }
+}
+
+static int outputs_exist(unsigned formats, const OutputPaths *out) {
+    for (int k = 0; k < FORMAT_COUNT; k++) {
+        if ((formats & (1u << k)) && access(out->path[k], F_OK) != 0) return 0;
+    }
+    return 1;
+}
+
+/* Delete whatever outputs a base name has, in any format */
+static void remove_outputs(const char *out_dir, const char *base) {
+    OutputPaths out;
+    bulk_output_paths(out_dir, base, &out);
+    for (int k = 0; k < FORMAT_COUNT; k++) remove(out.path[k]);
+}
+
+/* ─── Manifest ─────────────────────────────────────────────────────────────
+ * MANIFEST_NAME in the output directory records, for every documented
+ * source, its size, mtime and content hash, one tab-separated line each
+ * under a header naming the tool version. A manifest from another version
+ * is ignored, so upgrading always regenerates everything.
+ */
+
+static int compare_manifest_entries(const void *a, const void *b) {
+    const ManifestEntry *ea = a;
+    const ManifestEntry *eb = b;
+    return strcmp(ea->rel, eb->rel);
+}
+
+/* Outputs made under other -D, -U or --skip-inactive settings do not
+ * carry over, so those settings are part of the header. kind is
+ * "manifest" or "surface". */
+static void manifest_header(const BulkContext *ctx, const char *kind, char *header) {
+    uint64_t defines = defines_fingerprint(&ctx->opts->defines);
+    if (defines) {
+        snprintf(header, 64, "# DOCUNATION %s %s D%016llx\n", kind, DOCUNATION_VERSION,
+                 (unsigned long long)defines);
+    } else {
+        snprintf(header, 64, "# DOCUNATION %s %s\n", kind, DOCUNATION_VERSION);
+    }
+}
+
+/* ─── Symbol surface ──────────────────────────────────────────────────────
+ * SURFACE_NAME, beside the manifest, lists the nodes of every source the
+ * manifest does: a "@<TAB>rel" line, then one line per node with its line
+ * number, NodeType, the FNV-1a hashes of its signature and docstring, its
+ * name and its signature, backslash, tab and newline escaped. --diff
+ * compares a tree with these lines, so of the files the manifest lists
+ * only those whose content changed are parsed. A reused file's lines are
+ * carried over from the previous run.
+ * ──────────────────────────────────────────────────────────────────────── */
+
+/* A node as the surface records it */
+typedef struct {
+    uint64_t sig_hash;
+    uint64_t doc_hash;
+    const char *name;
+    size_t name_len;
+    const char *sig;     /* escaped when read back from a surface */
+    size_t sig_len;
+    int line;
+    int type;
+    int node;            /* index in the parsed document, or -1 */
+    int match;           /* entry it pairs with on the other side, or -1 */
+} SurfaceEntry;
+
+static void ob_surface(OutBuf *b, const char *s, size_t n) {
+    const char *e = s + n;
+    while (s < e) {
+        const char *run = s;
+        while (s < e && *s != '\\' && *s != '\t' && *s != '\n') s++;
+        ob_write(b, run, (size_t)(s - run));
+        if (s >= e) break;
+        char c = *s++;
+        char esc[2] = { '\\', c == '\t' ? 't' : c == '\n' ? 'n' : '\\' };
+        ob_write(b, esc, sizeof(esc));
+    }
+}
+
+/* Append an escaped surface string as JSON string content */
+static void ob_surface_json(OutBuf *b, const char *s, size_t n) {
+    const char *e = s + n;
+    while (s < e) {
+        const char *run = s;
+        while (s < e && *s != '\\') s++;
+        ob_json(b, run, (size_t)(s - run));
+        if (s >= e) break;
+        if (++s >= e) break;
+        char c = *s++;
+        char raw = c == 't' ? '\t' : c == 'n' ? '\n' : c;
+        ob_json(b, &raw, 1);
+    }
+}
+
+static void surface_entry(const DOCUNATION *doc, int i, SurfaceEntry *e) {
+    const DocNode *n = &doc->nodes[i];
+    e->sig_hash = fnv1a64(DSTR(doc, n->signature), n->signature.len);
+    e->doc_hash = fnv1a64(DSTR(doc, n->docstring), n->docstring.len);
+    e->name = DSTR(doc, n->name);
+    e->name_len = n->name.len;
+    e->sig = DSTR(doc, n->signature);
+    e->sig_len = n->signature.len;
+    e->line = n->line;
+    e->type = (int)n->type;
+    e->node = i;
+    e->match = -1;
+}
+
+/* Line fields by hand: printf dominated collecting a large tree */
+static char *surface_dec(char *p, int v) {
+    char tmp[12];
+    int n = 0;
+    unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+    if (v < 0) *p++ = '-';
+    do tmp[n++] = (char)('0' + u % 10); while (u /= 10);
+    while (n) *p++ = tmp[--n];
+    *p++ = '\t';
+    return p;
+}
+
+static char *surface_hex(char *p, uint64_t v) {
+    for (int i = 15; i >= 0; i--, v >>= 4) p[i] = "0123456789abcdef"[v & 15];
+    p[16] = '\t';
+    return p + 17;
+}
+
+/* Keep a parsed document's surface lines with its file */
+static int surface_collect(BulkFile *f, const DOCUNATION *doc, OutBuf *ob) {
+    ob_bind(ob, NULL);
+    for (int i = 0; i < doc->node_count; i++) {
+        SurfaceEntry e;
+        surface_entry(doc, i, &e);
+        char head[64], *h = head;
+        h = surface_dec(h, e.line);
+        h = surface_dec(h, e.type);
+        h = surface_hex(h, e.sig_hash);
+        h = surface_hex(h, e.doc_hash);
+        ob_write(ob, head, (size_t)(h - head));
+        ob_surface(ob, e.name, e.name_len);
+        OB_LIT(ob, "\t");
+        ob_surface(ob, e.sig, e.sig_len);
+        OB_LIT(ob, "\n");
+    }
+    if (ob->failed || !(f->surface = malloc(ob->len ? ob->len : 1))) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return -1;
+    }
+    memcpy(f->surface, ob->data, ob->len);
+    f->surface_len = ob->len;
+    return 0;
+}
+
+/* A file's surface lines: its own once parsed, else the previous run's */
+static const char *surface_of(const BulkFile *f, size_t *len) {
+    if (f->surface) {
+        *len = f->surface_len;
+        return f->surface;
+    }
+    if (f->reused && f->prev && f->prev->surface) {
+        *len = f->prev->surface_len;
+        return f->prev->surface;
+    }
+    return NULL;
+}
+
+/* Read back the entries of one file's surface lines */
+static int surface_parse(const char *s, size_t len, SurfaceEntry **out, size_t *count) {
+    const char *end = s + len;
+    size_t n = 0;
+    for (const char *p = s; p < end; p++) n += *p == '\n';
+    *out = malloc((n ? n : 1) * sizeof(SurfaceEntry));
+    *count = 0;
+    if (!*out) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return -1;
+    }
+    while (s < end) {
+        const char *eol = memchr(s, '\n', (size_t)(end - s));
+        if (!eol) eol = end;
+        SurfaceEntry *e = &(*out)[*count];
+        char *p;
+        e->line = (int)strtol(s, &p, 10);
+        if (*p == '\t') e->type = (int)strtol(p + 1, &p, 10);
+        if (*p == '\t') e->sig_hash = strtoull(p + 1, &p, 16);
+        if (*p == '\t') e->doc_hash = strtoull(p + 1, &p, 16);
+        const char *name = *p == '\t' ? p + 1 : NULL;
+        const char *tab = name ? memchr(name, '\t', (size_t)(eol - name)) : NULL;
+        if (tab && e->type >= 0 && e->type < (int)(sizeof(node_type_names) / sizeof(*node_type_names))) {
+            e->name = name;
+            e->name_len = (size_t)(tab - name);
+            e->sig = tab + 1;
+            e->sig_len = (size_t)(eol - tab - 1);
+            e->node = -1;
+            e->match = -1;
+            (*count)++;
+        }
+        s = eol + 1;
+    }
+    return 0;
+}
+
+/* Attach the previous run's surface lines to the manifest entries */
+static void surface_load(BulkContext *ctx) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", ctx->out_dir, SURFACE_NAME);
+    size_t len = 0;
+    char *text = read_file(path, &len);
+    if (!text) return;
+    char header[64];
+    manifest_header(ctx, "surface", header);
+    size_t header_len = strlen(header);
+    if (len < header_len || memcmp(text, header, header_len) != 0 || text[len - 1] != '\n') {
+        free(text);
+        return;
+    }
+    ManifestEntry *e = NULL;
+    const char *end = text + len;
+    for (char *s = text + header_len; s < end;) {
+        char *eol = memchr(s, '\n', (size_t)(end - s));
+        if (!eol) eol = (char *)end;
+        if (s[0] == '@' && s + 1 < eol && s[1] == '\t') {
+            if (e) e->surface_len = (size_t)(s - e->surface);
+            *eol = '\0';
+            ManifestEntry key = { 0 };
+            key.rel = s + 2;
+            e = bsearch(&key, ctx->manifest, ctx->manifest_count, sizeof(ManifestEntry),
+                        compare_manifest_entries);
+            if (e) e->surface = eol + 1 < end ? eol + 1 : end;
+        }
+        s = eol + 1;
+    }
+    if (e) e->surface_len = (size_t)(end - e->surface);
+    ctx->surface_text = text;
+}
+
+/* Write the surface of the files the manifest lists; ctx->files is sorted */
+static int surface_save(BulkContext *ctx) {
+    char path[MAX_PATH_LEN];
+    char tmp_path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", ctx->out_dir, SURFACE_NAME);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%s.tmp", ctx->out_dir, SURFACE_NAME);
+
+    OutBuf ob = { 0 };
+    if (ob_open(&ob, tmp_path) != 0) return -1;
+    char header[64];
+    manifest_header(ctx, "surface", header);
+    ob_write(&ob, header, strlen(header));
+    for (size_t i = 0; i < ctx->count; i++) {
+        const BulkFile *f = &ctx->files[i];
+        size_t len;
+        const char *lines = surface_of(f, &len);
+        if (!f->ok || !lines || strpbrk(f->rel, "\t\n") || strpbrk(f->base, "\t\n")) continue;
+        ob_printf(&ob, "@\t%s\n", f->rel);
+        ob_write(&ob, lines, len);
+    }
+    int rc = ob_close(&ob, tmp_path);
+    ob_free(&ob);
+    if (rc == 0 && rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error: Cannot write '%s'\n", path);
+        rc = -1;
+    }
+    if (rc != 0) remove(tmp_path);
+    return rc;
+}
+
+/* Read the previous run's manifest, if there is a usable one */
+static int manifest_load(BulkContext *ctx) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", ctx->out_dir, MANIFEST_NAME);
+    FILE *in = fopen(path, "r");
+    if (!in) return 0;
+
+    char header[64];
+    manifest_header(ctx, "manifest", header);
+    char line[2 * MAX_PATH_LEN + 128];
+    if (!fgets(line, sizeof(line), in) || strcmp(line, header) != 0) {
+        fclose(in);
+        return 0;
+    }
+    ctx->manifest_found = 1;
+
+    size_t cap = 0;
+    int rc = 0;
+    while (fgets(line, sizeof(line), in)) {
+        char *end;
+        uint64_t hash = strtoull(line, &end, 16);
+        if (*end != '\t') continue;
+        uint64_t size = strtoull(end + 1, &end, 10);
+        if (*end != '\t') continue;
+        int64_t mtime = strtoll(end + 1, &end, 10);
+        if (*end != '\t') continue;
+        char *base = end + 1;
+        char *rel = strchr(base, '\t');
+        if (!rel) continue;
+        *rel++ = '\0';
+        rel[strcspn(rel, "\n")] = '\0';
+        if (!*base || !*rel) continue;
+
+        if (ctx->manifest_count >= cap) {
+            cap = cap ? cap * 2 : 256;
+            ManifestEntry *entries = realloc(ctx->manifest, cap * sizeof(ManifestEntry));
+            if (!entries) {
+                fprintf(stderr, "Error: Cannot allocate memory\n");
+                rc = -1;
+                break;
+            }
+            ctx->manifest = entries;
+        }
+        ManifestEntry *e = &ctx->manifest[ctx->manifest_count];
+        e->rel = strdup(rel);
+        e->base = strdup(base);
+        if (!e->rel || !e->base) {
+            free(e->rel);
+            free(e->base);
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            rc = -1;
+            break;
+        }
+        e->size = size;
+        e->mtime = mtime;
+        e->hash = hash;
+        e->seen = 0;
+        ctx->manifest_count++;
+    }
+    fclose(in);
+    qsort(ctx->manifest, ctx->manifest_count, sizeof(ManifestEntry), compare_manifest_entries);
+    surface_load(ctx);
+    return rc;
+}
+
+/* Delete the outputs of sources that no longer exist */
+static void manifest_prune(BulkContext *ctx) {
+    for (size_t i = 0; i < ctx->manifest_count; i++) {
+        ManifestEntry *e = &ctx->manifest[i];
+        if (e->seen) continue;
+        remove_outputs(ctx->out_dir, e->base);
+    }
+}
+
+/* Record this run's documented files; ctx->files must be sorted */
+static int manifest_save(BulkContext *ctx) {
+    char path[MAX_PATH_LEN];
+    char tmp_path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", ctx->out_dir, MANIFEST_NAME);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%s.tmp", ctx->out_dir, MANIFEST_NAME);
+
+    if (surface_save(ctx) != 0) return -1;
+    OutBuf ob = { 0 };
+    if (ob_open(&ob, tmp_path) != 0) return -1;
+    char header[64];
+    manifest_header(ctx, "manifest", header);
+    ob_write(&ob, header, strlen(header));
+    for (size_t i = 0; i < ctx->count; i++) {
+        const BulkFile *f = &ctx->files[i];
+        /* Names that would break the line format, and files with no
+         * surface to carry over, are simply redone next time */
+        size_t len;
+        if (!f->ok || !surface_of(f, &len) || strpbrk(f->rel, "\t\n") ||
+            strpbrk(f->base, "\t\n")) continue;
+        ob_printf(&ob, "%016llx\t%llu\t%lld\t%s\t%s\n", (unsigned long long)f->hash,
+                  (unsigned long long)f->size, (long long)f->mtime, f->base, f->rel);
+    }
+    int rc = ob_close(&ob, tmp_path);
+    ob_free(&ob);
+    if (rc == 0 && rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error: Cannot write '%s'\n", path);
+        rc = -1;
+    }
+    if (rc != 0) remove(tmp_path);
+    return rc;
+}
+
+static void manifest_free(BulkContext *ctx) {
+    for (size_t i = 0; i < ctx->manifest_count; i++) {
+        free(ctx->manifest[i].rel);
+        free(ctx->manifest[i].base);
+    }
+    free(ctx->manifest);
+    ctx->manifest = NULL;
+    ctx->manifest_count = 0;
+    free(ctx->surface_text);
+    ctx->surface_text = NULL;
+}
+
+/* A path's position under the root */
+static const char *bulk_rel(const BulkContext *ctx, const char *path) {
+    if (strncmp(path, ctx->root, ctx->root_len) != 0) return path;
+    path += ctx->root_len;
+    if (*path == '/' || *path == '\\') path++;
+    return path;
+}
+
+/* Record a discovered source file in the worker's storage */
+static BulkFile *bulk_add_file(BulkWorker *w, const char *path, const struct stat *st) {
+    BulkContext *ctx = w->ctx;
+    if (w->chunk_count == 0 || w->last_used == BULK_CHUNK) {
+        BulkFile **chunks = realloc(w->chunks, (w->chunk_count + 1) * sizeof(BulkFile *));
+        BulkFile *chunk = chunks ? malloc(BULK_CHUNK * sizeof(BulkFile)) : NULL;
+        if (chunks) w->chunks = chunks;
+        if (!chunk) {
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            return NULL;
+        }
+        w->chunks[w->chunk_count++] = chunk;
+        w->last_used = 0;
+    }
+    BulkFile *f = &w->chunks[w->chunk_count - 1][w->last_used];
+    memset(f, 0, sizeof(*f));
+    f->path = strdup(path);
+    if (!f->path) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return NULL;
+    }
+    w->last_used++;
+    f->rel = bulk_rel(ctx, f->path);
+    if (!*f->rel) f->rel = f->path;
+    f->size = (uint64_t)st->st_size;
+    f->mtime = stat_mtime_ns(st);
+
+    /* Each entry matches at most one file, so seen is never shared */
+    if (ctx->manifest_count) {
+        ManifestEntry key = { 0 };
+        key.rel = (char *)f->rel;
+        ManifestEntry *e = bsearch(&key, ctx->manifest, ctx->manifest_count,
+                                   sizeof(ManifestEntry), compare_manifest_entries);
+        if (e) {
+            e->seen = 1;
+            f->prev = e;
+        }
+    }
+    return f;
+}
+
+/* ─── Phase timers ───────────────────────────────────────────────────────
+ * With --stats each thread keeps its own ThreadStats, so timing takes no
+ * lock. Without it every ThreadStats pointer is NULL and nothing is timed.
+ * ──────────────────────────────────────────────────────────────────────── */
+
+static uint64_t stats_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t stats_start(const ThreadStats *ts) {
+    return ts ? stats_clock() : 0;
+}
+
+/* Charge one item of phase p, begun at start, to ts; returns its time */
+static uint64_t stats_add(ThreadStats *ts, Phase p, uint64_t start, uint64_t bytes) {
+    if (!ts) return 0;
+    uint64_t ns = stats_clock() - start;
+    ts->ns[p] += ns;
+    ts->items[p]++;
+    ts->bytes[p] += bytes;
+    return ns;
+}
+
+/* Charge rendering begun at start, less the queueing and writing done
+ * meanwhile; wrote is stats_output_ns(ts) as it was at start */
+static uint64_t stats_output_ns(const ThreadStats *ts) {
+    return ts ? ts->ns[PHASE_QUEUE] + ts->ns[PHASE_WRITE] : 0;
+}
+
+static void stats_add_render(ThreadStats *ts, uint64_t start, uint64_t wrote) {
+    if (!ts) return;
+    uint64_t ns = stats_clock() - start - (stats_output_ns(ts) - wrote);
+    ts->ns[PHASE_RENDER] += ns;
+    ts->items[PHASE_RENDER]++;
+}
+
+/* ─── Declaration merge ──────────────────────────────────────────────────
+ * With --merge, every function the tree declares or defines is written to
+ * MERGE_NAME once: its definition, or its first declaration when nothing
+ * defines it, with the docstring of the first member that has one and the
+ * places that declare it. Workers record each file's functions keyed by
+ * a hash of the normalized signature. After the run a hash join groups
+ * them: threads count the keys of a range of files per partition, scatter
+ * them into one array partition by partition, then group the partitions
+ * in parallel through a table each. Files stay in path order throughout,
+ * so the choice of member does not depend on how the work was split.
+ * ──────────────────────────────────────────────────────────────────────── */
+
+typedef struct {
+    const char *s;
+    uint32_t len;
+} MergeToken;
+
+static int token_is(const MergeToken *t, const char *word) {
+    return t->len == strlen(word) && memcmp(t->s, word, t->len) == 0;
+}
+
+static int token_ident(const MergeToken *t) {
+    return is_ident_char(t->s[0]) && !isdigit((unsigned char)t->s[0]);
+}
+
+static int token_qualifier(const MergeToken *t) {
+    return token_is(t, "const") || token_is(t, "volatile") || token_is(t, "restrict") ||
+           token_is(t, "register");
+}
+
+static int token_type_word(const MergeToken *t) {
+    static const char *const words[] = {
+        "void", "char", "short", "int", "long", "float", "double", "signed", "unsigned",
+        "_Bool", "bool", "_Complex", "const", "volatile", "restrict",
+    };
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        if (token_is(t, words[i])) return 1;
+    }
+    return 0;
+}
+
+/* Split a signature into identifiers and single punctuation bytes,
+ * dropping comments; returns the count, or -1 past MERGE_TOKENS */
+static int merge_tokens(const char *s, const char *e, MergeToken *tok) {
+    int n = 0;
+    while (s < e) {
+        if (isspace((unsigned char)*s)) {
+            s++;
+            continue;
+        }
+        if (span_starts(s, e, "/*")) {
+            const char *close = span_find(s + 2, e, "*/");
+            s = close ? close + 2 : e;
+            continue;
+        }
+        if (span_starts(s, e, "//")) break;
+        if (n == MERGE_TOKENS) return -1;
+        const char *t = s++;
+        if (is_ident_char(*t)) {
+            while (s < e && is_ident_char(*s)) s++;
+        }
+        tok[n].s = t;
+        tok[n].len = (uint32_t)(s - t);
+        n++;
+    }
+    return n;
+}
+
+/* Index just past the parenthesized group opening at tok[i] */
+static int skip_group(const MergeToken *tok, int n, int i) {
+    int depth = 0;
+    for (; i < n; i++) {
+        if (token_is(&tok[i], "(")) depth++;
+        else if (token_is(&tok[i], ")") && --depth == 0) return i + 1;
+    }
+    return n;
+}
+
+/* Add a token to the normalized text in buf; returns -1 when full */
+static int merge_emit(char *buf, size_t *len, size_t cap, const MergeToken *t) {
+    if (*len + t->len + 1 > cap) return -1;
+    if (*len) buf[(*len)++] = ' ';
+    memcpy(buf + *len, t->s, t->len);
+    *len += t->len;
+    return 0;
+}
+
+/* Key of a function signature that a prototype and its definition share:
+ * the name and the parameter types, without each parameter's name, an
+ * empty list reading as void. C does not overload, and what precedes the
+ * name differs freely between the two (extern, export macros, a return
+ * type on the line before), so that is left out. 0 when the signature is
+ * not understood. */
+static uint64_t merge_key(const char *sig, size_t len, const char *name, size_t name_len) {
+    MergeToken tok[MERGE_TOKENS];
+    int n = merge_tokens(sig, sig + len, tok);
+    int at = -1;
+    for (int i = 0; i + 1 < n; i++) {
+        if (tok[i].len == name_len && memcmp(tok[i].s, name, name_len) == 0 &&
+            token_is(&tok[i + 1], "(")) {
+            at = i;
+            break;
+        }
+    }
+    if (at < 0) return 0;
+
+    char buf[2048];
+    size_t out = 0;
+    int rc = merge_emit(buf, &out, sizeof(buf), &tok[at]);
+    rc |= merge_emit(buf, &out, sizeof(buf), &tok[at + 1]);
+
+    /* Parameters at depth 1, each without the name it may end with */
+    int end = skip_group(tok, n, at + 1) - 1;
+    if (end <= at + 1 || !token_is(&tok[end], ")")) return 0;
+    int params = 0;
+    for (int ps = at + 2; ps < end && rc == 0;) {
+        int pe = ps;
+        int nested = 0;
+        for (int depth = 0; pe < end; pe++) {
+            if (token_is(&tok[pe], "(") || token_is(&tok[pe], "[")) {
+                depth++;
+                nested |= token_is(&tok[pe], "(");
+            } else if (token_is(&tok[pe], ")") || token_is(&tok[pe], "]")) {
+                depth--;
+            } else if (depth == 0 && token_is(&tok[pe], ",")) {
+                break;
+            }
+        }
+        int drop = -1;
+        if (!nested) {
+            int k = pe - 1;
+            for (int b = ps; b < pe; b++) {
+                if (token_is(&tok[b], "[")) {
+                    k = b - 1;
+                    break;
+                }
+            }
+            int typed = 0;
+            for (int b = ps; b < k; b++) typed |= !token_qualifier(&tok[b]);
+            if (k > ps && typed && token_ident(&tok[k]) && !token_type_word(&tok[k]) &&
+                !token_is(&tok[k - 1], "struct") && !token_is(&tok[k - 1], "union") &&
+                !token_is(&tok[k - 1], "enum")) {
+                drop = k;
+            }
+        }
+        if (params++) rc |= merge_emit(buf, &out, sizeof(buf), &(MergeToken){ ",", 1 });
+        for (int b = ps; b < pe && rc == 0; b++) {
+            if (b != drop) rc = merge_emit(buf, &out, sizeof(buf), &tok[b]);
+        }
+        ps = pe + 1;
+    }
+    if (!params) rc |= merge_emit(buf, &out, sizeof(buf), &(MergeToken){ "void", 4 });
+    rc |= merge_emit(buf, &out, sizeof(buf), &tok[end]);
+    if (rc != 0) return 0;
+    uint64_t key = fnv1a64(buf, out);
+    return key ? key : 1;
+}
+
+/* Keep the functions a document declares or defines. Static ones are
+ * private to their file and left out. */
+static int merge_collect(BulkFile *f, const DOCUNATION *doc) {
+    size_t text = 0;
+    uint32_t count = 0;
+    for (int i = 0; i < doc->node_count; i++) {
+        const DocNode *n = &doc->nodes[i];
+        if (n->type != NODE_FUNCTION || n->is_static || !n->name.len) continue;
+        text += (size_t)n->name.len + n->signature.len + n->docstring.len;
+        count++;
+    }
+    if (!count) return 0;
+    f->decls = malloc(count * sizeof(MergeDecl));
+    f->decl_text = text <= UINT32_MAX ? malloc(text ? text : 1) : NULL;
+    if (!f->decls || !f->decl_text) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return -1;
+    }
+    uint32_t off = 0;
+    for (int i = 0; i < doc->node_count; i++) {
+        const DocNode *n = &doc->nodes[i];
+        if (n->type != NODE_FUNCTION || n->is_static || !n->name.len) continue;
+        uint64_t key = merge_key(DSTR(doc, n->signature), n->signature.len,
+                                 DSTR(doc, n->name), n->name.len);
+        if (!key) continue;
+        MergeDecl *d = &f->decls[f->decl_count++];
+        const Slice *strs[3] = { &n->name, &n->signature, &n->docstring };
+        for (int k = 0; k < 3; k++) {
+            memcpy(f->decl_text + off, DSTR(doc, *strs[k]), strs[k]->len);
+            d->str[k][0] = off;
+            d->str[k][1] = strs[k]->len;
+            off += strs[k]->len;
+        }
+        d->key = key;
+        d->line = n->line;
+        d->defined = n->has_body != 0;
+    }
+    return 0;
+}
+
+/* A member of a group, by index in ctx->files and in that file's decls */
+typedef struct {
+    uint32_t file;
+    uint32_t decl;
+} MergeRef;
+
+typedef struct {
+    const BulkFile *file;        /* the canonical entry */
+    const MergeDecl *decl;
+    const BulkFile *doc_file;    /* where its docstring comes from */
+    const MergeDecl *doc;
+    size_t first;                /* members, together in the join's members */
+    uint32_t count;
+} MergeGroup;
+
+typedef struct {
+    BulkContext *ctx;
+    int threads;
+    size_t parts;                /* a power of two */
+    size_t *offsets;             /* [thread][part]: key counts, then scatter positions */
+    size_t *part_start;          /* parts + 1 */
+    MergeRef *refs;              /* by partition, in file order within each */
+    MergeRef *members;           /* refs again, each group's together */
+    MergeGroup **groups;         /* per partition */
+    size_t *group_count;
+    pthread_mutex_t lock;
+    size_t next_part;            /* guarded by lock */
+    int failed;                  /* guarded by lock */
+} MergeJoin;
+
+typedef struct {
+    MergeJoin *join;
+    int id;
+} MergeTask;
+
+#define MERGE_DECL(ctx, r) (&(ctx)->files[(r).file].decls[(r).decl])
+
+static size_t merge_part(const MergeJoin *j, uint64_t key) {
+    return (size_t)(key >> 40) & (j->parts - 1);
+}
+
+/* The files counted or scattered by one thread */
+static void merge_range(const MergeJoin *j, int id, size_t *begin, size_t *end) {
+    *begin = j->ctx->count * (size_t)id / (size_t)j->threads;
+    *end = j->ctx->count * (size_t)(id + 1) / (size_t)j->threads;
+}
+
+static void *merge_count(void *arg) {
+    MergeTask *t = arg;
+    MergeJoin *j = t->join;
+    size_t *counts = j->offsets + (size_t)t->id * j->parts;
+    size_t begin, end;
+    merge_range(j, t->id, &begin, &end);
+    for (size_t i = begin; i < end; i++) {
+        const BulkFile *f = &j->ctx->files[i];
+        if (!f->ok) continue;
+        for (uint32_t k = 0; k < f->decl_count; k++) counts[merge_part(j, f->decls[k].key)]++;
+    }
+    return NULL;
+}
+
+static void *merge_scatter(void *arg) {
+    MergeTask *t = arg;
+    MergeJoin *j = t->join;
+    size_t *at = j->offsets + (size_t)t->id * j->parts;
+    size_t begin, end;
+    merge_range(j, t->id, &begin, &end);
+    for (size_t i = begin; i < end; i++) {
+        const BulkFile *f = &j->ctx->files[i];
+        if (!f->ok) continue;
+        for (uint32_t k = 0; k < f->decl_count; k++) {
+            j->refs[at[merge_part(j, f->decls[k].key)]++] = (MergeRef){ (uint32_t)i, k };
+        }
+    }
+    return NULL;
+}
+
+/* Group one partition's refs by key through an open-addressing table,
+ * chaining each group's members in file order */
+static int merge_group_part(MergeJoin *j, size_t part) {
+    BulkContext *ctx = j->ctx;
+    size_t start = j->part_start[part];
+    size_t n = j->part_start[part + 1] - start;
+    if (!n) return 0;
+    size_t cap = 16;
+    while (cap < n * 2) cap *= 2;
+    uint32_t *slots = calloc(cap, sizeof(uint32_t));     /* group number + 1 */
+    uint32_t *next = malloc(n * sizeof(uint32_t));       /* member after, or UINT32_MAX */
+    uint32_t *ends = malloc(n * 2 * sizeof(uint32_t));   /* per group: first, last */
+    MergeGroup *groups = malloc(n * sizeof(MergeGroup));
+    if (!slots || !next || !ends || !groups) {
+        free(slots);
+        free(next);
+        free(ends);
+        free(groups);
+        return -1;
+    }
+    const MergeRef *refs = j->refs + start;
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t key = MERGE_DECL(ctx, refs[i])->key;
+        size_t slot = (size_t)key & (cap - 1);
+        while (slots[slot] && MERGE_DECL(ctx, refs[ends[(slots[slot] - 1) * 2]])->key != key) {
+            slot = (slot + 1) & (cap - 1);
+        }
+        next[i] = UINT32_MAX;
+        if (!slots[slot]) {
+            slots[slot] = (uint32_t)++count;
+            ends[(count - 1) * 2] = ends[(count - 1) * 2 + 1] = (uint32_t)i;
+        } else {
+            uint32_t *last = &ends[(slots[slot] - 1) * 2 + 1];
+            next[*last] = (uint32_t)i;
+            *last = (uint32_t)i;
+        }
+    }
+
+    /* Lay each group's members out together, picking its entries */
+    size_t at = start;
+    for (size_t g = 0; g < count; g++) {
+        MergeGroup *grp = &groups[g];
+        grp->first = at;
+        grp->count = 0;
+        MergeRef canon = refs[ends[g * 2]];
+        MergeRef doc = canon;
+        int defined = 0;
+        int documented = 0;
+        for (uint32_t i = ends[g * 2]; i != UINT32_MAX; i = next[i]) {
+            const MergeDecl *d = MERGE_DECL(ctx, refs[i]);
+            if (d->defined && !defined) {
+                canon = refs[i];
+                defined = 1;
+            }
+            if (d->str[2][1] && !documented) {
+                doc = refs[i];
+                documented = 1;
+            }
+            j->members[at++] = refs[i];
+            grp->count++;
+        }
+        if (MERGE_DECL(ctx, canon)->str[2][1]) doc = canon;
+        grp->file = &ctx->files[canon.file];
+        grp->decl = MERGE_DECL(ctx, canon);
+        grp->doc_file = &ctx->files[doc.file];
+        grp->doc = MERGE_DECL(ctx, doc);
+    }
+    free(slots);
+    free(next);
+    free(ends);
+    j->groups[part] = groups;
+    j->group_count[part] = count;
+    return 0;
+}
+
+static void *merge_group(void *arg) {
+    MergeJoin *j = ((MergeTask *)arg)->join;
+    for (;;) {
+        pthread_mutex_lock(&j->lock);
+        size_t part = j->next_part++;
+        pthread_mutex_unlock(&j->lock);
+        if (part >= j->parts) break;
+        if (merge_group_part(j, part) != 0) {
+            pthread_mutex_lock(&j->lock);
+            j->failed = 1;
+            pthread_mutex_unlock(&j->lock);
+        }
+    }
+    return NULL;
+}
+
+/* Run fn on every thread of the join, the calling one included */
+static void merge_parallel(MergeJoin *j, MergeTask *tasks, pthread_t *threads,
+                           void *(*fn)(void *)) {
+    int started = 1;
+    for (int i = 1; i < j->threads; i++) {
+        if (pthread_create(&threads[i], NULL, fn, &tasks[i]) != 0) break;
+        started++;
+    }
+    /* Ranges of threads that did not start are covered here */
+    for (int i = started; i < j->threads; i++) fn(&tasks[i]);
+    fn(&tasks[0]);
+    for (int i = 1; i < started; i++) pthread_join(threads[i], NULL);
+}
+
+/* By name, then by the path and line of the canonical entry */
+static int compare_merge_groups(const void *a, const void *b) {
+    const MergeGroup *ga = a;
+    const MergeGroup *gb = b;
+    uint32_t la = ga->decl->str[0][1];
+    uint32_t lb = gb->decl->str[0][1];
+    int c = memcmp(ga->file->decl_text + ga->decl->str[0][0],
+                   gb->file->decl_text + gb->decl->str[0][0], la < lb ? la : lb);
+    if (c) return c;
+    if (la != lb) return la < lb ? -1 : 1;
+    c = strcmp(ga->file->rel, gb->file->rel);
+    if (c) return c;
+    return (ga->decl->line > gb->decl->line) - (ga->decl->line < gb->decl->line);
+}
+
+static void merge_json_str(OutBuf *ob, const BulkFile *f, const uint32_t str[2]) {
+    ob_json(ob, f->decl_text + str[0], str[1]);
+}
+
+/* Write MERGE_NAME from the functions of every documented file;
+ * ctx->files must be sorted */
+static int merge_write(BulkContext *ctx) {
+    MergeJoin j = { 0 };
+    j.ctx = ctx;
+    j.threads = ctx->jobs > 0 ? ctx->jobs : 1;
+    j.parts = 1;
+    while (j.parts < (size_t)j.threads * 8) j.parts *= 2;
+    size_t total = 0;
+    for (size_t i = 0; i < ctx->count; i++) {
+        if (ctx->files[i].ok) total += ctx->files[i].decl_count;
+    }
+    j.offsets = calloc((size_t)j.threads * j.parts, sizeof(size_t));
+    j.part_start = malloc((j.parts + 1) * sizeof(size_t));
+    j.refs = malloc((total ? total : 1) * sizeof(MergeRef));
+    j.members = malloc((total ? total : 1) * sizeof(MergeRef));
+    j.groups = calloc(j.parts, sizeof(MergeGroup *));
+    j.group_count = calloc(j.parts, sizeof(size_t));
+    MergeTask *tasks = malloc((size_t)j.threads * sizeof(MergeTask));
+    pthread_t *threads = calloc((size_t)j.threads, sizeof(pthread_t));
+    MergeGroup *all = NULL;
+    int rc = -1;
+    if (!j.offsets || !j.part_start || !j.refs || !j.members || !j.groups || !j.group_count ||
+        !tasks || !threads) {
+        goto oom;
+    }
+    for (int i = 0; i < j.threads; i++) tasks[i] = (MergeTask){ &j, i };
+    pthread_mutex_init(&j.lock, NULL);
+
+    /* Partition-major positions, each thread's files after those before it */
+    merge_parallel(&j, tasks, threads, merge_count);
+    size_t at = 0;
+    for (size_t p = 0; p < j.parts; p++) {
+        j.part_start[p] = at;
+        for (int t = 0; t < j.threads; t++) {
+            size_t c = j.offsets[(size_t)t * j.parts + p];
+            j.offsets[(size_t)t * j.parts + p] = at;
+            at += c;
+        }
+    }
+    j.part_start[j.parts] = at;
+    merge_parallel(&j, tasks, threads, merge_scatter);
+    merge_parallel(&j, tasks, threads, merge_group);
+    pthread_mutex_destroy(&j.lock);
+    if (j.failed) goto oom;
+
+    size_t count = 0;
+    for (size_t p = 0; p < j.parts; p++) count += j.group_count[p];
+    all = malloc((count ? count : 1) * sizeof(MergeGroup));
+    if (!all) goto oom;
+    count = 0;
+    for (size_t p = 0; p < j.parts; p++) {
+        if (!j.group_count[p]) continue;     /* an empty partition has no array */
+        memcpy(all + count, j.groups[p], j.group_count[p] * sizeof(MergeGroup));
+        count += j.group_count[p];
+    }
+    qsort(all, count, sizeof(MergeGroup), compare_merge_groups);
+
+    char path[MAX_PATH_LEN];
+    char tmp_path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", ctx->out_dir, MERGE_NAME);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%s.tmp", ctx->out_dir, MERGE_NAME);
+    OutBuf ob = { 0 };
+    if (ob_open(&ob, tmp_path) != 0) goto done;
+    ob_printf(&ob, "{\n  \"version\": \"%s\",\n  \"symbols\": [\n", DOCUNATION_VERSION);
+    for (size_t g = 0; g < count; g++) {
+        const MergeGroup *grp = &all[g];
+        OB_LIT(&ob, "    {\n      \"name\": \"");
+        merge_json_str(&ob, grp->file, grp->decl->str[0]);
+        OB_LIT(&ob, "\",\n      \"signature\": \"");
+        merge_json_str(&ob, grp->file, grp->decl->str[1]);
+        OB_LIT(&ob, "\",\n      \"docstring\": \"");
+        merge_json_str(&ob, grp->doc_file, grp->doc->str[2]);
+        OB_LIT(&ob, "\",\n      \"file\": \"");
+        ob_json(&ob, grp->file->rel, strlen(grp->file->rel));
+        ob_printf(&ob, "\",\n      \"line\": %d,\n      \"defined\": %s,\n      \"declared_in\": [",
+                  grp->decl->line, grp->decl->defined ? "true" : "false");
+        int listed = 0;
+        for (uint32_t m = 0; m < grp->count; m++) {
+            MergeRef r = j.members[grp->first + m];
+            const MergeDecl *d = MERGE_DECL(ctx, r);
+            if (d == grp->decl) continue;
+            ob_str(&ob, listed++ ? ", {\"file\": \"" : "{\"file\": \"");
+            ob_json(&ob, ctx->files[r.file].rel, strlen(ctx->files[r.file].rel));
+            ob_printf(&ob, "\", \"line\": %d}", d->line);
+        }
+        ob_str(&ob, g + 1 < count ? "]\n    },\n" : "]\n    }\n");
+    }
+    OB_LIT(&ob, "  ]\n}\n");
+    rc = ob_close(&ob, tmp_path);
+    ob_free(&ob);
+    if (rc == 0 && rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error: Cannot write '%s'\n", path);
+        rc = -1;
+    }
+    if (rc != 0) remove(tmp_path);
+    goto done;
+
+oom:
+    fprintf(stderr, "Error: Cannot allocate memory\n");
+done:
+    free(all);
+    free(tasks);
+    free(threads);
+    if (j.groups) {
+        for (size_t p = 0; p < j.parts; p++) free(j.groups[p]);
+    }
+    free(j.groups);
+    free(j.group_count);
+    free(j.offsets);
+    free(j.part_start);
+    free(j.refs);
+    free(j.members);
+    return rc;
+}
+
+/* ─── Memory budget ──────────────────────────────────────────────────────
+ * With --max-mem, what bulk mode holds in memory is charged to one budget:
+ * each document from load to free, rendered output queued for the
+ * writers, the threads' render buffers and --link parses. A worker
+ * reserves a file's estimated size before loading it and waits while
+ * other work that will finish has the budget spent; the estimate is
+ * corrected to the real footprint once parsed. Waits only ever depend on
+ * work that can finish without waiting itself, so a file too large for
+ * the budget is simply done alone.
+ * ──────────────────────────────────────────────────────────────────────── */
+
+/* Smallest render buffer; a budget must hold eight per worker */
+#define BUDGET_MIN_BUFFER ((uint64_t)64 << 10)
+
+static void budget_init(MemBudget *b, uint64_t limit) {
+    memset(b, 0, sizeof(*b));
+    b->limit = limit;
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->room, NULL);
+}
+
+static void budget_destroy(MemBudget *b) {
+    pthread_mutex_destroy(&b->lock);
+    pthread_cond_destroy(&b->room);
+}
+
+/* What a file is expected to take once loaded and parsed */
+static uint64_t budget_estimate(uint64_t size) {
+    return sizeof(DOCUNATION) + ARENA_MIN_CAP + NODES_MIN_CAP * sizeof(DocNode) + 2 * size;
+}
+
+/* Take n bytes without waiting. held marks bytes kept until the pass ends. */
+static void budget_charge(MemBudget *b, uint64_t n, int held) {
+    if (!b->limit || !n) return;
+    pthread_mutex_lock(&b->lock);
+    b->used += n;
+    if (held) b->held += n;
+    if (b->used > b->peak) b->peak = b->used;
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* Take n bytes once they fit, while anything that will give bytes back is
+ * outstanding. Callers hold no reservation of their own that they wait on. */
+static void budget_reserve(MemBudget *b, uint64_t n) {
+    if (!b->limit) return;
+    pthread_mutex_lock(&b->lock);
+    if (b->used > b->held && b->used + n > b->limit) {
+        uint64_t start = stats_clock();
+        b->waits++;
+        while (b->used > b->held && b->used + n > b->limit) pthread_cond_wait(&b->room, &b->lock);
+        b->wait_ns += stats_clock() - start;
+    }
+    b->used += n;
+    if (b->used > b->peak) b->peak = b->used;
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* Keep n bytes for the rest of the pass if they fit within half the
+ * budget, leaving the other half to the work in flight; returns 0 when the
+ * caller should put the data on disk instead */
+static int budget_hold(MemBudget *b, uint64_t n) {
+    if (!b->limit) return 1;
+    pthread_mutex_lock(&b->lock);
+    int fits = b->held + n <= b->limit / 2;
+    if (fits) {
+        b->used += n;
+        b->held += n;
+        if (b->used > b->peak) b->peak = b->used;
+    }
+    pthread_mutex_unlock(&b->lock);
+    return fits;
+}
+
+static void budget_release(MemBudget *b, uint64_t n, int held) {
+    if (!b->limit || !n) return;
+    pthread_mutex_lock(&b->lock);
+    b->used -= n;
+    if (held) b->held -= n;
+    pthread_cond_broadcast(&b->room);
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* Whether n more bytes fit right now */
+static int budget_fits(MemBudget *b, uint64_t n) {
+    if (!b->limit) return 1;
+    pthread_mutex_lock(&b->lock);
+    int fits = b->used + n <= b->limit;
+    pthread_mutex_unlock(&b->lock);
+    return fits;
+}
+
+/* Render buffers start small enough that the threads' share stays an
+ * eighth of the budget; output that outgrows one still spills as usual */
+static size_t budget_buffer(const MemBudget *b, int threads) {
+    uint64_t cap = b->limit / 8 / (uint64_t)(threads > 0 ? threads : 1);
+    return cap < BUDGET_MIN_BUFFER ? BUDGET_MIN_BUFFER : cap > OUTBUF_CAP ? OUTBUF_CAP : (size_t)cap;
+}
+
+/* Follow a buffer that lives for the whole pass as it grows */
+static void budget_track(MemBudget *b, size_t *charged, size_t cap) {
+    if (cap > *charged) budget_charge(b, cap - *charged, 1);
+    else budget_release(b, *charged - cap, 1);
+    *charged = cap;
+}
+
+/* ─── Output writers ─────────────────────────────────────────────────────
+ * Workers render into memory and hand each finished output to a writer
+ * thread, which creates it with a bare open/write/close while the worker
+ * parses the next source. Writers take jobs in batches, and workers wait
+ * once WRITE_QUEUE_BYTES are pending, or the budget is spent while jobs
+ * are. Output too large for one buffer is written by the worker as it
+ * renders, and so is output the budget has no room for once the queue is
+ * empty.
+ * ──────────────────────────────────────────────────────────────────────── */
+
+static int write_whole_file(const char *path, const char *data, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return -1;
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return close(fd);
+}
+
+static void *bulk_writer(void *arg) {
+    WriterThread *self = arg;
+    WriteQueue *q = self->queue;
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        while (!q->head && !q->closing) pthread_cond_wait(&q->ready, &q->lock);
+        if (!q->head) break;
+        WriteJob *batch = q->head;
+        WriteJob *last = batch;
+        for (int i = 1; i < WRITE_BATCH && last->next; i++) last = last->next;
+        q->head = last->next;
+        if (!q->head) q->tail = &q->head;
+        last->next = NULL;
+        pthread_mutex_unlock(&q->lock);
+
+        size_t done = 0;
+        uint64_t charged = 0;
+        BulkFile *failed[WRITE_BATCH];
+        int failures = 0;
+        for (WriteJob *job = batch, *next; job; job = next) {
+            next = job->next;
+            uint64_t start = stats_start(self->stats);
+            int rc = write_whole_file(job->path, job->data, job->len);
+            stats_add(self->stats, PHASE_WRITE, start, job->len);
+            if (rc != 0) {
+                fprintf(stderr, "Error: Cannot write '%s'\n", job->path);
+                failed[failures++] = job->file;
+            }
+            done += job->len;
+            charged += sizeof(WriteJob) + job->len + strlen(job->path) + 1;
+            free(job);
+        }
+
+        pthread_mutex_lock(&q->lock);
+        for (int i = 0; i < failures; i++) failed[i]->write_failed = 1;
+        q->bytes -= done;
+        budget_release(q->budget, charged, 0);
+        pthread_cond_broadcast(&q->room);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+/* Start count writers; stats, if given, has a slot for each */
+static void write_queue_start(WriteQueue *q, int count, ThreadStats *stats, MemBudget *budget) {
+    memset(q, 0, sizeof(*q));
+    q->tail = &q->head;
+    q->budget = budget;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->ready, NULL);
+    pthread_cond_init(&q->room, NULL);
+    q->threads = calloc(count, sizeof(WriterThread));
+    for (int i = 0; q->threads && i < count; i++) {
+        WriterThread *t = &q->threads[i];
+        t->queue = q;
+        t->stats = stats ? &stats[i] : NULL;
+        if (pthread_create(&t->thread, NULL, bulk_writer, t) != 0) break;
+        q->count++;
+    }
+}
+
+/* Wait for every queued output to be written, then stop the writers */
+static void write_queue_stop(WriteQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closing = 1;
+    pthread_cond_broadcast(&q->ready);
+    pthread_mutex_unlock(&q->lock);
+    for (int i = 0; i < q->count; i++) pthread_join(q->threads[i].thread, NULL);
+    free(q->threads);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->ready);
+    pthread_cond_destroy(&q->room);
+}
+
+/* Queue what was rendered into ob since ob_defer(ob, path) */
+static int write_queue_push(WriteQueue *q, BulkFile *f, OutBuf *ob, const char *path) {
+    if (ob->sink) return ob_close(ob, path);
+    if (ob->failed) {
+        fprintf(stderr, "Error: Cannot write '%s'\n", path);
+        return -1;
+    }
+    size_t path_len = strlen(path) + 1;
+    size_t size = sizeof(WriteJob) + ob->len + path_len;
+    int queued = q->count > 0;
+    if (queued) {
+        /* Room is taken before the copy is made, so the copy fits */
+        pthread_mutex_lock(&q->lock);
+        while (q->bytes > WRITE_QUEUE_BYTES || (q->bytes && !budget_fits(q->budget, size))) {
+            pthread_cond_wait(&q->room, &q->lock);
+        }
+        queued = budget_fits(q->budget, size);
+        if (queued) {
+            q->bytes += ob->len;
+            budget_charge(q->budget, size, 0);
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+    if (!queued) {
+        if (write_whole_file(path, ob->data, ob->len) == 0) return 0;
+        fprintf(stderr, "Error: Cannot write '%s'\n", path);
+        return -1;
+    }
+    WriteJob *job = malloc(size);
+    if (job) {
+        job->next = NULL;
+        job->file = f;
+        job->len = ob->len;
+        memcpy(job->data, ob->data, ob->len);
+        job->path = job->data + ob->len;
+        memcpy(job->path, path, path_len);
+    }
+    pthread_mutex_lock(&q->lock);
+    if (job) {
+        *q->tail = job;
+        q->tail = &job->next;
+        pthread_cond_signal(&q->ready);
+    } else {
+        q->bytes -= ob->len;
+        budget_release(q->budget, size, 0);
+        pthread_cond_broadcast(&q->room);
+    }
+    pthread_mutex_unlock(&q->lock);
+    if (!job) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Append what was rendered into ob to a file shared by all workers: the
+ * offset is reserved under ctx->lock and the bytes go out with pwrite, so
+ * workers never wait on each other's writes */
+static int spool_append(BulkContext *ctx, int fd, uint64_t *end, const OutBuf *ob,
+                        uint64_t *off) {
+    if (ob->failed) return -1;
+    pthread_mutex_lock(&ctx->lock);
+    *off = *end;
+    *end += ob->len;
+    pthread_mutex_unlock(&ctx->lock);
+
+    const char *data = ob->data;
+    size_t len = ob->len;
+    off_t at = (off_t)*off;
+    while (len) {
+        ssize_t n = pwrite(fd, data, len, at);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t)n;
+        at += n;
+    }
+    return 0;
+}
+
+/* Read back len bytes that spool_append put at off */
+static int pread_full(int fd, char *buf, size_t len, uint64_t off) {
+    off_t at = (off_t)off;
+    while (len) {
+        ssize_t n = pread(fd, buf, len, at);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buf += n;
+        len -= (size_t)n;
+        at += n;
+    }
+    return 0;
+}
+
+/* Render format bit k of a document to its file or into the pack */
+static int emit_output(BulkContext *ctx, BulkFile *f, DOCUNATION *doc, OutBuf *ob, int k,
+                       const char *path, const HtmlLinks *links, ThreadStats *ts) {
+    if (ctx->pack_fd >= 0) {
+        ob_bind(ob, NULL);
+    } else {
+        ob_defer(ob, path);
+    }
+    switch (k) {
+        case 0: output_text(doc, ob, 0); break;
+        case 1: output_json(doc, ob); break;
+        case 2: output_html(doc, ob, links); break;
+        default: if (bin_encode(doc, f->hash, ob) != 0) ob->failed = 1; break;
+    }
+    /* Output that outgrew the buffer, or with no writers, is written here */
+    Phase phase = ctx->pack_fd < 0 && ctx->writes.count && !ob->sink ? PHASE_QUEUE : PHASE_WRITE;
+    uint64_t start = stats_start(ts);
+    size_t len = ob->len;
+    int rc = 0;
+    if (ctx->pack_fd < 0) {
+        rc = write_queue_push(&ctx->writes, f, ob, path);
+    } else if (spool_append(ctx, ctx->pack_fd, &ctx->pack_len, ob, &f->pack_off[k]) != 0) {
+        fprintf(stderr, "Error: Cannot write %s\n", PACK_NAME);
+        rc = -1;
+    } else {
+        f->pack_len[k] = ob->len;
+    }
+    stats_add(ts, phase, start, len);
+    return rc;
+}
+
+/* Keep the names a document defines for the search index */
+static int search_collect(BulkContext *ctx, BulkFile *f, DOCUNATION *doc) {
+    f->names = malloc(((size_t)doc->node_count + 1) * sizeof(SearchName));
+    if (!f->names) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return -1;
+    }
+    for (int i = 0; i < doc->node_count; i++) {
+        const DocNode *n = &doc->nodes[i];
+        if (n->type == NODE_INCLUDE || !n->name.len) continue;
+        SearchName *e = &f->names[f->name_count];
+        e->id = intern(ctx->strings, DSTR(doc, n->name), n->name.len);
+        if (!e->id) {
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            return -1;
+        }
+        e->line = n->line;
+        e->type = (uint8_t)n->type;
+        f->name_count++;
+    }
+    return 0;
+}
+
+/* Render the selected formats through one scratch buffer. With --link the
+ * HTML waits for the second pass; the parse is kept encoded until then
+ * and its names go into the symbol index. */
+static int write_outputs(BulkContext *ctx, BulkFile *f, DOCUNATION *doc, OutBuf *ob,
+                         const OutputPaths *paths,
+                         ThreadStats *ts) {
+    unsigned formats = ctx->opts->formats;
+    if (ctx->symbols && (formats & FORMAT_HTML)) {
+        formats &= ~(unsigned)FORMAT_HTML;
+        ob_bind(ob, NULL);
+        if (bin_encode(doc, f->hash, ob) != 0) {
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            return -1;
+        }
+        /* Past half the budget, held parses wait in the spool instead */
+        if (ctx->held_fd >= 0 && !budget_hold(&ctx->budget, ob->len)) {
+            if (spool_append(ctx, ctx->held_fd, &ctx->held_len, ob, &f->parsed_off) != 0) {
+                fprintf(stderr, "Error: Cannot write the --link spool\n");
+                return -1;
+            }
+        } else if (!(f->parsed = malloc(ob->len))) {
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            return -1;
+        } else {
+            memcpy(f->parsed, ob->data, ob->len);
+        }
+        f->parsed_len = ob->len;
+        for (int i = 0; i < doc->node_count; i++) symbols_add(ctx->symbols, doc, i, f->base, f->rel);
+    }
+    for (int k = 0; k < FORMAT_COUNT; k++) {
+        if (!(formats & (1u << k))) continue;
+        if (emit_output(ctx, f, doc, ob, k, paths->path[k], NULL, ts) != 0) return -1;
+    }
+    if (ctx->opts->search && ctx->strings && search_collect(ctx, f, doc) != 0) return -1;
+    if (ctx->opts->merge && merge_collect(f, doc) != 0) return -1;
+    if (surface_collect(f, doc, ob) != 0) return -1;
+    if (ctx->corpus_fd >= 0) {
+        ob_bind(ob, NULL);
+        output_ndjson(doc, ob);
+        uint64_t start = stats_start(ts);
+        int rc = spool_append(ctx, ctx->corpus_fd, &ctx->corpus_len, ob, &f->corpus_off);
+        stats_add(ts, PHASE_WRITE, start, ob->len);
+        if (rc != 0) {
+            fprintf(stderr, "Error: Cannot write %s\n", CORPUS_NAME);
+            return -1;
+        }
+        f->corpus_len = ob->len;
+    }
+    return 0;
+}
+
+/* ─── Differences ────────────────────────────────────────────────────────
+ * --diff pairs the nodes of a file's two versions by type and name.
+ * Within a name, entries with the same signature and docstring pair
+ * first and the rest pair in source order as modified; whatever is left
+ * was added or removed. Each worker renders its files' records, and they
+ * are gathered in path order at the end.
+ * ──────────────────────────────────────────────────────────────────────── */
+
+enum { DIFF_ADDED, DIFF_REMOVED, DIFF_MODIFIED };
+
+static const char *const diff_kinds[] = { "added", "removed", "modified" };
+
+typedef struct {
+    int kind;
+    const SurfaceEntry *cur;     /* NULL when removed */
+    const SurfaceEntry *old;     /* NULL when added */
+} DiffRecord;
+
+static int compare_surface_entries(const void *a, const void *b) {
+    const SurfaceEntry *ea = a;
+    const SurfaceEntry *eb = b;
+    if (ea->type != eb->type) return ea->type - eb->type;
+    size_t n = ea->name_len < eb->name_len ? ea->name_len : eb->name_len;
+    int c = memcmp(ea->name, eb->name, n);
+    if (c) return c;
+    if (ea->name_len != eb->name_len) return ea->name_len < eb->name_len ? -1 : 1;
+    return ea->line - eb->line;
+}
+
+static int compare_diff_records(const void *a, const void *b) {
+    const DiffRecord *ra = a;
+    const DiffRecord *rb = b;
+    int la = (ra->cur ? ra->cur : ra->old)->line;
+    int lb = (rb->cur ? rb->cur : rb->old)->line;
+    if (la != lb) return la - lb;
+    return ra->kind - rb->kind;
+}
+
+static int surface_same_name(const SurfaceEntry *a, const SurfaceEntry *b) {
+    return a->type == b->type && a->name_len == b->name_len &&
+           memcmp(a->name, b->name, a->name_len) == 0;
+}
+
+/* Pair old and cur entries, both sorted by compare_surface_entries */
+static void diff_match(SurfaceEntry *old, size_t old_count, SurfaceEntry *cur, size_t cur_count) {
+    size_t i = 0, j = 0;
+    while (i < old_count && j < cur_count) {
+        int c = compare_surface_entries(&old[i], &cur[j]);
+        if (c && !surface_same_name(&old[i], &cur[j])) {
+            if (c < 0) i++;
+            else j++;
+            continue;
+        }
+        size_t ie = i, je = j;
+        while (ie < old_count && surface_same_name(&old[ie], &old[i])) ie++;
+        while (je < cur_count && surface_same_name(&cur[je], &cur[j])) je++;
+        for (size_t b = j; b < je; b++) {
+            for (size_t a = i; a < ie; a++) {
+                if (old[a].match < 0 && old[a].sig_hash == cur[b].sig_hash &&
+                    old[a].doc_hash == cur[b].doc_hash) {
+                    old[a].match = (int)b;
+                    cur[b].match = (int)a;
+                    break;
+                }
+            }
+        }
+        size_t a = i;
+        for (size_t b = j; b < je; b++) {
+            if (cur[b].match >= 0) continue;
+            while (a < ie && old[a].match >= 0) a++;
+            if (a == ie) break;
+            old[a].match = (int)b;
+            cur[b].match = (int)a;
+        }
+        i = ie;
+        j = je;
+    }
+}
+
+/* One change record, led by a comma; doc is the current parse, if any */
+static void diff_record(OutBuf *ob, const char *rel, const DOCUNATION *doc, const DiffRecord *r) {
+    const SurfaceEntry *e = r->cur ? r->cur : r->old;
+    OB_LIT(ob, ",\n    {\"file\": \"");
+    ob_json(ob, rel, strlen(rel));
+    ob_printf(ob, "\", \"change\": \"%s\", \"type\": \"%s\", \"name\": \"", diff_kinds[r->kind],
+              node_type_names[e->type]);
+    if (r->cur) ob_json(ob, e->name, e->name_len);
+    else ob_surface_json(ob, e->name, e->name_len);
+    ob_printf(ob, "\", \"line\": %d", e->line);
+    if (r->kind == DIFF_MODIFIED) ob_printf(ob, ", \"old_line\": %d", r->old->line);
+    OB_LIT(ob, ", \"signature\": \"");
+    if (r->cur) ob_json(ob, e->sig, e->sig_len);
+    else ob_surface_json(ob, e->sig, e->sig_len);
+    OB_LIT(ob, "\"");
+    if (r->kind == DIFF_MODIFIED) {
+        int sig_changed = r->old->sig_hash != r->cur->sig_hash;
+        if (sig_changed) {
+            OB_LIT(ob, ", \"old_signature\": \"");
+            ob_surface_json(ob, r->old->sig, r->old->sig_len);
+            OB_LIT(ob, "\"");
+        }
+        ob_printf(ob, ", \"signature_changed\": %s, \"docstring_changed\": %s",
+                  sig_changed ? "true" : "false",
+                  r->old->doc_hash != r->cur->doc_hash ? "true" : "false");
+    }
+    if (r->cur) {
+        const DocNode *n = &doc->nodes[r->cur->node];
+        OB_LIT(ob, ", \"docstring\": \"");
+        ob_json(ob, DSTR(doc, n->docstring), n->docstring.len);
+        OB_LIT(ob, "\"");
+    }
+    OB_LIT(ob, "}");
+}
+
+/* Render the records of a file's changes into ob; counts by DIFF_* kind */
+static int diff_render(OutBuf *ob, const char *rel, const DOCUNATION *doc,
+                       SurfaceEntry *old, size_t old_count, SurfaceEntry *cur, size_t cur_count,
+                       uint32_t counts[3]) {
+    if (old_count) qsort(old, old_count, sizeof(SurfaceEntry), compare_surface_entries);
+    if (cur_count) qsort(cur, cur_count, sizeof(SurfaceEntry), compare_surface_entries);
+    diff_match(old, old_count, cur, cur_count);
+    DiffRecord *records = malloc((old_count + cur_count + 1) * sizeof(DiffRecord));
+    if (!records) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return -1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < cur_count; i++) {
+        const SurfaceEntry *o = cur[i].match >= 0 ? &old[cur[i].match] : NULL;
+        if (o && o->sig_hash == cur[i].sig_hash && o->doc_hash == cur[i].doc_hash) continue;
+        records[n++] = (DiffRecord){ o ? DIFF_MODIFIED : DIFF_ADDED, &cur[i], o };
+    }
+    for (size_t i = 0; i < old_count; i++) {
+        if (old[i].match < 0) records[n++] = (DiffRecord){ DIFF_REMOVED, NULL, &old[i] };
+    }
+    qsort(records, n, sizeof(DiffRecord), compare_diff_records);
+    for (size_t i = 0; i < n; i++) {
+        diff_record(ob, rel, doc, &records[i]);
+        counts[records[i].kind]++;
+    }
+    free(records);
+    return 0;
+}
+
+/* Compare a parsed file with the other run's surface of it */
+static int diff_collect(BulkFile *f, const DOCUNATION *doc, OutBuf *ob) {
+    SurfaceEntry *old = NULL;
+    size_t old_count = 0;
+    if (f->prev && f->prev->surface &&
+        surface_parse(f->prev->surface, f->prev->surface_len, &old, &old_count) != 0) return -1;
+    SurfaceEntry *cur = malloc(((size_t)doc->node_count + 1) * sizeof(SurfaceEntry));
+    if (!cur) {
+        free(old);
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return -1;
+    }
+    for (int i = 0; i < doc->node_count; i++) surface_entry(doc, i, &cur[i]);
+    ob_bind(ob, NULL);
+    int rc = diff_render(ob, f->rel, doc, old, old_count, cur, (size_t)doc->node_count, f->changed);
+    free(old);
+    free(cur);
+    if (rc != 0) return -1;
+    if (ob->len && (ob->failed || !(f->changes = malloc(ob->len)))) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return -1;
+    }
+    if (ob->len) memcpy(f->changes, ob->data, ob->len);
+    f->changes_len = ob->len;
+    return 0;
+}
+
+static int bulk_process_file(BulkContext *ctx, BulkFile *f, OutBuf *ob, ThreadStats *ts) {
+    OutputPaths paths;
+    const ManifestEntry *prev = f->prev;
+    int have_outputs = prev != NULL;
+    if (!ctx->diff) {
+        char safe[MAX_PATH_LEN];
+        sanitize_rel_path(f->rel, safe, sizeof(safe));
+        if (!safe[0]) safe_strcpy(safe, "file", sizeof(safe));
+
+        /* Only .c is dropped, so foo.c and foo.h keep separate outputs */
+        size_t safe_len = strlen(safe);
+        if (safe_len > 2 && ends_with(safe, ".c")) safe[safe_len - 2] = '\0';
+        f->base = strdup(safe);
+        if (!f->base) {
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            return -1;
+        }
+        bulk_output_paths(ctx->out_dir, f->base, &paths);
+
+        /* Same size and mtime as last time: trust the previous outputs. The
+         * corpus, the pack, the search index and the merged symbols are
+         * rebuilt whole, and linked pages depend on every other file, so
+         * those need every source. */
+        if (ctx->corpus_fd >= 0 || ctx->pack_fd >= 0 || ctx->symbols || ctx->opts->search ||
+            ctx->opts->merge || (prev && !prev->surface)) prev = NULL;
+        have_outputs = prev && outputs_exist(ctx->opts->formats, &paths);
+    }
+    /* With --diff, a file the other run recorded unchanged has no changes */
+    if (have_outputs && prev->size == f->size && prev->mtime == f->mtime) {
+        f->hash = prev->hash;
+        f->ok = f->reused = 1;
+        return 0;
+    }
+
+    uint64_t begin = stats_start(ts);
+    uint64_t charged = budget_estimate(f->size);
+    budget_reserve(&ctx->budget, charged);
+    DOCUNATION *doc = load_document(f->path);
+    if (!doc) {
+        budget_release(&ctx->budget, charged, 0);
+        return -1;
+    }
+    doc->defines = &ctx->opts->defines;
+    f->hash = fnv1a64(doc->src, doc->src_len);
+    stats_add(ts, PHASE_LOAD, begin, doc->src_len);
+
+    /* Touched but not changed */
+    if (have_outputs && prev->hash == f->hash && prev->size == doc->src_len) {
+        free_document(doc);
+        budget_release(&ctx->budget, charged, 0);
+        f->ok = f->reused = 1;
+        return 0;
+    }
+
+    const char *cache_dir = ctx->opts->cache_dir;
+    uint64_t start = stats_start(ts);
+    int rc = cache_dir ? parse_cached(cache_dir, doc, f->hash) : parse_loaded(doc);
+    /* The estimate gives way to what the parse really holds */
+    uint64_t footprint = doc_footprint(doc);
+    if (footprint > charged) budget_charge(&ctx->budget, footprint - charged, 0);
+    else budget_release(&ctx->budget, charged - footprint, 0);
+    charged = footprint;
+    if (rc != 0) {
+        free_document(doc);
+        budget_release(&ctx->budget, charged, 0);
+        return -1;
+    }
+    stats_add(ts, PHASE_PARSE, start, doc->src_len);
+    f->nodes = (uint32_t)doc->node_count;
+    f->truncated = doc->truncated;
+
+    start = stats_start(ts);
+    uint64_t wrote = stats_output_ns(ts);
+    rc = ctx->diff ? diff_collect(f, doc, ob) : write_outputs(ctx, f, doc, ob, &paths, ts);
+    stats_add_render(ts, start, wrote);
+    if (ts) f->busy_ns = stats_clock() - begin;
+    free_document(doc);
+    budget_release(&ctx->budget, charged, 0);
+    if (rc != 0) {
+        fprintf(stderr, "Error: Failed documenting %s\n", f->path);
+        return -1;
+    }
+    f->ok = 1;
+    return 0;
+}
+
+/* Add discovered work at the owner's end of a deque */
+static int deque_push(WorkDeque *q, BulkFile *f) {
+    int rc = 0;
+    pthread_mutex_lock(&q->lock);
+    if (q->head == q->tail) q->head = q->tail = 0;
+    if (q->tail == q->cap) {
+        size_t cap = q->cap ? q->cap * 2 : 64;
+        BulkFile **items = realloc(q->items, cap * sizeof(BulkFile *));
+        if (items) {
+            q->items = items;
+            q->cap = cap;
+        } else {
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            rc = -1;
+        }
+    }
+    if (rc == 0) q->items[q->tail++] = f;
+    pthread_mutex_unlock(&q->lock);
+    return rc;
+}
+
+/* Take work from the owner's end of a deque; returns 0 when empty */
+static int deque_pop(WorkDeque *q, BulkFile **item) {
+    int found = 0;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail > q->head) {
+        *item = q->items[--q->tail];
+        found = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+/* Take work from the far end of another worker's deque */
+static int deque_steal(WorkDeque *q, BulkFile **item) {
+    int found = 0;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail > q->head) {
+        *item = q->items[q->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+/* ─── Discovery ──────────────────────────────────────────────────────────── */
+
+enum { ENTRY_OTHER, ENTRY_DIR, ENTRY_FILE, ENTRY_UNKNOWN };
+
+/* What an entry is, from d_type where the filesystem reports it */
+static int entry_kind(const struct dirent *entry) {
+#ifdef DT_UNKNOWN
+    switch (entry->d_type) {
+    case DT_DIR: return ENTRY_DIR;
+    case DT_REG: return ENTRY_FILE;
+    case DT_UNKNOWN:
+    case DT_LNK: return ENTRY_UNKNOWN;   /* links are followed, as stat() would */
+    default: return ENTRY_OTHER;
+    }
+#else
+    (void)entry;
+    return ENTRY_UNKNOWN;
+#endif
+}
+
+/* Note a directory as scanned or reached through a link, so a link back
+ * to it is not followed; returns 0 if it was seen before. ctx->lock must
+ * be held. */
+static int mark_linked_dir(BulkContext *ctx, const struct stat *st) {
+    if (ctx->linked_count * 2 >= ctx->linked_cap) {
+        size_t cap = ctx->linked_cap ? ctx->linked_cap * 2 : 64;
+        DirId *table = calloc(cap, sizeof(DirId));
+        if (!table) return 0;
+        for (size_t i = 0; i < ctx->linked_cap; i++) {
+            DirId *id = &ctx->linked[i];
+            if (!id->used) continue;
+            size_t h = (size_t)(id->ino * 0x9E3779B97F4A7C15ull ^ id->dev) & (cap - 1);
+            while (table[h].used) h = (h + 1) & (cap - 1);
+            table[h] = *id;
+        }
+        free(ctx->linked);
+        ctx->linked = table;
+        ctx->linked_cap = cap;
+    }
+    size_t mask = ctx->linked_cap - 1;
+    size_t h = (size_t)(st->st_ino * 0x9E3779B97F4A7C15ull ^ st->st_dev) & mask;
+    for (; ctx->linked[h].used; h = (h + 1) & mask) {
+        if (ctx->linked[h].dev == st->st_dev && ctx->linked[h].ino == st->st_ino) return 0;
+    }
+    ctx->linked[h].dev = st->st_dev;
+    ctx->linked[h].ino = st->st_ino;
+    ctx->linked[h].used = 1;
+    ctx->linked_count++;
+    return 1;
+}
+
+/* Queue a directory for scanning; ctx->lock must be held */
+static void queue_dir(BulkContext *ctx, char *path, int fd, const IgnoreList *ignore, int shard) {
+    if (ctx->dir_count == ctx->dir_cap) {
+        size_t cap = ctx->dir_cap ? ctx->dir_cap * 2 : 64;
+        DirTask *dirs = realloc(ctx->dirs, cap * sizeof(DirTask));
+        if (!dirs) {
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            if (fd >= 0) close(fd);
+            free(path);
+            return;
+        }
+        ctx->dirs = dirs;
+        ctx->dir_cap = cap;
+    }
+    if (fd >= 0) ctx->held_fds++;
+    ctx->dirs[ctx->dir_count].path = path;
+    ctx->dirs[ctx->dir_count].fd = fd;
+    ctx->dirs[ctx->dir_count].ignore = ignore;
+    ctx->dirs[ctx->dir_count].shard = shard;
+    ctx->dir_count++;
+    if (ctx->shards) ctx->shards[shard < 0 ? 0 : shard].dirs++;
+    pthread_cond_signal(&ctx->wake);
+}
+
+/* ─── Index shards ─────────────────────────────────────────────────────────
+ * Past INDEX_PAGE_ROWS files, index.html only lists the top-level
+ * directories and each has its own pages under INDEX_DIR. A shard counts
+ * the directories of its subtree still to scan and the files found but not
+ * done, so the worker finishing its last file writes its pages at once;
+ * process_directory() then writes only those that went stale.
+ */
+
+static void index_shard_stream(BulkContext *ctx, int shard);
+
+/* A shard for the top-level directory name; ctx->lock must be held. Out of
+ * memory its files stay in shard 0 and every page waits for the end. */
+static int index_shard_new(BulkContext *ctx, const char *name) {
+    if (!ctx->shards) return 0;
+    if (ctx->shard_count == ctx->shard_cap) {
+        size_t cap = ctx->shard_cap * 2;
+        IndexShard *shards = realloc(ctx->shards, cap * sizeof(IndexShard));
+        if (!shards) {
+            ctx->shards_lost = 1;
+            return 0;
+        }
+        ctx->shards = shards;
+        ctx->shard_cap = cap;
+    }
+    IndexShard *s = &ctx->shards[ctx->shard_count];
+    memset(s, 0, sizeof(*s));
+    if (!(s->name = strdup(name))) {
+        ctx->shards_lost = 1;
+        return 0;
+    }
+    return (int)ctx->shard_count++;
+}
+
+/* Is shard complete, with enough files in the tree to be paged? Claims its
+ * pages for the caller; ctx->lock must be held */
+static int index_shard_ready(BulkContext *ctx, int shard) {
+    IndexShard *s = &ctx->shards[shard];
+    if (s->dirs || s->count != s->queued || s->streamed || ctx->shards_lost) return 0;
+    if (ctx->discovered <= INDEX_PAGE_ROWS) return 0;
+    s->streamed = 1;
+    return 1;
+}
+
+/* A scan of task t found found files */
+static void index_scan_done(BulkContext *ctx, const DirTask *t, size_t found) {
+    if (!ctx->shards) return;
+    int shard = t->shard < 0 ? 0 : t->shard;
+    pthread_mutex_lock(&ctx->lock);
+    ctx->shards[shard].dirs--;
+    ctx->shards[shard].queued += found;
+    ctx->discovered += found;
+    int ready = index_shard_ready(ctx, shard);
+    pthread_mutex_unlock(&ctx->lock);
+    if (ready) index_shard_stream(ctx, shard);
+}
+
+static void index_file_done(BulkContext *ctx, BulkFile *f) {
+    if (!ctx->shards) return;
+    pthread_mutex_lock(&ctx->lock);
+    IndexShard *s = &ctx->shards[f->shard];
+    if (s->count == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 64;
+        BulkFile **files = realloc(s->files, cap * sizeof(BulkFile *));
+        if (files) {
+            s->files = files;
+            s->cap = cap;
+        } else {
+            ctx->shards_lost = 1;
+        }
+    }
+    if (s->count < s->cap) s->files[s->count++] = f;
+    int ready = index_shard_ready(ctx, f->shard);
+    pthread_mutex_unlock(&ctx->lock);
+    if (ready) index_shard_stream(ctx, f->shard);
+}
+
+static int bulk_wanted(const BulkOptions *opts, const char *name) {
+    if (opts->ext_count == 0) return ends_with(name, ".c");
+    for (int i = 0; i < opts->ext_count; i++) {
+        if (ends_with(name, opts->exts[i])) return 1;
+    }
+    return 0;
+}
+
+/* Version control metadata never holds anything to document */
+static int is_vcs_dir(const char *name) {
+    return strcmp(name, ".git") == 0 || strcmp(name, ".hg") == 0 || strcmp(name, ".svn") == 0;
+}
+
+/* Read the ignore file of the directory open at dfd, if it has one, and
+ * chain it in front of parent */
+static const IgnoreList *load_ignore(BulkContext *ctx, int dfd, const char *dir_path,
+                                     const IgnoreList *parent) {
+    int fd = openat(dfd, IGNORE_NAME, O_RDONLY);
+    if (fd < 0) return parent;
+    struct stat st;
+    char *text = NULL;
+    ssize_t got = 0;
+    if (fstat(fd, &st) == 0 && (text = malloc((size_t)st.st_size + 1)) != NULL) {
+        while (got < st.st_size) {
+            ssize_t n = read(fd, text + got, (size_t)(st.st_size - got));
+            if (n <= 0) break;
+            got += n;
+        }
+    }
+    close(fd);
+    IgnoreList *list = text ? calloc(1, sizeof(IgnoreList)) : NULL;
+    if (!list) {
+        fprintf(stderr, "Error: Cannot read '%s/%s'\n", dir_path, IGNORE_NAME);
+        free(text);
+        return parent;
+    }
+    text[got] = '\0';
+
+    /* One pattern per line; '#' starts a comment line */
+    for (char *line = text; line && *line; ) {
+        char *nl = strchr(line, '\n');
+        if (nl) *nl = '\0';
+        char *end = line + strlen(line);
+        while (end > line && isspace((unsigned char)end[-1])) *--end = '\0';
+        if (*line && *line != '#') globset_add(&list->globs, line);
+        line = nl ? nl + 1 : NULL;
+    }
+    free(text);
+
+    list->parent = parent;
+    list->base_len = strlen(bulk_rel(ctx, dir_path));
+    pthread_mutex_lock(&ctx->lock);
+    list->next = ctx->ignores;
+    ctx->ignores = list;
+    pthread_mutex_unlock(&ctx->lock);
+    return list;
+}
+
+/* Is the entry at rel left out by --exclude or an ignore file above it? */
+static int bulk_excluded(const BulkContext *ctx, const IgnoreList *ignore,
+                         const char *rel, const char *name, int is_dir) {
+    if (globset_match(&ctx->opts->exclude, rel, name, is_dir)) return 1;
+    for (; ignore; ignore = ignore->parent) {
+        const char *sub = rel + ignore->base_len;
+        if (ignore->base_len) sub++;
+        if (globset_match(&ignore->globs, sub, name, is_dir)) return 1;
+    }
+    return 0;
+}
+
+/* Scan one directory: sources go onto w's deque, subdirectories onto the
+ * shared stack. Excluded subdirectories are never opened. Returns the
+ * number of sources queued. */
+static size_t scan_directory(BulkWorker *w, DirTask *t) {
+    BulkContext *ctx = w->ctx;
+    int fd = t->fd >= 0 ? t->fd : open(t->path, O_RDONLY | O_DIRECTORY);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd >= 0) close(fd);
+        fprintf(stderr, "Error: Cannot open directory '%s'\n", t->path);
+        free(t->path);
+        return 0;
+    }
+    int dfd = dirfd(dir);
+    /* The root and every directory reached directly are scanned; only
+     * links are checked against what has been seen */
+    struct stat dir_st;
+    if (fstat(dfd, &dir_st) == 0) {
+        pthread_mutex_lock(&ctx->lock);
+        mark_linked_dir(ctx, &dir_st);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    const IgnoreList *ignore = load_ignore(ctx, dfd, t->path, t->ignore);
+    const BulkOptions *opts = ctx->opts;
+    size_t found = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        int kind = entry_kind(entry);
+        int wanted = bulk_wanted(opts, name);
+        if (kind == ENTRY_OTHER || (kind == ENTRY_FILE && !wanted)) continue;
+        if (kind == ENTRY_DIR && is_vcs_dir(name)) continue;
+
+        struct stat st;
+        int via_stat = kind != ENTRY_DIR;
+        if (kind != ENTRY_DIR) {
+            if (fstatat(dfd, name, &st, 0) != 0) continue;
+            kind = S_ISDIR(st.st_mode) ? ENTRY_DIR :
+                   S_ISREG(st.st_mode) && wanted ? ENTRY_FILE : ENTRY_OTHER;
+        }
+        if (kind == ENTRY_OTHER || (kind == ENTRY_DIR && is_vcs_dir(name))) continue;
+
+        char path[MAX_PATH_LEN];
+        if ((size_t)snprintf(path, sizeof(path), "%s/%s", t->path, name) >= sizeof(path)) {
+            fprintf(stderr, "Error: Path too long under '%s'\n", t->path);
+            continue;
+        }
+        const char *rel = bulk_rel(ctx, path);
+        if (bulk_excluded(ctx, ignore, rel, name, kind == ENTRY_DIR)) continue;
+        if (kind == ENTRY_FILE && opts->include.count &&
+            !globset_match(&opts->include, rel, name, 0)) continue;
+        if (kind == ENTRY_DIR) {
+            char *sub = strdup(path);
+            if (!sub) continue;
+            pthread_mutex_lock(&ctx->lock);
+            if (via_stat && !mark_linked_dir(ctx, &st)) {
+                pthread_mutex_unlock(&ctx->lock);
+                free(sub);
+                continue;
+            }
+            int sub_fd = -1;
+            if (ctx->held_fds < DISCOVERY_MAX_FDS) {
+                sub_fd = openat(dfd, name, O_RDONLY | O_DIRECTORY);
+            }
+            queue_dir(ctx, sub, sub_fd, ignore, t->shard < 0 ? index_shard_new(ctx, name) : t->shard);
+            pthread_mutex_unlock(&ctx->lock);
+        } else {
+            BulkFile *f = bulk_add_file(w, path, &st);
+            if (!f) continue;
+            f->shard = t->shard < 0 ? 0 : t->shard;
+            if (deque_push(&ctx->deques[w->id], f) != 0) continue;
+            /* Let idle workers steal from a large directory as it is read */
+            if (++found % 64 == 0) {
+                pthread_mutex_lock(&ctx->lock);
+                pthread_cond_broadcast(&ctx->wake);
+                pthread_mutex_unlock(&ctx->lock);
+            }
+        }
+    }
+    closedir(dir);
+    free(t->path);
+    return found;
+}
+
+/* Find a file to document: own deque first, then the others' */
+static int bulk_take(BulkWorker *w, BulkFile **f) {
+    BulkContext *ctx = w->ctx;
+    if (deque_pop(&ctx->deques[w->id], f)) return 1;
+    for (int i = 1; i < ctx->jobs; i++) {
+        if (deque_steal(&ctx->deques[(w->id + i) % ctx->jobs], f)) return 1;
+    }
+    return 0;
+}
+
+static void *bulk_worker(void *arg) {
+    BulkWorker *w = arg;
+    BulkContext *ctx = w->ctx;
+    BulkFile *f;
+    if (ctx->budget.limit) ob_presize(&w->out, budget_buffer(&ctx->budget, ctx->jobs));
+    for (;;) {
+        if (bulk_take(w, &f)) {
+            bulk_process_file(ctx, f, &w->out, w->stats);
+            budget_track(&ctx->budget, &w->out_charged, w->out.cap);
+            index_file_done(ctx, f);
+            continue;
+        }
+        pthread_mutex_lock(&ctx->lock);
+        if (ctx->dir_count > 0) {
+            DirTask t = ctx->dirs[--ctx->dir_count];
+            if (t.fd >= 0) ctx->held_fds--;
+            ctx->scanning++;
+            pthread_mutex_unlock(&ctx->lock);
+            uint64_t start = stats_start(w->stats);
+            size_t found = scan_directory(w, &t);
+            stats_add(w->stats, PHASE_DISCOVER, start, 0);
+            index_scan_done(ctx, &t, found);
+            pthread_mutex_lock(&ctx->lock);
+            ctx->scanning--;
+            pthread_cond_broadcast(&ctx->wake);
+            pthread_mutex_unlock(&ctx->lock);
+            continue;
+        }
+        if (ctx->scanning == 0) {
+            /* Discovery is over; anything queued since bulk_take() is
+             * picked up by one more look before leaving */
+            pthread_mutex_unlock(&ctx->lock);
+            if (bulk_take(w, &f)) {
+                bulk_process_file(ctx, f, &w->out, w->stats);
+                budget_track(&ctx->budget, &w->out_charged, w->out.cap);
+                index_file_done(ctx, f);
+                continue;
+            }
+            break;
+        }
+        pthread_cond_wait(&ctx->wake, &ctx->lock);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    ob_free(&w->out);
+    budget_track(&ctx->budget, &w->out_charged, 0);
+    return NULL;
+}
+
+/* ─── Linking ──────────────────────────────────────────────────────────── */
+
+/* Render f's HTML from its held parse, linked through the complete index */
+static int link_page(BulkContext *ctx, BulkFile *f, OutBuf *ob, ThreadStats *ts) {
+    uint64_t start = stats_start(ts);
+    uint64_t wrote = stats_output_ns(ts);
+    BinHeader h;
+    if (f->parsed_len < sizeof(h)) return -1;
+    memcpy(&h, f->parsed, sizeof(h));
+    DOCUNATION *doc = calloc(1, sizeof(DOCUNATION));
+    if (!doc) return -1;
+    safe_strcpy(doc->filepath, f->path, MAX_LINE);
+    extract_module_name(f->path, doc->module_name, MAX_NAME);
+    stamp_document(doc);
+    doc->src_len = (size_t)h.size;
+    int rc = bin_decode(doc, f->parsed, f->parsed_len, h.hash);
+    if (rc == 0) {
+        OutputPaths paths;
+        bulk_output_paths(ctx->out_dir, f->base, &paths);
+        /* Pages in a pack open as blobs, so only same-page links work */
+        HtmlLinks links = { ctx->symbols, f->base, ctx->pack_fd < 0 };
+        rc = emit_output(ctx, f, doc, ob, 2, paths.path[2], &links, ts);
+    }
+    free_document(doc);
+    stats_add_render(ts, start, wrote);
+    if (ts) f->busy_ns += stats_clock() - start;
+    return rc;
+}
+
+/* Each link thread takes the place, and the stats, of one worker */
+static void *link_worker(void *arg) {
+    BulkWorker *w = arg;
+    BulkContext *ctx = w->ctx;
+    OutBuf ob = { 0 };
+    size_t ob_charged = 0;
+    if (ctx->budget.limit) ob_presize(&ob, budget_buffer(&ctx->budget, ctx->jobs));
+    for (;;) {
+        pthread_mutex_lock(&ctx->lock);
+        size_t i = ctx->link_next++;
+        pthread_mutex_unlock(&ctx->lock);
+        if (i >= ctx->link_count) break;
+        BulkFile *f = ctx->link_files[i];
+        if (!f->parsed_len) continue;
+        /* The decoded page costs about its encoding again */
+        uint64_t charged = sizeof(DOCUNATION) + 2 * (uint64_t)f->parsed_len;
+        int held = f->parsed != NULL;
+        if (held) {
+            budget_reserve(&ctx->budget, charged - f->parsed_len);
+        } else {
+            budget_reserve(&ctx->budget, charged);
+            if (!(f->parsed = malloc(f->parsed_len)) ||
+                pread_full(ctx->held_fd, f->parsed, f->parsed_len, f->parsed_off) != 0) {
+                fprintf(stderr, "Error: Cannot read the --link spool\n");
+                free(f->parsed);
+                f->parsed = NULL;
+            }
+        }
+        if (!f->parsed || link_page(ctx, f, &ob, w->stats) != 0) {
+            fprintf(stderr, "Error: Failed documenting %s\n", f->path);
+            f->ok = 0;
+        }
+        free(f->parsed);
+        f->parsed = NULL;
+        if (held) {
+            budget_release(&ctx->budget, f->parsed_len, 1);
+            budget_release(&ctx->budget, charged - f->parsed_len, 0);
+        } else {
+            budget_release(&ctx->budget, charged, 0);
+        }
+        budget_track(&ctx->budget, &ob_charged, ob.cap);
+    }
+    ob_free(&ob);
+    budget_track(&ctx->budget, &ob_charged, 0);
+    return NULL;
+}
+
+/* The second --link pass, once every file is parsed and the index is
+ * complete: render each held parse as a linked page */
+static void bulk_link(BulkContext *ctx) {
+    size_t total = 0;
+    for (int i = 0; i < ctx->jobs; i++) {
+        BulkWorker *w = &ctx->workers[i];
+        if (w->chunk_count) total += (w->chunk_count - 1) * BULK_CHUNK + w->last_used;
+    }
+    ctx->link_files = malloc((total ? total : 1) * sizeof(BulkFile *));
+    if (!ctx->link_files) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return;
+    }
+    for (int i = 0; i < ctx->jobs; i++) {
+        BulkWorker *w = &ctx->workers[i];
+        for (size_t c = 0; c < w->chunk_count; c++) {
+            size_t used = c + 1 == w->chunk_count ? w->last_used : BULK_CHUNK;
+            for (size_t k = 0; k < used; k++) ctx->link_files[ctx->link_count++] = &w->chunks[c][k];
+        }
+    }
+
+    pthread_t *threads = calloc(ctx->jobs, sizeof(pthread_t));
+    int started = 1;
+    for (int i = 1; threads && i < ctx->jobs; i++) {
+        if (pthread_create(&threads[i], NULL, link_worker, &ctx->workers[i]) != 0) break;
+        started++;
+    }
+    link_worker(&ctx->workers[0]);
+    for (int i = 1; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+    free(ctx->link_files);
+    ctx->link_files = NULL;
+}
+
+/* Discover and document the tree under ctx->root on ctx->jobs workers,
+ * then gather every worker's files into ctx->files */
+static int bulk_run(BulkContext *ctx) {
+    int jobs = ctx->jobs;
+    ctx->deques = calloc(jobs, sizeof(WorkDeque));
+    ctx->workers = calloc(jobs, sizeof(BulkWorker));
+    pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+    char *root = strdup(ctx->root);
+    int writers = ctx->diff ? 0 : (jobs + 1) / 2;
+    int timed = ctx->opts->stats || ctx->opts->stats_json;
+    if (timed) ctx->stats = calloc((size_t)(jobs + writers), sizeof(ThreadStats));
+    int rc = 0;
+    if (!ctx->deques || !ctx->workers || !threads || !root || (timed && !ctx->stats)) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        free(root);
+        rc = -1;
+        goto done;
+    }
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->wake, NULL);
+    for (int i = 0; i < jobs; i++) {
+        pthread_mutex_init(&ctx->deques[i].lock, NULL);
+        ctx->workers[i].ctx = ctx;
+        ctx->workers[i].id = i;
+        ctx->workers[i].stats = ctx->stats ? &ctx->stats[i] : NULL;
+    }
+    budget_init(&ctx->budget, ctx->opts->max_mem);
+    write_queue_start(&ctx->writes, writers, ctx->stats ? ctx->stats + jobs : NULL,
+                      &ctx->budget);
+    ctx->writer_count = ctx->writes.count;
+    /* Pack offsets of linked pages are only known after the HTML pass */
+    if (!ctx->diff && !(ctx->symbols && ctx->opts->pack) &&
+        (ctx->shards = calloc(16, sizeof(IndexShard)))) {
+        ctx->shard_cap = 16;
+        if (!(ctx->shards[0].name = strdup(""))) ctx->shards_lost = 1;
+        ctx->shard_count = 1;
+    }
+    pthread_mutex_lock(&ctx->lock);
+    queue_dir(ctx, root, open(root, O_RDONLY | O_DIRECTORY), NULL, -1);
+    pthread_mutex_unlock(&ctx->lock);
+
+    int started = 1;
+    for (int i = 1; i < jobs; i++) {
+        if (pthread_create(&threads[i], NULL, bulk_worker, &ctx->workers[i]) != 0) {
+            fprintf(stderr, "Warning: cannot start worker %d, continuing with %d\n", i, i);
+            break;
+        }
+        started++;
+    }
+    bulk_worker(&ctx->workers[0]);
+    for (int i = 1; i < started; i++) pthread_join(threads[i], NULL);
+    if (ctx->symbols) bulk_link(ctx);
+    write_queue_stop(&ctx->writes);
+    budget_destroy(&ctx->budget);
+    pthread_mutex_destroy(&ctx->lock);
+    pthread_cond_destroy(&ctx->wake);
+    free(ctx->dirs);
+    ctx->dirs = NULL;
+    while (ctx->ignores) {
+        IgnoreList *next = ctx->ignores->next;
+        globset_free(&ctx->ignores->globs);
+        free(ctx->ignores);
+        ctx->ignores = next;
+    }
+    free(ctx->linked);
+    ctx->linked = NULL;
+    for (size_t i = 0; i < ctx->shard_count; i++) {
+        free(ctx->shards[i].files);
+        ctx->shards[i].files = NULL;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < jobs; i++) {
+        BulkWorker *w = &ctx->workers[i];
+        if (w->chunk_count) total += (w->chunk_count - 1) * BULK_CHUNK + w->last_used;
+    }
+    ctx->files = malloc((total ? total : 1) * sizeof(BulkFile));
+    if (!ctx->files) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        rc = -1;
+    }
+    for (int i = 0; i < jobs; i++) {
+        BulkWorker *w = &ctx->workers[i];
+        for (size_t c = 0; c < w->chunk_count; c++) {
+            size_t used = c + 1 == w->chunk_count ? w->last_used : BULK_CHUNK;
+            for (size_t k = 0; k < used; k++) {
+                if (w->chunks[c][k].write_failed) w->chunks[c][k].ok = 0;
+                free(w->chunks[c][k].parsed);
+                w->chunks[c][k].parsed = NULL;
+                if (ctx->files) {
+                    ctx->files[ctx->count++] = w->chunks[c][k];
+                } else {
+                    free(w->chunks[c][k].path);
+                    free(w->chunks[c][k].base);
+                    free(w->chunks[c][k].names);
+                    free(w->chunks[c][k].decls);
+                    free(w->chunks[c][k].decl_text);
+                    free(w->chunks[c][k].surface);
+                    free(w->chunks[c][k].changes);
+                }
+            }
+            free(w->chunks[c]);
+        }
+        free(w->chunks);
+    }
+
+done:
+    if (ctx->deques) {
+        for (int i = 0; i < jobs; i++) {
+            free(ctx->deques[i].items);
+            if (ctx->workers) pthread_mutex_destroy(&ctx->deques[i].lock);
+        }
+    }
+    free(ctx->deques);
+    ctx->deques = NULL;
+    free(ctx->workers);
+    ctx->workers = NULL;
+    free(threads);
+    return rc;
+}
+
+/* Add a comma-separated list of extensions, with or without the dot */
+static int add_extensions(BulkOptions *opts, const char *list) {
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        const char *ext = list;
+        list += len;
+        if (*list) list++;
+        if (len && *ext == '.') {
+            ext++;
+            len--;
+        }
+        if (!len) continue;
+        char **exts = realloc(opts->exts, (size_t)(opts->ext_count + 1) * sizeof(char *));
+        char *dotted = exts ? malloc(len + 2) : NULL;
+        if (exts) opts->exts = exts;
+        if (!dotted) {
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            return -1;
+        }
+        dotted[0] = '.';
+        memcpy(dotted + 1, ext, len);
+        dotted[len + 1] = '\0';
+        opts->exts[opts->ext_count++] = dotted;
+    }
+    return 0;
+}
+
+/* Parse a comma-separated list of txt, json, html and bin */
+static int parse_formats(const char *list, unsigned *formats) {
+    *formats = 0;
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        if (len == 3 && strncmp(list, "txt", 3) == 0) *formats |= FORMAT_TXT;
+        else if (len == 4 && strncmp(list, "json", 4) == 0) *formats |= FORMAT_JSON;
+        else if (len == 4 && strncmp(list, "html", 4) == 0) *formats |= FORMAT_HTML;
+        else if (len == 3 && strncmp(list, "bin", 3) == 0) *formats |= FORMAT_BIN;
+        else if (len) {
+            fprintf(stderr, "Error: Unknown format '%.*s'\n", (int)len, list);
+            return -1;
+        }
+        list += len;
+        if (*list) list++;
+    }
+    return 0;
+}
+
+/* Parse a byte count with an optional K, M, G or T suffix (powers of 1024) */
+static int parse_size(const char *text, uint64_t *size) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(text, &end, 10);
+    int shift = 0;
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        case 't': case 'T': shift = 40; end++; break;
+    }
+    if (*end == 'B' || *end == 'b') end++;
+    if (!isdigit((unsigned char)*text) || *end || errno || n > (UINT64_MAX >> shift)) {
+        fprintf(stderr, "Error: Bad size '%s'\n", text);
+        return -1;
+    }
+    *size = (uint64_t)n << shift;
+    return 0;
+}
+
+static void bulk_options_free(BulkOptions *opts) {
+    globset_free(&opts->include);
+    globset_free(&opts->exclude);
+    for (int i = 0; i < opts->ext_count; i++) free(opts->exts[i]);
+    free(opts->exts);
+    opts->exts = NULL;
+    opts->ext_count = 0;
+    define_set_free(&opts->defines);
+}
+
+/* Copy the spooled blocks of documented files, sorted, into path */
+static int corpus_assemble(BulkContext *ctx, const char *path) {
+    char tmp_path[MAX_PATH_LEN];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%s.tmp", ctx->out_dir, CORPUS_NAME);
+    OutBuf ob = { 0 };
+    if (ob_open(&ob, tmp_path) != 0) return -1;
+    for (size_t i = 0; i < ctx->count && !ob.failed; i++) {
+        const BulkFile *f = &ctx->files[i];
+        if (!f->ok) continue;
+        off_t off = (off_t)f->corpus_off;
+        size_t left = f->corpus_len;
+        while (left && ob_reserve(&ob, left < OUTBUF_CAP ? left : OUTBUF_CAP) == 0) {
+            size_t want = ob.cap - ob.len < left ? ob.cap - ob.len : left;
+            ssize_t n = pread(ctx->corpus_fd, ob.data + ob.len, want, off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                ob.failed = 1;
+                break;
+            }
+            ob.len += (size_t)n;
+            off += n;
+            left -= (size_t)n;
+        }
+    }
+    int rc = ob_close(&ob, tmp_path);
+    ob_free(&ob);
+    if (rc == 0 && rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error: Cannot write '%s'\n", path);
+        rc = -1;
+    }
+    if (rc != 0) remove(tmp_path);
+    return rc;
+}
+
+/* ─── Pack ─────────────────────────────────────────────────────────────────
+ * With --pack, every rendered output is appended to PACK_NAME as workers
+ * finish it, and PACK_INDEX_NAME lists the entries sorted by name: a
+ * header line, then "offset<TAB>length<TAB>name" per entry, where name is
+ * the path the output would have had, such as html/src__main.html.
+ */
+
+typedef struct {
+    char *name;
+    uint64_t off;
+    size_t len;
+} PackEntry;
+
+static int compare_pack_entries(const void *a, const void *b) {
+    const PackEntry *ea = a;
+    const PackEntry *eb = b;
+    return strcmp(ea->name, eb->name);
+}
+
+/* Write the sorted index for the pack at tmp_path, then publish both */
+static int pack_finish(BulkContext *ctx, const char *tmp_path, const char *pack_path) {
+    unsigned formats = ctx->opts->formats;
+    PackEntry *entries = malloc((ctx->count ? ctx->count : 1) * FORMAT_COUNT * sizeof(PackEntry));
+    if (!entries) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        return -1;
+    }
+    size_t count = 0;
+    int rc = 0;
+    for (size_t i = 0; i < ctx->count && rc == 0; i++) {
+        const BulkFile *f = &ctx->files[i];
+        if (!f->ok || strpbrk(f->base, "\t\n")) continue;
+        for (int k = 0; k < FORMAT_COUNT; k++) {
+            if (!(formats & (1u << k))) continue;
+            size_t size = strlen(f->base) + 2 * strlen(format_exts[k]) + 3;
+            PackEntry *e = &entries[count];
+            e->name = malloc(size);
+            if (!e->name) {
+                fprintf(stderr, "Error: Cannot allocate memory\n");
+                rc = -1;
+                break;
+            }
+            snprintf(e->name, size, "%s/%s.%s", format_exts[k], f->base, format_exts[k]);
+            e->off = f->pack_off[k];
+            e->len = f->pack_len[k];
+            count++;
+        }
+    }
+    qsort(entries, count, sizeof(PackEntry), compare_pack_entries);
+
+    char idx_path[MAX_PATH_LEN];
+    char idx_tmp[MAX_PATH_LEN];
+    snprintf(idx_path, sizeof(idx_path), "%s/%s", ctx->out_dir, PACK_INDEX_NAME);
+    snprintf(idx_tmp, sizeof(idx_tmp), "%s/%s.tmp", ctx->out_dir, PACK_INDEX_NAME);
+    OutBuf ob = { 0 };
+    if (rc == 0 && ob_open(&ob, idx_tmp) != 0) rc = -1;
+    if (rc == 0) {
+        OB_LIT(&ob, "# DOCUNATION pack " DOCUNATION_VERSION "\n");
+        for (size_t i = 0; i < count; i++) {
+            ob_printf(&ob, "%llu\t%zu\t%s\n", (unsigned long long)entries[i].off,
+                      entries[i].len, entries[i].name);
+        }
+        rc = ob_close(&ob, idx_tmp);
+    }
+    ob_free(&ob);
+    for (size_t i = 0; i < count; i++) free(entries[i].name);
+    free(entries);
+
+    if (rc == 0 && (rename(tmp_path, pack_path) != 0 || rename(idx_tmp, idx_path) != 0)) {
+        fprintf(stderr, "Error: Cannot write '%s'\n", pack_path);
+        rc = -1;
+    }
+    if (rc != 0) {
+        remove(tmp_path);
+        remove(idx_tmp);
+    }
+    return rc;
+}
+
+/* Copy entry name of the pack in out_dir to out */
+static int pack_get(const char *out_dir, const char *name, FILE *out) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", out_dir, PACK_INDEX_NAME);
+    size_t len;
+    char *idx = read_file(path, &len);
+    if (!idx) {
+        fprintf(stderr, "Error: Cannot read '%s'\n", path);
+        return -1;
+    }
+    unsigned long long off = 0;
+    unsigned long long size = 0;
+    int found = 0;
+    size_t name_len = strlen(name);
+    for (char *line = idx; line < idx + len && !found; ) {
+        char *nl = memchr(line, '\n', (size_t)(idx + len - line));
+        char *end = nl ? nl : idx + len;
+        char *tab = memchr(line, '\t', (size_t)(end - line));
+        tab = tab ? memchr(tab + 1, '\t', (size_t)(end - tab - 1)) : NULL;
+        if (*line != '#' && tab && (size_t)(end - tab - 1) == name_len &&
+            memcmp(tab + 1, name, name_len) == 0) {
+            found = sscanf(line, "%llu\t%llu", &off, &size) == 2;
+        }
+        line = end + 1;
+    }
+    free(idx);
+    if (!found) {
+        fprintf(stderr, "Error: '%s' is not in the pack\n", name);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", out_dir, PACK_NAME);
+    int fd = open(path, O_RDONLY);
+    char *buf = fd >= 0 ? malloc(STREAM_CHUNK) : NULL;
+    int rc = buf ? 0 : -1;
+    while (rc == 0 && size) {
+        size_t want = size < STREAM_CHUNK ? (size_t)size : STREAM_CHUNK;
+        ssize_t n = pread(fd, buf, want, (off_t)off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0 || fwrite(buf, 1, (size_t)n, out) != (size_t)n) rc = -1;
+        off += (unsigned long long)n;
+        size -= (unsigned long long)n;
+    }
+    if (rc != 0) fprintf(stderr, "Error: Cannot read '%s'\n", path);
+    free(buf);
+    if (fd >= 0) close(fd);
+    return rc;
+}
+
+/* One index cell linking f's output in format bit k; up leads from the
+ * page to the output directory */
+static void index_cell(OutBuf *index, const BulkFile *f, int k, int packed, const char *up) {
+    if (packed) {
+        ob_printf(index, "<td><a href=\"#\" data-off=\"%llu\" data-len=\"%zu\" data-type=\"%s\" "
+                  "onclick=\"return unpack(this)\">%s</a></td>", (unsigned long long)f->pack_off[k],
+                  f->pack_len[k], format_mimes[k], format_labels[k]);
+        return;
+    }
+    ob_printf(index, "<td><a href=\"%s%s/", up, format_exts[k]);
+    ob_html(index, f->base, strlen(f->base));
+    ob_printf(index, ".%s\">%s</a></td>", format_exts[k], format_labels[k]);
+}
+
+static int compare_bulk_files(const void *a, const void *b) {
+    const BulkFile *fa = a;
+    const BulkFile *fb = b;
+    return strcmp(fa->rel, fb->rel);
+}
+
+static int compare_bulk_file_refs(const void *a, const void *b) {
+    return compare_bulk_files(*(const BulkFile *const *)a, *(const BulkFile *const *)b);
+}
+
+/* Columns in the order HTML, Text, JSON, Binary */
+static const int index_columns[] = { 2, 0, 1, 3 };
+
+static void index_table(OutBuf *index, unsigned formats) {
+    OB_LIT(index, "<table border=1 cellspacing=0 cellpadding=4>\n<tr><th>Source</th>");
+    for (int c = 0; c < FORMAT_COUNT; c++) {
+        if (formats & (1u << index_columns[c])) ob_printf(index, "<th>%s</th>", format_labels[index_columns[c]]);
+    }
+    OB_LIT(index, "</tr>\n");
+}
+
+static void index_row(OutBuf *index, const BulkFile *f, const BulkOptions *opts, const char *up) {
+    OB_LIT(index, "<tr><td>");
+    ob_html(index, f->rel, strlen(f->rel));
+    OB_LIT(index, "</td>");
+    for (int c = 0; c < FORMAT_COUNT; c++) {
+        if (opts->formats & (1u << index_columns[c])) index_cell(index, f, index_columns[c], opts->pack, up);
+    }
+    OB_LIT(index, "</tr>\n");
+}
+
+static void index_unpack_script(OutBuf *index, const char *up) {
+    /* Entries are fetched by byte range and shown from a blob; a server
+     * that ignores Range sends the whole pack, which is sliced instead */
+    OB_LIT(index, "<script>\n"
+           "function unpack(a) {\n"
+           "  var off = +a.dataset.off, len = +a.dataset.len;\n"
+           "  var got = !len ? Promise.resolve(new Blob()) :\n"
+           "    fetch('");
+    ob_str(index, up);
+    OB_LIT(index, PACK_NAME "', {headers: {Range: 'bytes=' + off + '-' + (off + len - 1)}})\n"
+           "      .then(function (r) { return r.blob().then(function (b) {\n"
+           "        return r.status == 206 ? b : b.slice(off, off + len); }); });\n"
+           "  got.then(function (b) {\n"
+           "    location.href = URL.createObjectURL(new Blob([b], {type: a.dataset.type + ';charset=utf-8'}));\n"
+           "  });\n"
+           "  return false;\n"
+           "}\n"
+           "</script>\n");
+}
+
+/* File name of page (from 0) of shard name within INDEX_DIR */
+static void index_page_name(char *out, size_t size, const char *name, size_t page) {
+    if (!*name) {
+        snprintf(out, size, "%zu.html", page + 1);
+        return;
+    }
+    char safe[256];      /* a single path component */
+    sanitize_rel_path(name, safe, sizeof(safe));
+    snprintf(out, size, "%zu_%s.html", page + 1, safe);
+}
+
+static size_t index_page_count(size_t rows) {
+    return rows ? (rows + INDEX_PAGE_ROWS - 1) / INDEX_PAGE_ROWS : 0;
+}
+
+/* Write the pages of shard name, listing those of files[] that are ok in
+ * order. Returns how many that is, or -1 when a page cannot be written. */
+static long index_shard_write(const BulkContext *ctx, const char *name, BulkFile *const *files,
+                              size_t count) {
+    const BulkOptions *opts = ctx->opts;
+    size_t rows = 0;
+    for (size_t i = 0; i < count; i++) rows += files[i]->ok != 0;
+    size_t pages = index_page_count(rows);
+    char dir[MAX_PATH_LEN];
+    snprintf(dir, sizeof(dir), "%s/" INDEX_DIR, ctx->out_dir);
+    if (pages && ensure_dir(dir) != 0) return -1;
+
+    OutBuf ob = { 0 };
+    int rc = 0;
+    size_t at = 0;
+    for (size_t page = 0; page < pages && rc == 0; page++) {
+        char file[MAX_PATH_LEN];
+        char path[MAX_PATH_LEN * 2];
+        index_page_name(file, sizeof(file), name, page);
+        snprintf(path, sizeof(path), "%s/%s", dir, file);
+        if (ob_open(&ob, path) != 0) {
+            rc = -1;
+            break;
+        }
+        const char *label = *name ? name : "Top level";
+        OB_LIT(&ob, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>DOCUNATION Index: ");
+        ob_html(&ob, label, strlen(label));
+        OB_LIT(&ob, "</title></head><body>\n<h1>");
+        ob_html(&ob, label, strlen(label));
+        OB_LIT(&ob, "</h1><p><a href=\"../index.html\">All directories</a>");
+        if (pages > 1) {
+            ob_printf(&ob, " &middot; Page %zu of %zu", page + 1, pages);
+            if (page > 0) {
+                index_page_name(file, sizeof(file), name, page - 1);
+                OB_LIT(&ob, " &middot; <a href=\"");
+                ob_html(&ob, file, strlen(file));
+                OB_LIT(&ob, "\">Previous</a>");
+            }
+            if (page + 1 < pages) {
+                index_page_name(file, sizeof(file), name, page + 1);
+                OB_LIT(&ob, " &middot; <a href=\"");
+                ob_html(&ob, file, strlen(file));
+                OB_LIT(&ob, "\">Next</a>");
+            }
+        }
+        OB_LIT(&ob, "</p>\n");
+        if (opts->pack) index_unpack_script(&ob, "../");
+        index_table(&ob, opts->formats);
+        size_t listed = 0;
+        for (; at < count && listed < INDEX_PAGE_ROWS; at++) {
+            if (!files[at]->ok) continue;
+            index_row(&ob, files[at], opts, "../");
+            listed++;
+        }
+        ob_printf(&ob, "</table>\n<p>Files: %zu</p>\n</body></html>\n", listed);
+        if (ob_close(&ob, path) != 0) rc = -1;
+    }
+    ob_free(&ob);
+    return rc == 0 ? (long)rows : -1;
+}
+
+/* Write the pages of a shard that just completed, from the worker that
+ * completed it */
+static void index_shard_stream(BulkContext *ctx, int shard) {
+    pthread_mutex_lock(&ctx->lock);
+    IndexShard s = ctx->shards[shard];
+    pthread_mutex_unlock(&ctx->lock);
+    qsort(s.files, s.count, sizeof(BulkFile *), compare_bulk_file_refs);
+    long rows = index_shard_write(ctx, s.name, s.files, s.count);
+    pthread_mutex_lock(&ctx->lock);
+    if (rows >= 0) ctx->shards[shard].rows = (size_t)rows;
+    else ctx->shards[shard].streamed = 0;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+/* ─── Search index ─────────────────────────────────────────────────────────
+ * With --search, SEARCH_DIR holds a client-side index of every documented
+ * name, fetched in pieces as a query needs them:
+ *   meta.json      counts, type names, and the lowercased first name of
+ *                  each names chunk, for binary search by prefix
+ *   names-K.json   SEARCH_CHUNK entries [name, type, file, line], sorted
+ *                  case-insensitively
+ *   files-K.json   SEARCH_CHUNK entries [source path, output base name]
+ *   tri-XX.bin     postings for substring search: the lowercased trigrams
+ *                  hashing to bucket XX, each as its 3 bytes, a varint
+ *                  count and varint deltas of ascending entry numbers
+ */
+
+typedef struct {
+    const InternString *name;
+    uint32_t rank;           /* of the name in search order */
+    uint32_t file;
+    int32_t line;
+    uint8_t type;
+} SearchEntry;
+
+/* An interned string and its place in the rank table */
+typedef struct {
+    const InternString *name;
+    size_t slot;
+} RankedName;
+
+static int ascii_lower(int c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/* Case-insensitively, then exactly, so that case variants sit together */
+static int compare_ranked_names(const void *a, const void *b) {
+    const InternString *ea = ((const RankedName *)a)->name;
+    const InternString *eb = ((const RankedName *)b)->name;
+    uint32_t n = ea->len < eb->len ? ea->len : eb->len;
+    for (uint32_t i = 0; i < n; i++) {
+        int ca = ascii_lower((unsigned char)ea->str[i]);
+        int cb = ascii_lower((unsigned char)eb->str[i]);
+        if (ca != cb) return ca - cb;
+    }
+    if (ea->len != eb->len) return ea->len < eb->len ? -1 : 1;
+    return memcmp(ea->str, eb->str, n);
+}
+
+static int compare_search_entries(const void *a, const void *b) {
+    const SearchEntry *ea = a;
+    const SearchEntry *eb = b;
+    if (ea->rank != eb->rank) return ea->rank < eb->rank ? -1 : 1;
+    if (ea->file != eb->file) return ea->file < eb->file ? -1 : 1;
+    return (ea->line > eb->line) - (ea->line < eb->line);
+}
+
+/* Rank every interned string once, so that entries, however many share a
+ * name, sort on integers. The rank of id is at
+ * base[INTERN_SHARD(id)] + INTERN_NUMBER(id) - 1. */
+static uint32_t *search_ranks(const Interner *in, size_t base[INTERN_SHARDS]) {
+    size_t total = 0;
+    for (int s = 0; s < INTERN_SHARDS; s++) {
+        base[s] = total;
+        total += in->shards[s].count;
+    }
+    RankedName *names = malloc((total ? total : 1) * sizeof(RankedName));
+    uint32_t *ranks = malloc((total ? total : 1) * sizeof(uint32_t));
+    if (!names || !ranks) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        free(names);
+        free(ranks);
+        return NULL;
+    }
+    for (int s = 0; s < INTERN_SHARDS; s++) {
+        for (size_t i = 0; i < in->shards[s].count; i++) {
+            names[base[s] + i].name = &in->shards[s].strings[i];
+            names[base[s] + i].slot = base[s] + i;
+        }
+    }
+    qsort(names, total, sizeof(RankedName), compare_ranked_names);
+    for (size_t i = 0; i < total; i++) ranks[names[i].slot] = (uint32_t)i;
+    free(names);
+    return ranks;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* The bucket a trigram's postings live in; index.html computes the same */
+static unsigned trigram_bucket(uint32_t key) {
+    return ((uint32_t)(key * 2654435761u) >> 24) & 255;
+}
+
+static void ob_varint(OutBuf *ob, uint64_t v) {
+    char buf[10];
+    size_t n = 0;
+    do {
+        buf[n++] = (char)((v & 127) | (v > 127 ? 128 : 0));
+        v >>= 7;
+    } while (v);
+    ob_write(ob, buf, n);
+}
+
+/* Write one JSON file of the index, built by the caller in ob */
+static int search_save(BulkContext *ctx, OutBuf *ob, const char *fmt, size_t k) {
+    char path[MAX_PATH_LEN];
+    int n = snprintf(path, sizeof(path), "%s/%s/", ctx->out_dir, SEARCH_DIR);
+    snprintf(path + n, sizeof(path) - (size_t)n, fmt, k);
+    FILE *out = fopen(path, "wb");
+    int rc = -1;
+    if (out) {
+        rc = fwrite(ob->data, 1, ob->len, out) == ob->len ? 0 : -1;
+        if (fclose(out) != 0) rc = -1;
+    }
+    if (rc != 0 || ob->failed) {
+        fprintf(stderr, "Error: Cannot write '%s'\n", path);
+        rc = -1;
+    }
+    ob_bind(ob, NULL);
+    return rc;
+}
+
+/* Write SEARCH_DIR from the names of every documented file; ctx->files
+ * must be sorted */
+static int search_write(BulkContext *ctx) {
+    char dir[MAX_PATH_LEN];
+    snprintf(dir, sizeof(dir), "%s/%s", ctx->out_dir, SEARCH_DIR);
+    if (ensure_dir(dir) != 0) return -1;
+
+    size_t total = 0;
+    for (size_t i = 0; i < ctx->count; i++) {
+        if (ctx->files[i].ok) total += ctx->files[i].name_count;
+    }
+    size_t base[INTERN_SHARDS];
+    uint32_t *ranks = search_ranks(ctx->strings, base);
+    if (!ranks) return -1;
+    SearchEntry *entries = malloc((total ? total : 1) * sizeof(SearchEntry));
+    if (!entries) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        free(ranks);
+        return -1;
+    }
+
+    /* Files are numbered in path order, skipping failed ones */
+    OutBuf ob = { 0 };
+    ob_bind(&ob, NULL);
+    int rc = 0;
+    size_t count = 0;
+    uint32_t files = 0;
+    for (size_t i = 0; i < ctx->count; i++) {
+        const BulkFile *f = &ctx->files[i];
+        if (!f->ok) continue;
+        for (uint32_t k = 0; k < f->name_count; k++) {
+            const SearchName *n = &f->names[k];
+            SearchEntry *e = &entries[count++];
+            e->name = intern_get(ctx->strings, n->id);
+            e->rank = ranks[base[INTERN_SHARD(n->id)] + INTERN_NUMBER(n->id) - 1];
+            e->file = files;
+            e->line = n->line;
+            e->type = n->type;
+        }
+        ob_str(&ob, files % SEARCH_CHUNK ? ",\n[\"" : "[\n[\"");
+        ob_json(&ob, f->rel, strlen(f->rel));
+        OB_LIT(&ob, "\",\"");
+        ob_json(&ob, f->base, strlen(f->base));
+        OB_LIT(&ob, "\"]");
+        files++;
+        if (files % SEARCH_CHUNK == 0) {
+            OB_LIT(&ob, "\n]\n");
+            if (search_save(ctx, &ob, "files-%zu.json", files / SEARCH_CHUNK - 1) != 0) rc = -1;
+        }
+    }
+    if (files % SEARCH_CHUNK) {
+        OB_LIT(&ob, "\n]\n");
+        if (search_save(ctx, &ob, "files-%zu.json", files / SEARCH_CHUNK) != 0) rc = -1;
+    }
+    free(ranks);
+    qsort(entries, count, sizeof(SearchEntry), compare_search_entries);
+
+    /* Names chunks, noting where each starts for meta.json */
+    size_t chunks = (count + SEARCH_CHUNK - 1) / SEARCH_CHUNK;
+    for (size_t c = 0; c < chunks && rc == 0; c++) {
+        size_t end = (c + 1) * SEARCH_CHUNK < count ? (c + 1) * SEARCH_CHUNK : count;
+        OB_LIT(&ob, "[\n");
+        for (size_t i = c * SEARCH_CHUNK; i < end; i++) {
+            const SearchEntry *e = &entries[i];
+            OB_LIT(&ob, "[\"");
+            ob_json(&ob, e->name->str, e->name->len);
+            ob_printf(&ob, "\",%d,%u,%d]%s\n", e->type, e->file, e->line, i + 1 < end ? "," : "");
+        }
+        OB_LIT(&ob, "]\n");
+        if (search_save(ctx, &ob, "names-%zu.json", c) != 0) rc = -1;
+    }
+
+    const char *link = (ctx->opts->pack || !ctx->opts->formats) ? "" :
+                       (ctx->opts->formats & FORMAT_HTML) ? "html" :
+                       (ctx->opts->formats & FORMAT_TXT) ? "txt" : "json";
+    ob_printf(&ob, "{\"version\":\"%s\",\"count\":%zu,\"chunk\":%d,\"files\":%u,"
+              "\"file_chunk\":%d,\"link\":\"%s\",\"types\":[", DOCUNATION_VERSION, count,
+              SEARCH_CHUNK, files, SEARCH_CHUNK, link);
+    for (int t = 0; t <= NODE_INCLUDE; t++) {
+        ob_printf(&ob, "%s\"%s\"", t ? "," : "", node_type_names[t]);
+    }
+    OB_LIT(&ob, "],\"first\":[");
+    for (size_t c = 0; c < chunks; c++) {
+        const SearchEntry *e = &entries[c * SEARCH_CHUNK];
+        char lower[MAX_NAME];
+        size_t len = e->name->len < sizeof(lower) ? e->name->len : sizeof(lower);
+        for (size_t i = 0; i < len; i++) lower[i] = (char)ascii_lower((unsigned char)e->name->str[i]);
+        ob_str(&ob, c ? ",\"" : "\"");
+        ob_json(&ob, lower, len);
+        OB_LIT(&ob, "\"");
+    }
+    OB_LIT(&ob, "]}\n");
+    if (rc == 0 && search_save(ctx, &ob, "meta.json", 0) != 0) rc = -1;
+
+    /* Postings: (bucket, trigram, entry) packed so that one sort groups
+     * them for writing; a trigram repeated within a name sorts adjacent */
+    size_t pair_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].name->len >= 3) pair_count += entries[i].name->len - 2;
+    }
+    uint64_t *pairs = rc == 0 ? malloc((pair_count ? pair_count : 1) * sizeof(uint64_t)) : NULL;
+    if (rc == 0 && !pairs) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        rc = -1;
+    }
+    if (pairs) {
+        size_t n = 0;
+        for (size_t i = 0; i < count; i++) {
+            const SearchEntry *e = &entries[i];
+            for (uint32_t k = 0; k + 3 <= e->name->len; k++) {
+                uint32_t key = (uint32_t)ascii_lower((unsigned char)e->name->str[k]) << 16 |
+                               (uint32_t)ascii_lower((unsigned char)e->name->str[k + 1]) << 8 |
+                               (uint32_t)ascii_lower((unsigned char)e->name->str[k + 2]);
+                pairs[n++] = (uint64_t)trigram_bucket(key) << 56 | (uint64_t)key << 32 | i;
+            }
+        }
+        qsort(pairs, n, sizeof(uint64_t), compare_u64);
+        size_t at = 0;
+        for (unsigned b = 0; b < 256 && rc == 0; b++) {
+            while (at < n && pairs[at] >> 56 == b) {
+                uint32_t key = (uint32_t)(pairs[at] >> 32) & 0xFFFFFF;
+                size_t run = at;
+                size_t ids = 0;
+                for (size_t j = at; j < n && (pairs[j] >> 32) == (pairs[at] >> 32); j++) {
+                    if (j == at || pairs[j] != pairs[j - 1]) ids++;
+                    run = j + 1;
+                }
+                char head[3] = { (char)(key >> 16), (char)(key >> 8), (char)key };
+                ob_write(&ob, head, 3);
+                ob_varint(&ob, ids);
+                uint64_t prev = 0;
+                for (size_t j = at; j < run; j++) {
+                    if (j > at && pairs[j] == pairs[j - 1]) continue;
+                    uint64_t id = pairs[j] & 0xFFFFFFFFu;
+                    ob_varint(&ob, id - prev);
+                    prev = id;
+                }
+                at = run;
+            }
+            if (search_save(ctx, &ob, "tri-%02zx.bin", b) != 0) rc = -1;
+        }
+        free(pairs);
+    }
+    ob_free(&ob);
+    free(entries);
+    return rc;
+}
+
+/* Search box script for index.html, in pieces short enough for any C
+ * compiler to accept as literals */
+static const char *const search_script[] = {
+    "var S = { meta: null, names: {}, files: {}, tri: {} };\n"
+    "function sget(url, bin) {\n"
+    "  return fetch(url).then(function (r) {\n"
+    "    if (!r.ok) throw new Error(url + ': ' + r.status);\n"
+    "    return bin ? r.arrayBuffer() : r.json();\n"
+    "  });\n"
+    "}\n"
+    "function smeta() { return S.meta || (S.meta = sget('search/meta.json')); }\n"
+    "function snames(k) { return S.names[k] || (S.names[k] = sget('search/names-' + k + '.json')); }\n"
+    "function sfiles(k) { return S.files[k] || (S.files[k] = sget('search/files-' + k + '.json')); }\n"
+    "function sbucket(key) { return (Math.imul(key, 2654435761 | 0) >>> 24) & 255; }\n"
+    "function stri(b) {\n"
+    "  if (!S.tri[b]) {\n"
+    "    var name = 'search/tri-' + (b < 16 ? '0' : '') + b.toString(16) + '.bin';\n"
+    "    S.tri[b] = sget(name, 1).then(function (buf) {\n"
+    "      var d = new Uint8Array(buf), at = 0, lists = {};\n"
+    "      function varint() {\n"
+    "        var v = 0, shift = 0, c;\n"
+    "        do { c = d[at++]; v += (c & 127) * Math.pow(2, shift); shift += 7; } while (c & 128);\n"
+    "        return v;\n"
+    "      }\n"
+    "      while (at < d.length) {\n"
+    "        var key = d[at] << 16 | d[at + 1] << 8 | d[at + 2];\n"
+    "        at += 3;\n"
+    "        var n = varint(), ids = new Array(n), id = 0;\n"
+    "        for (var i = 0; i < n; i++) ids[i] = id += varint();\n"
+    "        lists[key] = ids;\n"
+    "      }\n"
+    "      return lists;\n"
+    "    });\n"
+    "  }\n"
+    "  return S.tri[b];\n"
+    "}\n"
+    "/* Names starting with q, from the chunk that may hold the first one on */\n"
+    "function sprefix(m, q, limit) {\n"
+    "  var lo = 0, hi = m.first.length, out = [];\n"
+    "  while (lo < hi) {\n"
+    "    var mid = (lo + hi) >> 1;\n"
+    "    if (m.first[mid] < q) lo = mid + 1; else hi = mid;\n"
+    "  }\n"
+    "  function step(k) {\n"
+    "    if (k >= m.first.length) return out;\n"
+    "    return snames(k).then(function (c) {\n"
+    "      for (var i = 0; i < c.length; i++) {\n"
+    "        var n = c[i][0].toLowerCase();\n"
+    "        if (n.lastIndexOf(q, 0) === 0) {\n"
+    "          out.push(k * m.chunk + i);\n"
+    "          if (out.length >= limit) return out;\n"
+    "        } else if (n > q) {\n"
+    "          return out;\n"
+    "        }\n"
+    "      }\n"
+    "      return step(k + 1);\n"
+    "    });\n"
+    "  }\n"
+    "  return step(Math.max(0, lo - 1));\n"
+    "}\n"
+    "/* Names containing q: intersect the postings of its trigrams */\n",
+    "function ssubstring(m, q, limit) {\n"
+    "  var keys = [];\n"
+    "  for (var i = 0; i + 3 <= q.length; i++) {\n"
+    "    keys.push(q.charCodeAt(i) << 16 | q.charCodeAt(i + 1) << 8 | q.charCodeAt(i + 2));\n"
+    "  }\n"
+    "  return Promise.all(keys.map(function (key) {\n"
+    "    return stri(sbucket(key)).then(function (t) { return t[key] || []; });\n"
+    "  })).then(function (lists) {\n"
+    "    lists.sort(function (a, b) { return a.length - b.length; });\n"
+    "    var ids = lists[0];\n"
+    "    for (var j = 1; j < lists.length && ids.length; j++) {\n"
+    "      var other = {};\n"
+    "      lists[j].forEach(function (id) { other[id] = 1; });\n"
+    "      ids = ids.filter(function (id) { return other[id]; });\n"
+    "    }\n"
+    "    return ids.slice(0, limit * 4);\n"
+    "  });\n"
+    "}\n"
+    "function sentry(m, id) {\n"
+    "  return snames(Math.floor(id / m.chunk)).then(function (c) { return c[id % m.chunk]; });\n"
+    "}\n"
+    "function sfile(m, f) {\n"
+    "  return sfiles(Math.floor(f / m.file_chunk)).then(function (c) { return c[f % m.file_chunk]; });\n"
+    "}\n"
+    "function srun(q) {\n"
+    "  var limit = 50;\n"
+    "  q = q.toLowerCase();\n"
+    "  return smeta().then(function (m) {\n"
+    "    return sprefix(m, q, limit).then(function (ids) {\n"
+    "      if (ids.length >= limit || q.length < 3) return ids;\n"
+    "      return ssubstring(m, q, limit).then(function (more) {\n"
+    "        var seen = {};\n"
+    "        ids.forEach(function (id) { seen[id] = 1; });\n"
+    "        return Promise.all(more.map(function (id) { return sentry(m, id); })).then(function (es) {\n"
+    "          for (var i = 0; i < es.length && ids.length < limit; i++) {\n"
+    "            if (!seen[more[i]] && es[i][0].toLowerCase().indexOf(q) >= 0) ids.push(more[i]);\n"
+    "          }\n"
+    "          return ids;\n"
+    "        });\n"
+    "      });\n"
+    "    }).then(function (ids) {\n"
+    "      return Promise.all(ids.map(function (id) {\n"
+    "        return sentry(m, id).then(function (e) {\n"
+    "          return sfile(m, e[2]).then(function (f) { return [e, f]; });\n"
+    "        });\n"
+    "      }));\n"
+    "    }).then(function (hits) { sshow(m, hits); });\n"
+    "  });\n"
+    "}\n"
+    "function sshow(m, hits) {\n"
+    "  var ul = document.getElementById('hits');\n"
+    "  ul.innerHTML = '';\n"
+    "  hits.forEach(function (h) {\n"
+    "    var e = h[0], f = h[1], li = document.createElement('li'), a = document.createElement('a');\n"
+    "    a.textContent = e[0];\n"
+    "    if (m.link) a.href = m.link + '/' + f[1] + '.' + m.link + '#' + e[0];\n"
+    "    li.appendChild(a);\n"
+    "    li.appendChild(document.createTextNode(' (' + m.types[e[1]] + ') ' + f[0] + ':' + e[3]));\n"
+    "    ul.appendChild(li);\n"
+    "  });\n"
+    "}\n"
+    "var stimer;\n"
+    "function squery(q) {\n"
+    "  clearTimeout(stimer);\n"
+    "  stimer = setTimeout(function () {\n"
+    "    if (q) srun(q); else document.getElementById('hits').innerHTML = '';\n"
+    "  }, 100);\n"
+    "}\n"
+};
+
+/* ─── Run statistics ─────────────────────────────────────────────────────
+ * --stats prints, and --stats-json writes, where a run spent its time:
+ * each phase summed over threads and per thread, the files by time taken
+ * and by size, nodes per file and how many files hit truncation limits.
+ * Reused files took no work, so they count only towards the totals.
+ * ──────────────────────────────────────────────────────────────────────── */
+
+typedef struct {
+    ThreadStats total;
+    size_t files;
+    size_t documented;
+    size_t reused;
+    size_t truncated;
+    uint64_t bytes;
+    size_t parsed;           /* files whose nodes were counted */
+    uint32_t nodes_min;
+    uint32_t nodes_median;
+    uint32_t nodes_max;
+    double nodes_mean;
+    const BulkFile **slowest;
+    const BulkFile **largest;
+    size_t top;              /* entries in each list */
+    double wall;             /* seconds for the whole run */
+    double run;              /* of which discovering and documenting */
+} RunSummary;
+
+static int compare_busy(const void *a, const void *b) {
+    const BulkFile *fa = *(const BulkFile *const *)a;
+    const BulkFile *fb = *(const BulkFile *const *)b;
+    if (fa->busy_ns != fb->busy_ns) return fa->busy_ns > fb->busy_ns ? -1 : 1;
+    return strcmp(fa->rel, fb->rel);
+}
+
+static int compare_size(const void *a, const void *b) {
+    const BulkFile *fa = *(const BulkFile *const *)a;
+    const BulkFile *fb = *(const BulkFile *const *)b;
+    if (fa->size != fb->size) return fa->size > fb->size ? -1 : 1;
+    return strcmp(fa->rel, fb->rel);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int summarize_run(const BulkContext *ctx, RunSummary *r) {
+    for (int t = 0; t < ctx->jobs + ctx->writer_count; t++) {
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            r->total.ns[p] += ctx->stats[t].ns[p];
+            r->total.items[p] += ctx->stats[t].items[p];
+            r->total.bytes[p] += ctx->stats[t].bytes[p];
+        }
+    }
+    size_t n = ctx->count;
+    const BulkFile **worked = malloc((n ? n : 1) * sizeof(BulkFile *));
+    uint32_t *nodes = malloc((n ? n : 1) * sizeof(uint32_t));
+    r->slowest = malloc(STATS_TOP * sizeof(BulkFile *));
+    r->largest = malloc(STATS_TOP * sizeof(BulkFile *));
+    if (!worked || !nodes || !r->slowest || !r->largest) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        free(worked);
+        free(nodes);
+        return -1;
+    }
+    uint64_t node_sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        const BulkFile *f = &ctx->files[i];
+        r->files++;
+        r->bytes += f->size;
+        r->documented += f->ok != 0;
+        r->reused += f->reused != 0;
+        r->truncated += f->truncated > 0;
+        if (f->reused) continue;
+        worked[r->parsed] = f;
+        nodes[r->parsed++] = f->nodes;
+        node_sum += f->nodes;
+    }
+    if (r->parsed) {
+        qsort(nodes, r->parsed, sizeof(uint32_t), compare_u32);
+        r->nodes_min = nodes[0];
+        r->nodes_median = nodes[r->parsed / 2];
+        r->nodes_max = nodes[r->parsed - 1];
+        r->nodes_mean = (double)node_sum / (double)r->parsed;
+    }
+    r->top = r->parsed < STATS_TOP ? r->parsed : STATS_TOP;
+    qsort(worked, r->parsed, sizeof(BulkFile *), compare_busy);
+    memcpy(r->slowest, worked, r->top * sizeof(BulkFile *));
+    qsort(worked, r->parsed, sizeof(BulkFile *), compare_size);
+    memcpy(r->largest, worked, r->top * sizeof(BulkFile *));
+    free(worked);
+    free(nodes);
+    return 0;
+}
+
+/* Label of stats slot t: workers come first, then writers */
+static void stats_thread_name(const BulkContext *ctx, int t, char *name, size_t size) {
+    if (t < ctx->jobs) snprintf(name, size, "worker %d", t);
+    else snprintf(name, size, "writer %d", t - ctx->jobs);
+}
+
+static void stats_text(const BulkContext *ctx, const RunSummary *r, OutBuf *ob) {
+    ob_printf(ob, "Bulk run: %zu files, %.1f MB: %zu documented (%zu reused), %zu failed\n",
+              r->files, (double)r->bytes / 1e6, r->documented, r->reused,
+              r->files - r->documented);
+    ob_printf(ob, "Wall %.3f s: %.3f s discovering and documenting, %.3f s finishing\n\n",
+              r->wall, r->run, r->wall - r->run);
+    ob_printf(ob, "%-10s %10s %10s %10s   (summed over threads)\n", "phase", "seconds", "items", "MB");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        ob_printf(ob, "%-10s %10.3f %10llu", phase_names[p], (double)r->total.ns[p] / 1e9,
+                  (unsigned long long)r->total.items[p]);
+        if (r->total.bytes[p]) ob_printf(ob, " %10.1f\n", (double)r->total.bytes[p] / 1e6);
+        else ob_printf(ob, " %10s\n", "-");
+    }
+    ob_printf(ob, "\n%-10s", "seconds");
+    for (int p = 0; p < PHASE_COUNT; p++) ob_printf(ob, " %9s", phase_names[p]);
+    OB_LIT(ob, "\n");
+    for (int t = 0; t < ctx->jobs + ctx->writer_count; t++) {
+        char name[32];
+        stats_thread_name(ctx, t, name, sizeof(name));
+        ob_printf(ob, "%-10s", name);
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            ob_printf(ob, " %9.3f", (double)ctx->stats[t].ns[p] / 1e9);
+        }
+        OB_LIT(ob, "\n");
+    }
+    if (r->parsed) {
+        ob_printf(ob, "\nNodes per file: min %u, median %u, mean %.1f, max %u (%zu files)\n",
+                  r->nodes_min, r->nodes_median, r->nodes_mean, r->nodes_max, r->parsed);
+    }
+    ob_printf(ob, "Files hitting truncation limits: %zu\n", r->truncated);
+    const MemBudget *b = &ctx->budget;
+    if (b->limit) {
+        ob_printf(ob, "Memory budget: peak %.1f of %.1f MB, %llu waits (%.3f s)\n",
+                  (double)b->peak / 1e6, (double)b->limit / 1e6,
+                  (unsigned long long)b->waits, (double)b->wait_ns / 1e9);
+    }
+    if (!r->top) return;
+    OB_LIT(ob, "\nSlowest files:\n");
+    for (size_t i = 0; i < r->top; i++) {
+        ob_printf(ob, "  %10.3f ms  %s (%u nodes)\n", (double)r->slowest[i]->busy_ns / 1e6,
+                  r->slowest[i]->rel, r->slowest[i]->nodes);
+    }
+    OB_LIT(ob, "\nLargest files:\n");
+    for (size_t i = 0; i < r->top; i++) {
+        ob_printf(ob, "  %10.3f MB  %s (%u nodes)\n", (double)r->largest[i]->size / 1e6,
+                  r->largest[i]->rel, r->largest[i]->nodes);
+    }
+}
+
+/* One phase of ts as a JSON object member */
+static void stats_json_phase(OutBuf *ob, const ThreadStats *ts, int p) {
+    ob_printf(ob, "\"%s\": {\"seconds\": %.6f, \"items\": %llu, \"bytes\": %llu}",
+              phase_names[p], (double)ts->ns[p] / 1e9, (unsigned long long)ts->items[p],
+              (unsigned long long)ts->bytes[p]);
+}
+
+static void stats_json_files(OutBuf *ob, const char *key, const BulkFile **list, size_t count) {
+    ob_printf(ob, "  \"%s\": [", key);
+    for (size_t i = 0; i < count; i++) {
+        const BulkFile *f = list[i];
+        ob_str(ob, i ? ",\n    {\"path\": \"" : "\n    {\"path\": \"");
+        ob_json(ob, f->rel, strlen(f->rel));
+        ob_printf(ob, "\", \"seconds\": %.6f, \"bytes\": %llu, \"nodes\": %u, \"truncated\": %d}",
+                  (double)f->busy_ns / 1e9, (unsigned long long)f->size, f->nodes, f->truncated);
+    }
+    ob_str(ob, count ? "\n  ]" : "]");
+}
+
+static void stats_json(const BulkContext *ctx, const RunSummary *r, OutBuf *ob) {
+    ob_printf(ob, "{\n  \"version\": \"%s\",\n  \"jobs\": %d,\n  \"writers\": %d,\n",
+              DOCUNATION_VERSION, ctx->jobs, ctx->writer_count);
+    ob_printf(ob, "  \"wall_seconds\": %.6f,\n  \"run_seconds\": %.6f,\n", r->wall, r->run);
+    ob_printf(ob, "  \"files\": %zu,\n  \"bytes\": %llu,\n  \"documented\": %zu,\n"
+              "  \"reused\": %zu,\n  \"failed\": %zu,\n  \"truncated_files\": %zu,\n",
+              r->files, (unsigned long long)r->bytes, r->documented, r->reused,
+              r->files - r->documented, r->truncated);
+    ob_printf(ob, "  \"nodes_per_file\": {\"files\": %zu, \"min\": %u, \"median\": %u, "
+              "\"mean\": %.3f, \"max\": %u},\n", r->parsed, r->nodes_min, r->nodes_median,
+              r->nodes_mean, r->nodes_max);
+    const MemBudget *b = &ctx->budget;
+    if (b->limit) {
+        ob_printf(ob, "  \"memory_budget\": {\"limit\": %llu, \"peak\": %llu, \"waits\": %llu, "
+                  "\"wait_seconds\": %.6f},\n", (unsigned long long)b->limit,
+                  (unsigned long long)b->peak, (unsigned long long)b->waits,
+                  (double)b->wait_ns / 1e9);
+    }
+    OB_LIT(ob, "  \"phases\": {");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        ob_str(ob, p ? ",\n    " : "\n    ");
+        stats_json_phase(ob, &r->total, p);
+    }
+    OB_LIT(ob, "\n  },\n  \"threads\": [");
+    for (int t = 0; t < ctx->jobs + ctx->writer_count; t++) {
+        ob_printf(ob, "%s\n    {\"role\": \"%s\", \"id\": %d", t ? "," : "",
+                  t < ctx->jobs ? "worker" : "writer", t < ctx->jobs ? t : t - ctx->jobs);
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            OB_LIT(ob, ", ");
+            stats_json_phase(ob, &ctx->stats[t], p);
+        }
+        OB_LIT(ob, "}");
+    }
+    OB_LIT(ob, "\n  ],\n");
+    stats_json_files(ob, "slowest", r->slowest, r->top);
+    OB_LIT(ob, ",\n");
+    stats_json_files(ob, "largest", r->largest, r->top);
+    OB_LIT(ob, "\n}\n");
+}
+
+/* Print and write the report asked for; ctx->files must be sorted */
+static int stats_report(const BulkContext *ctx, double wall, double run) {
+    if (!ctx->stats) return 0;
+    RunSummary r = { 0 };
+    r.wall = wall;
+    r.run = run;
+    int rc = summarize_run(ctx, &r);
+    OutBuf ob = { 0 };
+    if (rc == 0 && ctx->opts->stats) {
+        ob_bind(&ob, stdout);
+        stats_text(ctx, &r, &ob);
+        if (ob_finish(&ob) != 0) rc = -1;
+    }
+    if (rc == 0 && ctx->opts->stats_json) {
+        if (ob_open(&ob, ctx->opts->stats_json) != 0) rc = -1;
+        else {
+            stats_json(ctx, &r, &ob);
+            if (ob_close(&ob, ctx->opts->stats_json) != 0) rc = -1;
+        }
+    }
+    ob_free(&ob);
+    free(r.slowest);
+    free(r.largest);
+    return rc;
+}
+
+static int compare_index_shards(const void *a, const void *b) {
+    const IndexShard *sa = a;
+    const IndexShard *sb = b;
+    return strcmp(sa->name ? sa->name : "", sb->name ? sb->name : "");
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Remove the pages in INDEX_DIR left from earlier runs: all but the sorted
+ * keep[], and the directory itself once it is empty */
+static void index_prune(const char *out_dir, char **keep, size_t keep_count) {
+    char dir[MAX_PATH_LEN];
+    snprintf(dir, sizeof(dir), "%s/" INDEX_DIR, out_dir);
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        char *name = entry->d_name;
+        if (!ends_with(name, ".html") || bsearch(&name, keep, keep_count, sizeof(char *), compare_names)) {
+            continue;
+        }
+        char path[MAX_PATH_LEN * 2];
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        unlink(path);
+    }
+    closedir(d);
+    if (!keep_count) rmdir(dir);
+}
+
+/* Write the pages of each top-level directory that were not streamed, or
+ * have lost files since, and list the directories in index. rows holds the
+ * ok files in sorted order, the top of them at the root. */
+static int index_shards(OutBuf *index, BulkContext *ctx, BulkFile **rows, size_t row_count,
+                        size_t top) {
+    if (ctx->shards) qsort(ctx->shards, ctx->shard_count, sizeof(IndexShard), compare_index_shards);
+    char **keep = NULL;
+    size_t keep_count = 0;
+    size_t keep_cap = 0;
+    int rc = 0;
+    OB_LIT(index, "<table border=1 cellspacing=0 cellpadding=4>\n"
+           "<tr><th>Directory</th><th>Files</th><th>Pages</th></tr>\n");
+    char name[MAX_PATH_LEN];
+    for (size_t at = 0; at < row_count; ) {
+        size_t len = at < top ? 0 : strcspn(rows[at]->rel, "/");
+        if (len >= sizeof(name)) len = sizeof(name) - 1;
+        memcpy(name, rows[at]->rel, len);
+        name[len] = '\0';
+        size_t end = at + 1;
+        if (at < top) end = top;
+        else while (end < row_count && strncmp(rows[end]->rel, name, len) == 0 && rows[end]->rel[len] == '/') end++;
+        size_t n = end - at;
+
+        IndexShard key = { 0 };
+        key.name = name;
+        const IndexShard *s = ctx->shards && !ctx->shards_lost ?
+            bsearch(&key, ctx->shards, ctx->shard_count, sizeof(IndexShard), compare_index_shards) : NULL;
+        if (!(s && s->streamed && s->rows == n) && index_shard_write(ctx, name, rows + at, n) < 0) rc = -1;
+
+        size_t pages = index_page_count(n);
+        if (keep_count + pages > keep_cap) {
+            size_t cap = keep_cap * 2 > keep_count + pages ? keep_cap * 2 : keep_count + pages + 64;
+            char **grown = realloc(keep, cap * sizeof(char *));
+            if (!grown) {
+                fprintf(stderr, "Error: Cannot allocate memory\n");
+                rc = -1;
+                break;
+            }
+            keep = grown;
+            keep_cap = cap;
+        }
+        char file[MAX_PATH_LEN];
+        for (size_t page = 0; page < pages; page++) {
+            index_page_name(file, sizeof(file), name, page);
+            if (!(keep[keep_count] = strdup(file))) {
+                rc = -1;
+                break;
+            }
+            keep_count++;
+        }
+        index_page_name(file, sizeof(file), name, 0);
+        OB_LIT(index, "<tr><td><a href=\"" INDEX_DIR "/");
+        ob_html(index, file, strlen(file));
+        OB_LIT(index, "\">");
+        if (*name) {
+            ob_html(index, name, len);
+            OB_LIT(index, "/");
+        } else {
+            OB_LIT(index, "Top level");
+        }
+        ob_printf(index, "</a></td><td>%zu</td><td>", n);
+        for (size_t page = 0; page < pages; page++) {
+            index_page_name(file, sizeof(file), name, page);
+            if (page) OB_LIT(index, " ");
+            OB_LIT(index, "<a href=\"" INDEX_DIR "/");
+            ob_html(index, file, strlen(file));
+            ob_printf(index, "\">%zu</a>", page + 1);
+        }
+        OB_LIT(index, "</td></tr>\n");
+        at = end;
+    }
+    if (rc == 0) {
+        qsort(keep, keep_count, sizeof(char *), compare_names);
+        index_prune(ctx->out_dir, keep, keep_count);
+    }
+    for (size_t i = 0; i < keep_count; i++) free(keep[i]);
+    free(keep);
+    return rc;
+}
+
+/* The top-level index.html of a run, and its pages under INDEX_DIR when
+ * there are too many files for one; ctx->files must be sorted */
+static int index_render(OutBuf *index, BulkContext *ctx) {
+    const BulkOptions *opts = ctx->opts;
+    OB_LIT(index, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>DOCUNATION Index</title></head><body>\n");
+    OB_LIT(index, "<h1>DOCUNATION Output</h1><p>Root: ");
+    ob_html(index, ctx->root, ctx->root_len);
+    OB_LIT(index, "</p>\n");
+    if (opts->single_json) OB_LIT(index, "<p>All sources: <a href=\"" CORPUS_NAME "\">" CORPUS_NAME "</a></p>\n");
+    if (opts->merge) OB_LIT(index, "<p>All functions: <a href=\"" MERGE_NAME "\">" MERGE_NAME "</a></p>\n");
+    if (opts->pack) index_unpack_script(index, "");
+    if (opts->search) {
+        OB_LIT(index, "<p><input id=\"q\" placeholder=\"Search symbols\" size=40 "
+               "oninput=\"squery(this.value)\"></p>\n<ul id=\"hits\"></ul>\n<script>\n");
+        for (size_t k = 0; k < sizeof(search_script) / sizeof(*search_script); k++) {
+            ob_str(index, search_script[k]);
+        }
+        OB_LIT(index, "</script>\n");
+    }
+    size_t file_count = 0;
+    for (size_t i = 0; i < ctx->count; i++) file_count += ctx->files[i].ok != 0;
+    int rc = 0;
+    if (file_count <= INDEX_PAGE_ROWS) {
+        index_table(index, opts->formats);
+        for (size_t i = 0; i < ctx->count; i++) {
+            if (ctx->files[i].ok) index_row(index, &ctx->files[i], opts, "");
+        }
+        index_prune(ctx->out_dir, NULL, 0);
+    } else {
+        BulkFile **rows = malloc(file_count * sizeof(BulkFile *));
+        if (!rows) {
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            return -1;
+        }
+        /* Files at the root first; each directory's then form one run */
+        size_t n = 0;
+        for (size_t i = 0; i < ctx->count; i++) {
+            if (ctx->files[i].ok && !strchr(ctx->files[i].rel, '/')) rows[n++] = &ctx->files[i];
+        }
+        size_t top = n;
+        for (size_t i = 0; i < ctx->count; i++) {
+            if (ctx->files[i].ok && strchr(ctx->files[i].rel, '/')) rows[n++] = &ctx->files[i];
+        }
+        rc = index_shards(index, ctx, rows, n, top);
+        free(rows);
+    }
+    ob_printf(index, "</table>\n<p>Total files: %zu</p>\n</body></html>\n", file_count);
+    return rc;
+}
+
+/* Free what the shards of a run still hold */
+static void index_shards_free(BulkContext *ctx) {
+    for (size_t i = 0; i < ctx->shard_count; i++) {
+        free(ctx->shards[i].name);
+        free(ctx->shards[i].files);
+    }
+    free(ctx->shards);
+    ctx->shards = NULL;
+    ctx->shard_count = 0;
+}
+
+static int process_directory(const char *root, const char *out_dir, const BulkOptions *opts) {
+    uint64_t started = stats_clock();
+    struct stat st;
+    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Error: '%s' is not a directory\n", root);
+        return -1;
+    }
+
+    if (ensure_dir(out_dir) != 0) return -1;
+
+    unsigned formats = opts->formats;
+    unsigned dirs = opts->pack ? 0 : formats;
+    for (int k = 0; k < FORMAT_COUNT; k++) {
+        char dir[MAX_PATH_LEN];
+        snprintf(dir, sizeof(dir), "%s/%s", out_dir, format_exts[k]);
+        if ((dirs & (1u << k)) && ensure_dir(dir) != 0) return -1;
+    }
+    if (opts->cache_dir && ensure_dir(opts->cache_dir) != 0) return -1;
+
+    /* Blocks land in the spool as they finish and are copied out in path
+     * order at the end; unlinked at once, it cannot be left behind */
+    char corpus_path[MAX_PATH_LEN];
+    snprintf(corpus_path, sizeof(corpus_path), "%s/%s", out_dir, CORPUS_NAME);
+    int corpus_fd = -1;
+    if (opts->single_json) {
+        char spool_path[MAX_PATH_LEN];
+        snprintf(spool_path, sizeof(spool_path), "%s/.%s.spool", out_dir, CORPUS_NAME);
+        corpus_fd = open(spool_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (corpus_fd < 0) {
+            fprintf(stderr, "Error: Cannot write '%s'\n", spool_path);
+            return -1;
+        }
+        unlink(spool_path);
+    }
+
+    /* With a budget, --link parses beyond half of it wait in a spool */
+    int held_fd = -1;
+    if (opts->max_mem && opts->link && (formats & FORMAT_HTML)) {
+        char spool_path[MAX_PATH_LEN];
+        snprintf(spool_path, sizeof(spool_path), "%s/.docunation-link.spool", out_dir);
+        held_fd = open(spool_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (held_fd < 0) {
+            fprintf(stderr, "Error: Cannot write '%s'\n", spool_path);
+            if (corpus_fd >= 0) close(corpus_fd);
+            return -1;
+        }
+        unlink(spool_path);
+    }
+
+    /* The pack replaces the previous one only once it is complete */
+    char pack_path[MAX_PATH_LEN];
+    char pack_tmp[MAX_PATH_LEN];
+    snprintf(pack_path, sizeof(pack_path), "%s/%s", out_dir, PACK_NAME);
+    snprintf(pack_tmp, sizeof(pack_tmp), "%s/%s.tmp", out_dir, PACK_NAME);
+    int pack_fd = -1;
+    if (opts->pack) {
+        pack_fd = open(pack_tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (pack_fd < 0) {
+            fprintf(stderr, "Error: Cannot write '%s'\n", pack_tmp);
+            if (corpus_fd >= 0) close(corpus_fd);
+            if (held_fd >= 0) close(held_fd);
+            return -1;
+        }
+    }
+
+    char index_path[MAX_PATH_LEN];
+    snprintf(index_path, sizeof(index_path), "%s/index.html", out_dir);
+    OutBuf index = { 0 };
+    if (ob_open(&index, index_path) != 0) {
+        if (corpus_fd >= 0) close(corpus_fd);
+        if (held_fd >= 0) close(held_fd);
+        if (pack_fd >= 0) {
+            close(pack_fd);
+            remove(pack_tmp);
+        }
+        return -1;
+    }
+
+    BulkContext ctx = { 0 };
+    ctx.root = root;
+    ctx.root_len = strlen(root);
+    ctx.out_dir = out_dir;
+    ctx.opts = opts;
+    ctx.jobs = opts->jobs > 0 ? opts->jobs : 1;
+    ctx.corpus_fd = corpus_fd;
+    ctx.pack_fd = pack_fd;
+    ctx.held_fd = held_fd;
+    int rc = 0;
+    int link = opts->link && (formats & FORMAT_HTML);
+    if ((link || opts->search) && !(ctx.strings = interner_new())) rc = -1;
+    else if (link && !(ctx.symbols = symbols_new(ctx.strings))) rc = -1;
+    if (rc != 0) fprintf(stderr, "Error: Cannot allocate memory\n");
+    if (opts->incremental && manifest_load(&ctx) != 0) rc = -1;
+    if (bulk_run(&ctx) != 0) rc = -1;
+    if (held_fd >= 0) close(held_fd);
+    uint64_t ran = stats_clock();
+    symbols_free(ctx.symbols);
+    if (opts->incremental) manifest_prune(&ctx);
+
+    /* Reused files carry their surface over from the manifest's */
+    qsort(ctx.files, ctx.count, sizeof(BulkFile), compare_bulk_files);
+    if (manifest_save(&ctx) != 0) rc = -1;
+    manifest_free(&ctx);
+    if (corpus_fd >= 0) {
+        if (corpus_assemble(&ctx, corpus_path) != 0) rc = -1;
+        close(corpus_fd);
+    }
+    if (pack_fd >= 0) {
+        if (close(pack_fd) != 0) {
+            fprintf(stderr, "Error: Cannot write '%s'\n", pack_tmp);
+            rc = -1;
+            remove(pack_tmp);
+        } else if (pack_finish(&ctx, pack_tmp, pack_path) != 0) {
+            rc = -1;
+        }
+    }
+    if (opts->search && ctx.strings && search_write(&ctx) != 0) rc = -1;
+    if (opts->merge && merge_write(&ctx) != 0) rc = -1;
+    interner_free(ctx.strings);
+    if (index_render(&index, &ctx) != 0) rc = -1;
+    if (ob_close(&index, index_path) != 0) rc = -1;
+    ob_free(&index);
+    index_shards_free(&ctx);
+
+    uint64_t now = stats_clock();
+    if (stats_report(&ctx, (double)(now - started) / 1e9, (double)(ran - started) / 1e9) != 0) rc = -1;
+    free(ctx.stats);
+    for (size_t i = 0; i < ctx.count; i++) {
+        free(ctx.files[i].path);
+        free(ctx.files[i].base);
+        free(ctx.files[i].names);
+        free(ctx.files[i].decls);
+        free(ctx.files[i].decl_text);
+        free(ctx.files[i].surface);
+    }
+    free(ctx.files);
+    return rc;
+}
+
+/* ─── Diff mode ──────────────────────────────────────────────────────────
+ * --diff OLD documents nothing. OLD is the output directory of an earlier
+ * run, or its manifest or pack; the tree is compared with the manifest and
+ * surface there, and the symbols added, removed or modified since are
+ * printed as one JSON document, in path and then line order.
+ * ──────────────────────────────────────────────────────────────────────── */
+
+/* Records for every symbol of a source the other run had and this one
+ * does not */
+static int diff_removed(OutBuf *ob, const ManifestEntry *e, uint32_t counts[3]) {
+    SurfaceEntry *old;
+    size_t old_count;
+    if (surface_parse(e->surface, e->surface_len, &old, &old_count) != 0) return -1;
+    int rc = diff_render(ob, e->rel, NULL, old, old_count, NULL, 0, counts);
+    free(old);
+    return rc;
+}
+
+/* Append a file's records, dropping the comma before the first of all */
+static void diff_append(OutBuf *ob, const char *records, size_t len, int *first) {
+    if (!len) return;
+    if (*first) {
+        records++;
+        len--;
+        *first = 0;
+    }
+    ob_write(ob, records, len);
+}
+
+static int diff_directory(const char *root, const char *old, const BulkOptions *opts) {
+    struct stat st;
+    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Error: '%s' is not a directory\n", root);
+        return -1;
+    }
+    char old_dir[MAX_PATH_LEN];
+    safe_strcpy(old_dir, old, sizeof(old_dir));
+    if (stat(old_dir, &st) == 0 && !S_ISDIR(st.st_mode)) {
+        char *slash = strrchr(old_dir, '/');
+        if (!slash) safe_strcpy(old_dir, ".", sizeof(old_dir));
+        else *(slash == old_dir ? slash + 1 : slash) = '\0';
+    }
+
+    BulkContext ctx = { 0 };
+    ctx.root = root;
+    ctx.root_len = strlen(root);
+    ctx.out_dir = old_dir;
+    ctx.opts = opts;
+    ctx.jobs = opts->jobs > 0 ? opts->jobs : 1;
+    ctx.corpus_fd = ctx.pack_fd = ctx.held_fd = -1;
+    ctx.diff = 1;
+    if (manifest_load(&ctx) != 0) return -1;
+    if (!ctx.manifest_found || !ctx.surface_text) {
+        fprintf(stderr, "Error: '%s' has no %s and %s from DOCUNATION %s with these "
+                "-D/-U settings\n", old_dir, MANIFEST_NAME, SURFACE_NAME, DOCUNATION_VERSION);
+        manifest_free(&ctx);
+        return -1;
+    }
+    int rc = bulk_run(&ctx);
+    free(ctx.stats);
+    qsort(ctx.files, ctx.count, sizeof(BulkFile), compare_bulk_files);
+
+    /* Removed sources are rendered as they come, so count them up front */
+    size_t files[5] = { 0 };     /* unchanged, modified, added, removed, failed */
+    uint64_t symbols[3] = { 0 };
+    for (size_t i = 0; i < ctx.count; i++) {
+        const BulkFile *f = &ctx.files[i];
+        uint32_t changed = f->changed[0] + f->changed[1] + f->changed[2];
+        if (!f->ok) rc = -1;
+        files[!f->ok ? 4 : !f->prev ? 2 : changed ? 1 : 0]++;
+        for (int k = 0; k < 3; k++) symbols[k] += f->changed[k];
+    }
+    for (size_t i = 0; i < ctx.manifest_count; i++) {
+        const ManifestEntry *e = &ctx.manifest[i];
+        if (e->seen || !e->surface) continue;
+        files[3]++;
+        for (size_t k = 0; k < e->surface_len; k++) symbols[DIFF_REMOVED] += e->surface[k] == '\n';
+    }
+
+    OutBuf ob = { 0 };
+    OutBuf scratch = { 0 };
+    ob_bind(&ob, stdout);
+    OB_LIT(&ob, "{\n  \"old\": \"");
+    ob_json(&ob, old_dir, strlen(old_dir));
+    ob_printf(&ob, "\",\n  \"files\": {\"unchanged\": %zu, \"modified\": %zu, \"added\": %zu, "
+              "\"removed\": %zu, \"failed\": %zu},\n", files[0], files[1], files[2], files[3],
+              files[4]);
+    ob_printf(&ob, "  \"symbols\": {\"added\": %llu, \"removed\": %llu, \"modified\": %llu},\n",
+              (unsigned long long)symbols[DIFF_ADDED], (unsigned long long)symbols[DIFF_REMOVED],
+              (unsigned long long)symbols[DIFF_MODIFIED]);
+    OB_LIT(&ob, "  \"changes\": [");
+    int first = 1;
+    size_t j = 0;
+    for (size_t i = 0; i <= ctx.count; i++) {
+        /* Sources only the other run had, in path order among the rest */
+        for (; j < ctx.manifest_count; j++) {
+            const ManifestEntry *e = &ctx.manifest[j];
+            if (i < ctx.count && strcmp(e->rel, ctx.files[i].rel) >= 0) break;
+            if (e->seen || !e->surface) continue;
+            uint32_t counts[3] = { 0 };
+            ob_bind(&scratch, NULL);
+            if (diff_removed(&scratch, e, counts) != 0) rc = -1;
+            diff_append(&ob, scratch.data, scratch.len, &first);
+        }
+        if (i < ctx.count) diff_append(&ob, ctx.files[i].changes, ctx.files[i].changes_len, &first);
+    }
+    if (first) OB_LIT(&ob, "]\n}\n");
+    else OB_LIT(&ob, "\n  ]\n}\n");
+    if (ob_finish(&ob) != 0) {
+        fprintf(stderr, "Error: Cannot write output\n");
+        rc = -1;
+    }
+    ob_free(&ob);
+    ob_free(&scratch);
+
+    for (size_t i = 0; i < ctx.count; i++) {
+        free(ctx.files[i].path);
+        free(ctx.files[i].changes);
+    }
+    free(ctx.files);
+    manifest_free(&ctx);
+    return rc;
+}
+
+/* ─── Watch mode ───────────────────────────────────────────────────────────
+ * --watch does one run, then waits for changes: inotify watches every
+ * directory of the tree where Linux provides it, and elsewhere a digest of
+ * the tree's names, sizes and mtimes is taken every WATCH_POLL_MS. Events
+ * are gathered until the tree has been quiet for WATCH_SETTLE_MS, so an
+ * editor's save is handled once. Edits and deletions of sources in the
+ * manifest are applied directly: only those files go through
+ * bulk_process_file(), and the manifest and index.html are rewritten from
+ * the manifest. Anything else (a new source, a directory or ignore file
+ * changing) needs discovery, so it redoes an incremental run, as do runs
+ * whose corpus, pack, search index or links depend on every file.
+ */
+
+typedef struct {
+    const char *root;
+    size_t root_len;
+    const BulkOptions *opts;
+    int fd;                  /* inotify instance, or -1 to poll */
+    dev_t out_dev;           /* the output directory is never watched */
+    ino_t out_ino;
+    char **dirs;             /* watched directory paths, by watch descriptor */
+    size_t dir_cap;
+    uint64_t digest;         /* polling: sum over the tree's entries */
+    char **changed;          /* relative paths of touched sources */
+    size_t changed_count;
+    size_t changed_cap;
+    int rescan;              /* a change only discovery can apply */
+} Watcher;
+
+#ifdef __linux__
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+/* Watch one directory, or refresh the path of one already watched.
+ * Watch descriptors are small integers handed out in sequence. */
+static void watch_add(Watcher *w, const char *path) {
+    int wd = inotify_add_watch(w->fd, path, WATCH_EVENTS | IN_ONLYDIR);
+    if (wd < 0) {
+        fprintf(stderr, "Error: Cannot watch '%s': %s\n", path, strerror(errno));
+        return;
+    }
+    if ((size_t)wd >= w->dir_cap) {
+        size_t cap = w->dir_cap ? w->dir_cap : 64;
+        while (cap <= (size_t)wd) cap *= 2;
+        char **dirs = realloc(w->dirs, cap * sizeof(char *));
+        if (!dirs) return;
+        memset(dirs + w->dir_cap, 0, (cap - w->dir_cap) * sizeof(char *));
+        w->dirs = dirs;
+        w->dir_cap = cap;
+    }
+    char *copy = strdup(path);
+    if (!copy) return;
+    free(w->dirs[wd]);
+    w->dirs[wd] = copy;
+}
+#endif
+
+/* Fold one entry into the polling digest; the sum ignores readdir order */
+static void watch_digest(Watcher *w, const char *rel, const struct stat *st) {
+    uint64_t meta[2] = { (uint64_t)st->st_size, (uint64_t)stat_mtime_ns(st) };
+    w->digest += fnv1a64(rel, strlen(rel)) ^ fnv1a64(meta, sizeof(meta));
+}
+
+/* Watch or digest dir and the directories below it. Links to directories
+ * are not followed, so a link cycle cannot trap the walk. */
+static void watch_tree(Watcher *w, const char *dir) {
+#ifdef __linux__
+    if (w->fd >= 0) watch_add(w, dir);
+#endif
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || is_vcs_dir(name)) continue;
+        char path[MAX_PATH_LEN];
+        if ((size_t)snprintf(path, sizeof(path), "%s/%s", dir, name) >= sizeof(path)) continue;
+        struct stat st;
+        if (lstat(path, &st) != 0) continue;
+        const char *rel = path + w->root_len;
+        if (*rel == '/') rel++;
+        if (S_ISDIR(st.st_mode)) {
+            if (st.st_dev == w->out_dev && st.st_ino == w->out_ino) continue;
+            if (globset_match(&w->opts->exclude, rel, name, 1)) continue;
+            if (w->fd < 0) watch_digest(w, rel, &st);
+            watch_tree(w, path);
+        } else if (w->fd < 0 && (bulk_wanted(w->opts, name) || strcmp(name, IGNORE_NAME) == 0)) {
+            if (stat(path, &st) == 0) watch_digest(w, rel, &st);
+        }
+    }
+    closedir(d);
+}
+
+#ifdef __linux__
+/* Remember a touched source once per batch */
+static void watch_note(Watcher *w, const char *rel) {
+    for (size_t i = 0; i < w->changed_count; i++) {
+        if (strcmp(w->changed[i], rel) == 0) return;
+    }
+    if (w->changed_count == w->changed_cap) {
+        size_t cap = w->changed_cap ? w->changed_cap * 2 : 16;
+        char **changed = realloc(w->changed, cap * sizeof(char *));
+        if (!changed) {
+            w->rescan = 1;
+            return;
+        }
+        w->changed = changed;
+        w->changed_cap = cap;
+    }
+    if (!(w->changed[w->changed_count] = strdup(rel))) {
+        w->rescan = 1;
+        return;
+    }
+    w->changed_count++;
+}
+
+/* Sort a batch of inotify events into touched sources and rescans */
+static void watch_events(Watcher *w, const char *buf, size_t len) {
+    for (size_t at = 0; at + sizeof(struct inotify_event) <= len; ) {
+        const struct inotify_event *ev = (const struct inotify_event *)(buf + at);
+        at += sizeof(struct inotify_event) + ev->len;
+        if (ev->mask & IN_Q_OVERFLOW) {
+            w->rescan = 1;
+            continue;
+        }
+        if (ev->wd < 0 || (size_t)ev->wd >= w->dir_cap || !w->dirs[ev->wd]) continue;
+        if (ev->mask & IN_IGNORED) {
+            free(w->dirs[ev->wd]);
+            w->dirs[ev->wd] = NULL;
+            continue;
+        }
+        if (!ev->len) continue;
+        const char *name = ev->name;
+        if (ev->mask & IN_ISDIR) {
+            if (!is_vcs_dir(name)) w->rescan = 1;
+            continue;
+        }
+        if (strcmp(name, IGNORE_NAME) == 0) {
+            w->rescan = 1;
+            continue;
+        }
+        /* A new file is only complete once written or moved in */
+        if ((ev->mask & IN_CREATE) || !bulk_wanted(w->opts, name)) continue;
+        char path[MAX_PATH_LEN];
+        if ((size_t)snprintf(path, sizeof(path), "%s/%s", w->dirs[ev->wd], name) >= sizeof(path)) {
+            continue;
+        }
+        const char *rel = path + w->root_len;
+        if (*rel == '/') rel++;
+        watch_note(w, rel);
+    }
+}
+#endif
+
+/* Block until something changed and the tree has settled */
+static int watch_wait(Watcher *w) {
+#ifdef __linux__
+    if (w->fd >= 0) {
+        union {
+            struct inotify_event ev;     /* aligns the buffer for events */
+            char bytes[64 << 10];
+        } buf;
+        int timeout = -1;
+        for (;;) {
+            struct pollfd pfd = { w->fd, POLLIN, 0 };
+            int n = poll(&pfd, 1, timeout);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                fprintf(stderr, "Error: Cannot watch '%s': %s\n", w->root, strerror(errno));
+                return -1;
+            }
+            if (n == 0) {
+                if (w->changed_count || w->rescan) return 0;
+                timeout = -1;
+                continue;
+            }
+            ssize_t len = read(w->fd, buf.bytes, sizeof(buf.bytes));
+            if (len < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            if (len <= 0) {
+                fprintf(stderr, "Error: Cannot watch '%s'\n", w->root);
+                return -1;
+            }
+            watch_events(w, buf.bytes, (size_t)len);
+            timeout = WATCH_SETTLE_MS;
+        }
+    }
+#endif
+    uint64_t digest = w->digest;
+    while (w->digest == digest) {
+        usleep(WATCH_POLL_MS * 1000);
+        w->digest = 0;
+        watch_tree(w, w->root);
+    }
+    w->rescan = 1;
+    return 0;
+}
+
+/* Apply edits and deletions of manifest sources without discovery.
+ * Returns 1 when a full run is needed instead. */
+static int watch_update(const Watcher *w, const char *out_dir) {
+    const BulkOptions *opts = w->opts;
+    if (w->rescan || opts->single_json || opts->pack || opts->search || opts->merge ||
+        (opts->link && (opts->formats & FORMAT_HTML))) return 1;
+
+    BulkContext ctx = { 0 };
+    ctx.root = w->root;
+    ctx.root_len = strlen(w->root);
+    ctx.out_dir = out_dir;
+    ctx.opts = opts;
+    ctx.jobs = 1;
+    ctx.corpus_fd = ctx.pack_fd = ctx.held_fd = -1;
+    if (manifest_load(&ctx) != 0) return -1;
+    int rc = ctx.manifest_count ? 0 : 1;
+    for (size_t i = 0; rc == 0 && i < w->changed_count; i++) {
+        ManifestEntry key = { 0 };
+        key.rel = w->changed[i];
+        if (!bsearch(&key, ctx.manifest, ctx.manifest_count, sizeof(ManifestEntry),
+                     compare_manifest_entries)) rc = 1;
+    }
+    if (rc == 0 && !(ctx.files = calloc(ctx.manifest_count, sizeof(BulkFile)))) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        rc = -1;
+    }
+
+    /* The manifest is sorted, so the files it lists are too */
+    for (size_t i = 0; rc == 0 && i < ctx.manifest_count; i++) {
+        const ManifestEntry *e = &ctx.manifest[i];
+        BulkFile *f = &ctx.files[ctx.count];
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "%s/%s", w->root, e->rel);
+        if (!(f->path = strdup(path)) || !(f->base = strdup(e->base))) {
+            free(f->path);
+            fprintf(stderr, "Error: Cannot allocate memory\n");
+            rc = -1;
+            break;
+        }
+        ctx.count++;
+        f->rel = bulk_rel(&ctx, f->path);
+        f->size = e->size;
+        f->mtime = e->mtime;
+        f->hash = e->hash;
+        f->prev = e;
+        f->ok = f->reused = 1;
+    }
+
+    OutBuf ob = { 0 };
+    for (size_t i = 0; rc == 0 && i < w->changed_count; i++) {
+        BulkFile key = { 0 };
+        key.rel = w->changed[i];
+        BulkFile *f = bsearch(&key, ctx.files, ctx.count, sizeof(BulkFile), compare_bulk_files);
+        struct stat st;
+        if (stat(f->path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            remove_outputs(out_dir, f->base);
+            f->ok = 0;
+            continue;
+        }
+        free(f->base);
+        f->base = NULL;
+        f->size = (uint64_t)st.st_size;
+        f->mtime = stat_mtime_ns(&st);
+        f->ok = f->reused = 0;
+        bulk_process_file(&ctx, f, &ob, NULL);
+    }
+    ob_free(&ob);
+
+    char index_path[MAX_PATH_LEN];
+    snprintf(index_path, sizeof(index_path), "%s/index.html", out_dir);
+    if (rc == 0 && manifest_save(&ctx) != 0) rc = -1;
+    if (rc == 0) {
+        OutBuf index = { 0 };
+        if (ob_open(&index, index_path) != 0) {
+            rc = -1;
+        } else {
+            if (index_render(&index, &ctx) != 0) rc = -1;
+            if (ob_close(&index, index_path) != 0) rc = -1;
+        }
+        ob_free(&index);
+    }
+    for (size_t i = 0; i < ctx.count; i++) {
+        free(ctx.files[i].path);
+        free(ctx.files[i].base);
+        free(ctx.files[i].surface);
+    }
+    free(ctx.files);
+    manifest_free(&ctx);
+    return rc;
+}
+
+/* Document root, then keep its outputs current until interrupted */
+static int watch_directory(const char *root, const char *out_dir, const BulkOptions *opts) {
+    /* Failures in single files are reported and watched for a fix */
+    struct stat st;
+    if (process_directory(root, out_dir, opts) != 0 &&
+        (stat(root, &st) != 0 || !S_ISDIR(st.st_mode) || stat(out_dir, &st) != 0)) return -1;
+
+    /* Later runs only redo what changed */
+    BulkOptions again = *opts;
+    again.incremental = 1;
+    Watcher w = { 0 };
+    w.root = root;
+    w.root_len = strlen(root);
+    w.opts = &again;
+    w.fd = -1;
+    if (stat(out_dir, &st) == 0) {
+        w.out_dev = st.st_dev;
+        w.out_ino = st.st_ino;
+    }
+#ifdef __linux__
+    w.fd = inotify_init1(IN_CLOEXEC);
+    if (w.fd < 0) fprintf(stderr, "Warning: inotify unavailable, polling '%s'\n", root);
+#endif
+    watch_tree(&w, root);
+    printf("Watching %s (Ctrl-C to stop)\n", root);
+    fflush(stdout);
+
+    while (watch_wait(&w) == 0) {
+        uint64_t start = stats_clock();
+        size_t changed = w.changed_count;
+        int updated = watch_update(&w, out_dir);
+        if (updated == 1) {
+            process_directory(root, out_dir, &again);
+#ifdef __linux__
+            if (w.fd >= 0) watch_tree(&w, root);
+#endif
+        }
+        double ms = (double)(stats_clock() - start) / 1e6;
+        if (updated == 0) printf("Updated %zu file%s in %.1f ms\n", changed, changed == 1 ? "" : "s", ms);
+        else if (updated == 1) printf("Re-ran over the tree in %.1f ms\n", ms);
+        fflush(stdout);
+        for (size_t i = 0; i < w.changed_count; i++) free(w.changed[i]);
+        w.changed_count = 0;
+        w.rescan = 0;
+    }
+
+    /* Only a failure to watch gets here */
+    for (size_t i = 0; i < w.dir_cap; i++) free(w.dirs[i]);
+    free(w.dirs);
+    free(w.changed);
+    if (w.fd >= 0) close(w.fd);
+    return -1;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * OUTPUT FORMATTERS
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/* Append a slice of doc to out: raw, JSON-escaped or HTML-escaped */
+#define PUT_RAW(s) ob_write(out, DSTR(doc, s), (s).len)
+#define PUT_JSON(s) ob_json(out, DSTR(doc, s), (s).len)
+#define PUT_HTML(s) ob_html(out, DSTR(doc, s), (s).len)
+
+/* Colored text: the code is dropped when color is off */
+#define PUT_COLOR(code) ob_str(out, C(code))
+
+static void output_text(DOCUNATION *doc, OutBuf *out, int color) {
+    PUT_COLOR(COL_BOLD);
+    PUT_COLOR(COL_MAGENTA);
+    ob_fill(out, '=', 70);
+    PUT_COLOR(COL_RESET);
+    ob_printf(out, "\n%sModule: %s%s\n", C(COL_BOLD), doc->module_name, C(COL_RESET));
+    ob_printf(out, "File: %s\n", doc->filepath);
+    ob_printf(out, "Generated: %s\n", doc->timestamp);
+    PUT_COLOR(COL_MAGENTA);
+    PUT_COLOR(COL_BOLD);
+    ob_fill(out, '=', 70);
+    PUT_COLOR(COL_RESET);
+    OB_LIT(out, "\n");
+
+    if (doc->docstring.len) {
+        ob_printf(out, "\n%sDESCRIPTION%s\n", C(COL_CYAN), C(COL_RESET));
+        OB_LIT(out, "    ");
+        PUT_RAW(doc->docstring);
+        OB_LIT(out, "\n");
+    }
+
+    ob_printf(out, "\n%sINCLUDES%s\n", C(COL_BLUE), C(COL_RESET));
+    FOR_SECTION(doc, SECTION_INCLUDES, n) {
+        OB_LIT(out, "    ");
+        PUT_COLOR(COL_GREEN);
+        PUT_RAW(n->name);
+        PUT_COLOR(COL_RESET);
+        OB_LIT(out, "\n");
+    }
+
+/* Indented, colored condition and docstring lines under a node */
+#define PUT_DOCSTRING(n) do { \
+        if ((n)->condition.len || (n)->inactive) { \
+            OB_LIT(out, "        "); \
+            PUT_COLOR(COL_YELLOW); \
+            if ((n)->condition.len) { \
+                OB_LIT(out, "#if "); \
+                PUT_RAW((n)->condition); \
+                if ((n)->inactive) OB_LIT(out, " "); \
+            } \
+            if ((n)->inactive) OB_LIT(out, "(ruled out)"); \
+            PUT_COLOR(COL_RESET); \
+            OB_LIT(out, "\n"); \
+        } \
+        if ((n)->docstring.len) { \
+            OB_LIT(out, "        "); \
+            PUT_COLOR(COL_CYAN); \
+            PUT_RAW((n)->docstring); \
+            PUT_COLOR(COL_RESET); \
+            OB_LIT(out, "\n"); \
+        } \
+    } while (0)
+
+    if (SECTION_SIZE(doc, SECTION_MACROS)) {
+        ob_printf(out, "\n%sMACROS%s\n", C(COL_BLUE), C(COL_RESET));
+    }
+    FOR_SECTION(doc, SECTION_MACROS, n) {
+        OB_LIT(out, "    ");
+        PUT_COLOR(COL_GREEN);
+        PUT_RAW(n->name);
+        PUT_COLOR(COL_RESET);
+        OB_LIT(out, "\n");
+        PUT_DOCSTRING(n);
+    }
+
+    if (SECTION_SIZE(doc, SECTION_DATA)) {
+        ob_printf(out, "\n%sDATA%s\n", C(COL_BLUE), C(COL_RESET));
+    }
+    FOR_SECTION(doc, SECTION_DATA, n) {
+        OB_LIT(out, "    ");
+        PUT_COLOR(COL_GREEN);
+        PUT_RAW(n->name);
+        PUT_COLOR(COL_RESET);
+        if (n->is_static) OB_LIT(out, " [static]");
+        OB_LIT(out, "\n        ");
+        PUT_RAW(n->signature);
+        OB_LIT(out, "\n");
+        PUT_DOCSTRING(n);
+    }
+
+    if (SECTION_SIZE(doc, SECTION_TYPES)) {
+        ob_printf(out, "\n%sTYPES%s\n", C(COL_BLUE), C(COL_RESET));
+    }
+    FOR_SECTION(doc, SECTION_TYPES, n) {
+        OB_LIT(out, "    ");
+        PUT_COLOR(COL_GREEN);
+        PUT_RAW(n->name);
+        PUT_COLOR(COL_RESET);
+        OB_LIT(out, " (");
+        ob_str(out, node_type_names[n->type]);
+        OB_LIT(out, ")\n");
+        PUT_DOCSTRING(n);
+    }
+
+    if (SECTION_SIZE(doc, SECTION_FUNCTIONS)) {
+        ob_printf(out, "\n%sFUNCTIONS%s\n", C(COL_BLUE), C(COL_RESET));
+    }
+    FOR_SECTION(doc, SECTION_FUNCTIONS, n) {
+        OB_LIT(out, "    ");
+        PUT_COLOR(COL_GREEN);
+        PUT_RAW(n->name);
+        PUT_COLOR(COL_RESET);
+        if (n->is_static) OB_LIT(out, " [static]");
+        if (n->is_inline) OB_LIT(out, " [inline]");
+        if (n->is_extern) OB_LIT(out, " [extern]");
+        OB_LIT(out, "\n        ");
+        PUT_RAW(n->signature);
+        OB_LIT(out, "\n");
+        PUT_DOCSTRING(n);
+    }
+#undef PUT_DOCSTRING
+
+    OB_LIT(out, "\n");
+    PUT_COLOR(COL_MAGENTA);
+    PUT_COLOR(COL_BOLD);
+    ob_fill(out, '=', 70);
+    PUT_COLOR(COL_RESET);
+    OB_LIT(out, "\n");
+}
+
+static void output_json(DOCUNATION *doc, OutBuf *out) {
+    OB_LIT(out, "{\n  \"filepath\": \"");
+    ob_json(out, doc->filepath, strlen(doc->filepath));
+    OB_LIT(out, "\",\n  \"module_name\": \"");
+    ob_json(out, doc->module_name, strlen(doc->module_name));
+    OB_LIT(out, "\",\n  \"timestamp\": \"");
+    ob_str(out, doc->timestamp);
+    OB_LIT(out, "\",\n  \"docstring\": \"");
+    PUT_JSON(doc->docstring);
+    OB_LIT(out, "\",\n");
+
+    OB_LIT(out, "  \"nodes\": [\n");
+    for (int i = 0; i < doc->node_count; i++) {
+        DocNode *n = &doc->nodes[i];
+        OB_LIT(out, "    {\n      \"name\": \"");
+        PUT_JSON(n->name);
+        OB_LIT(out, "\",\n      \"type\": \"");
+        ob_str(out, node_type_names[n->type]);
+        ob_printf(out, "\",\n      \"line\": %d,\n", n->line);
+        ob_printf(out, "      \"column\": %d,\n", n->column);
+        ob_printf(out, "      \"end_line\": %d,\n", n->end_line);
+        ob_printf(out, "      \"end_column\": %d,\n", n->end_column);
+        ob_printf(out, "      \"start_byte\": %u,\n", n->start);
+        ob_printf(out, "      \"end_byte\": %u,\n", n->end);
+        OB_LIT(out, "      \"condition\": \"");
+        PUT_JSON(n->condition);
+        ob_printf(out, "\",\n      \"inactive\": %s,\n", n->inactive ? "true" : "false");
+        OB_LIT(out, "      \"signature\": \"");
+        PUT_JSON(n->signature);
+        OB_LIT(out, "\",\n      \"docstring\": \"");
+        PUT_JSON(n->docstring);
+        OB_LIT(out, "\"\n    }");
+        if (i < doc->node_count - 1) OB_LIT(out, ",");
+        OB_LIT(out, "\n");
+    }
+    OB_LIT(out, "  ]\n}\n");
+}
+
+/* Section banner and list opening shared by every HTML section */
+static void html_section(OutBuf *out, const char *bgcolor, const char *title) {
+    OB_LIT(out, "<p><table width=\"100%\" cellspacing=0 cellpadding=2 border=0>\n");
+    ob_printf(out, "<tr bgcolor=\"%s\"><td>&nbsp;</td>\n", bgcolor);
+    ob_printf(out, "<td><strong>%s</strong></td></tr></table>\n", title);
+}
+
+/* Ids of the names documented on one page, for linking its signatures */
+typedef struct {
+    const HtmlLinks *links;
+    uint32_t *slots;         /* interned ids, 0 when empty */
+    size_t cap;              /* power of two, or 0 */
+} PageLinks;
+
+static void page_links_init(PageLinks *pl, DOCUNATION *doc, const HtmlLinks *links) {
+    pl->links = links;
+    pl->cap = 16;
+    while (pl->cap < (size_t)doc->node_count * 2) pl->cap *= 2;
+    pl->slots = calloc(pl->cap, sizeof(uint32_t));
+    if (!pl->slots) {
+        pl->cap = 0;
+        return;
+    }
+    for (int i = 0; i < doc->node_count; i++) {
+        const DocNode *n = &doc->nodes[i];
+        if (n->type == NODE_INCLUDE || !n->name.len) continue;
+        uint32_t id = intern_find(links->symbols->strings, DSTR(doc, n->name), n->name.len);
+        if (!id) continue;
+        size_t h = (size_t)(id * 2654435761u) & (pl->cap - 1);
+        while (pl->slots[h] && pl->slots[h] != id) h = (h + 1) & (pl->cap - 1);
+        pl->slots[h] = id;
+    }
+}
+
+static int page_defines(const PageLinks *pl, uint32_t id) {
+    if (!pl->cap) return 0;
+    size_t h = (size_t)(id * 2654435761u) & (pl->cap - 1);
+    for (; pl->slots[h]; h = (h + 1) & (pl->cap - 1)) {
+        if (pl->slots[h] == id) return 1;
+    }
+    return 0;
+}
+
+/* A signature with each identifier that names a documented symbol linked
+ * to its anchor, on this page or another */
+static void html_linked(OutBuf *out, DOCUNATION *doc, const DocNode *self, const PageLinks *pl) {
+    const char *s = DSTR(doc, self->signature);
+    const char *end = s + self->signature.len;
+    const char *plain = s;
+    const Interner *strings = pl->links->symbols->strings;
+    uint32_t self_id = intern_find(strings, DSTR(doc, self->name), self->name.len);
+    while (s < end) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\'') {
+            for (s++; s < end && *s != (char)c; s++) {
+                if (*s == '\\' && s + 1 < end) s++;
+            }
+            if (s < end) s++;
             continue;
         }
-        if (strstr(line, "enum ") && !strstr(line, "typedef")) {
-            parse_aggregate(p, NODE_ENUM);
+        if (isdigit(c)) {
+            while (s < end && (isalnum((unsigned char)*s) || *s == '_' || *s == '.')) s++;
             continue;
         }
-        
-        /* Typedef */
-        if (starts_with(line, "typedef")) {
-            parse_typedef(p);
+        if (!isalpha(c) && c != '_') {
+            s++;
             continue;
         }
-        
-        /* Function (has parentheses but not control statements) 
-         * Must start with a type or be static/inline/extern */
-        if (strchr(line, '(') && 
-            !starts_with(line, "if") &&
-            !starts_with(line, "while") &&
-            !starts_with(line, "for") &&
-            !starts_with(line, "switch") &&
-            !starts_with(line, "return") &&
-            !strstr(line, "sizeof") &&
-            !strstr(line, "= ") &&
-            !strstr(line, "->") &&
-            !strstr(line, ".") &&
-            (is_static || is_inline || is_extern ||
-             starts_with(line, "void") ||
-             starts_with(line, "int") ||
-             starts_with(line, "char") ||
-             starts_with(line, "long") ||
-             starts_with(line, "short") ||
-             starts_with(line, "unsigned") ||
-             starts_with(line, "signed") ||
-             starts_with(line, "float") ||
-             starts_with(line, "double") ||
-             starts_with(line, "size_t") ||
-             starts_with(line, "const") ||
-             strstr(line, "* ") ||   /* pointer return */
-             strstr(line, "*\t"))) { /* pointer return */
-            parse_function(p, line, is_static, is_inline, is_extern);
-            continue;
+        const char *id = s;
+        while (s < end && (isalnum((unsigned char)*s) || *s == '_')) s++;
+        size_t len = (size_t)(s - id);
+        if (!symbol_linkable(id, len)) continue;
+        uint32_t name = intern_find(strings, id, len);
+        if (!name || name == self_id) continue;
+        const Symbol *sym = NULL;
+        if (!page_defines(pl, name)) {
+            if (!pl->links->cross_file) continue;
+            sym = symbols_find(pl->links->symbols, name);
+            if (!sym) continue;
         }
-        
-        /* Static/const variables (not functions - no parens or has = sign) 
-         * Must be at file scope - require static/extern or no leading whitespace */
-        int at_file_scope = (p->line[0] && !isspace((unsigned char)p->line[0])) || 
-                            is_static || is_extern;
-        if (at_file_scope &&
-            (is_static || starts_with(line, "const ")) && 
-            !strchr(line, '(') &&
-            !strstr(line, "->") &&
-            (strstr(line, "=") || strstr(line, "["))) {
-            parse_variable(p, line, is_static);
-            continue;
+        ob_html(out, plain, (size_t)(id - plain));
+        OB_LIT(out, "<a href=\"");
+        if (sym) {
+            ob_html(out, sym->file, strlen(sym->file));
+            OB_LIT(out, ".html");
         }
-        
-        /* Clear pending comment if not consumed */
-        if (p->pending_comment_line < p->line_num - 1) {
-            p->pending_comment[0] = '\0';
+        OB_LIT(out, "#");
+        ob_write(out, id, len);
+        OB_LIT(out, "\">");
+        ob_write(out, id, len);
+        OB_LIT(out, "</a>");
+        plain = s;
+    }
+    ob_html(out, plain, (size_t)(end - plain));
+}
+
+static void output_html(DOCUNATION *doc, OutBuf *out, const HtmlLinks *links) {
+    PageLinks pl = { 0 };
+    if (links) page_links_init(&pl, doc, links);
+    size_t module_len = strlen(doc->module_name);
+    OB_LIT(out, "<!DOCTYPE html>\n<html>\n<head>\n");
+    OB_LIT(out, "<meta charset=\"UTF-8\">\n<title>");
+    ob_html(out, doc->module_name, module_len);
+    OB_LIT(out, "</title>\n</head>\n<body bgcolor=\"#f0f0f0\">\n");
+
+    OB_LIT(out, "<table width=\"100%\" cellspacing=0 cellpadding=2 border=0>\n");
+    OB_LIT(out, "<tr bgcolor=\"#7799ee\"><td>&nbsp;</td>\n");
+    OB_LIT(out, "<td><font face=\"helvetica, arial\" size=\"+1\"><strong>");
+    ob_html(out, doc->module_name, module_len);
+    OB_LIT(out, "</strong></font></td></tr></table>\n<p><tt>");
+    ob_html(out, doc->filepath, strlen(doc->filepath));
+    OB_LIT(out, "</tt></p>\n");
+
+    if (doc->docstring.len) {
+        html_section(out, "#eeaa77", "Description");
+        OB_LIT(out, "<pre>");
+        PUT_HTML(doc->docstring);
+        OB_LIT(out, "</pre>\n");
+    }
+
+    if (SECTION_SIZE(doc, SECTION_INCLUDES)) {
+        html_section(out, "#aa55cc", "Includes");
+        OB_LIT(out, "<dl>\n");
+    }
+    FOR_SECTION(doc, SECTION_INCLUDES, n) {
+        OB_LIT(out, "<dt><tt>");
+        PUT_HTML(n->signature);
+        OB_LIT(out, "</tt></dt>\n");
+    }
+    if (SECTION_SIZE(doc, SECTION_INCLUDES)) OB_LIT(out, "</dl>\n");
+
+/* Anchored name term, opened but not closed */
+#define PUT_TERM(n) do { \
+        OB_LIT(out, "<dt><a name=\""); \
+        PUT_HTML((n)->name); \
+        OB_LIT(out, "\"><strong>"); \
+        PUT_HTML((n)->name); \
+        OB_LIT(out, "</strong></a>"); \
+    } while (0)
+
+/* Signature and docstring definitions under a term */
+#define PUT_DEFS(n) do { \
+        OB_LIT(out, "<dd><tt>"); \
+        if (pl.links) html_linked(out, doc, (n), &pl); \
+        else PUT_HTML((n)->signature); \
+        OB_LIT(out, "</tt></dd>\n"); \
+        if ((n)->condition.len || (n)->inactive) { \
+            OB_LIT(out, "<dd><small>"); \
+            if ((n)->condition.len) { \
+                OB_LIT(out, "#if "); \
+                PUT_HTML((n)->condition); \
+                if ((n)->inactive) OB_LIT(out, " "); \
+            } \
+            if ((n)->inactive) OB_LIT(out, "(ruled out)"); \
+            OB_LIT(out, "</small></dd>\n"); \
+        } \
+        if ((n)->docstring.len) { \
+            OB_LIT(out, "<dd>"); \
+            PUT_HTML((n)->docstring); \
+            OB_LIT(out, "</dd>\n"); \
+        } \
+    } while (0)
+
+    if (SECTION_SIZE(doc, SECTION_MACROS)) {
+        html_section(out, "#aa55cc", "Macros");
+        OB_LIT(out, "<dl>\n");
+    }
+    FOR_SECTION(doc, SECTION_MACROS, n) {
+        PUT_TERM(n);
+        OB_LIT(out, "</dt>\n");
+        PUT_DEFS(n);
+    }
+    if (SECTION_SIZE(doc, SECTION_MACROS)) OB_LIT(out, "</dl>\n");
+
+    if (SECTION_SIZE(doc, SECTION_DATA)) {
+        html_section(out, "#aa55cc", "Data");
+        OB_LIT(out, "<dl>\n");
+    }
+    FOR_SECTION(doc, SECTION_DATA, n) {
+        PUT_TERM(n);
+        OB_LIT(out, "</dt>\n");
+        PUT_DEFS(n);
+    }
+    if (SECTION_SIZE(doc, SECTION_DATA)) OB_LIT(out, "</dl>\n");
+
+    if (SECTION_SIZE(doc, SECTION_TYPES)) {
+        html_section(out, "#aa55cc", "Types");
+        OB_LIT(out, "<dl>\n");
+    }
+    FOR_SECTION(doc, SECTION_TYPES, n) {
+        PUT_TERM(n);
+        OB_LIT(out, " (");
+        ob_str(out, node_type_names[n->type]);
+        OB_LIT(out, ")</dt>\n");
+        PUT_DEFS(n);
+    }
+    if (SECTION_SIZE(doc, SECTION_TYPES)) OB_LIT(out, "</dl>\n");
+
+    if (SECTION_SIZE(doc, SECTION_FUNCTIONS)) {
+        html_section(out, "#aa55cc", "Functions");
+        OB_LIT(out, "<dl>\n");
+    }
+    FOR_SECTION(doc, SECTION_FUNCTIONS, n) {
+        PUT_TERM(n);
+        OB_LIT(out, "(");
+        const char *sig = DSTR(doc, n->signature);
+        const char *sig_end = sig + n->signature.len;
+        const char *paren = span_chr(sig, sig_end, '(');
+        if (paren) {
+            const char *end = sig_end - 1;
+            while (end > paren && *end != ')') end--;
+            if (end > paren + 1) ob_html(out, paren + 1, (size_t)(end - paren - 1));
         }
+        OB_LIT(out, ")</dt>\n");
+        PUT_DEFS(n);
     }
+    if (SECTION_SIZE(doc, SECTION_FUNCTIONS)) OB_LIT(out, "</dl>\n");
+#undef PUT_TERM
+#undef PUT_DEFS
+
+    OB_LIT(out, "<hr>\n<p><small>Generated by DOCUNATION.C - Ring 1</small></p>\n");
+    OB_LIT(out, "</body>\n</html>\n");
+    free(pl.slots);
 }
 
+#undef PUT_RAW
+#undef PUT_JSON
+#undef PUT_HTML
+#undef PUT_COLOR
+
+
 /* ═══════════════════════════════════════════════════════════════════════════
- * DOCUMENT HELPERS
+ * STREAMING
+ *
+ * `-j -` parses standard input through a SourceStream and writes NDJSON:
+ * a module record, then one record per node as the parser completes it.
+ * Nothing accumulates, so memory is bounded by the longest line and the
+ * largest single construct rather than by the input.
  * ═══════════════════════════════════════════════════════════════════════════ */
 
 typedef struct {
-    const char *root;
-    size_t root_len;
-    const char *out_dir;
-    FILE *index;
-    size_t file_count;
-} BulkContext;
+    OutBuf *out;
+    int started;         /* module record written */
+} NdjsonSink;
 
-static DOCUNATION *parse_document(const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        fprintf(stderr, "Error: Cannot open '%s'\n", filename);
-        return NULL;
-    }
+/* The module record; its docstring is settled before the first node */
+static void ndjson_module(OutBuf *out, DOCUNATION *doc) {
+    OB_LIT(out, "{\"type\": \"module\", \"filepath\": \"");
+    ob_json(out, doc->filepath, strlen(doc->filepath));
+    OB_LIT(out, "\", \"module_name\": \"");
+    ob_json(out, doc->module_name, strlen(doc->module_name));
+    OB_LIT(out, "\", \"timestamp\": \"");
+    ob_str(out, doc->timestamp);
+    OB_LIT(out, "\", \"docstring\": \"");
+    ob_json(out, DSTR(doc, doc->docstring), doc->docstring.len);
+    OB_LIT(out, "\"}\n");
+}
 
-    DOCUNATION *doc = calloc(1, sizeof(DOCUNATION));
-    if (!doc) {
-        fprintf(stderr, "Error: Cannot allocate memory\n");
-        fclose(fp);
-        return NULL;
+static void ndjson_node(void *ctx, DOCUNATION *doc, const DocNode *n) {
+    NdjsonSink *sink = ctx;
+    OutBuf *out = sink->out;
+    if (!sink->started) {
+        ndjson_module(out, doc);
+        sink->started = 1;
     }
+    OB_LIT(out, "{\"name\": \"");
+    ob_json(out, DSTR(doc, n->name), n->name.len);
+    OB_LIT(out, "\", \"type\": \"");
+    ob_str(out, node_type_names[n->type]);
+    ob_printf(out, "\", \"line\": %d, \"signature\": \"", n->line);
+    ob_json(out, DSTR(doc, n->signature), n->signature.len);
+    OB_LIT(out, "\", \"docstring\": \"");
+    ob_json(out, DSTR(doc, n->docstring), n->docstring.len);
+    if (n->condition.len) {
+        OB_LIT(out, "\", \"condition\": \"");
+        ob_json(out, DSTR(doc, n->condition), n->condition.len);
+    }
+    OB_LIT(out, "\"");
+    if (n->inactive) OB_LIT(out, ", \"inactive\": true");
+    OB_LIT(out, "}\n");
+}
 
-    safe_strcpy(doc->filepath, filename, MAX_LINE);
-    extract_module_name(filename, doc->module_name, MAX_NAME);
-
-    time_t now = time(NULL);
-    struct tm *tm_info = NULL;
-#ifdef _WIN32
-    tm_info = localtime(&now);
-#else
-    struct tm tm_buf;
-    tm_info = localtime_r(&now, &tm_buf);
-#endif
-    if (!tm_info) tm_info = localtime(&now);
-    if (tm_info) {
-        strftime(doc->timestamp, sizeof(doc->timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
-    } else {
-        safe_strcpy(doc->timestamp, "unknown", sizeof(doc->timestamp));
+/* A whole parsed document as NDJSON, as `-j -` would stream it */
+static void output_ndjson(DOCUNATION *doc, OutBuf *out) {
+    ndjson_module(out, doc);
+    for (int i = 0; i < doc->node_count; i++) {
+        NdjsonSink sink = { out, 1 };
+        ndjson_node(&sink, doc, &doc->nodes[i]);
     }
+}
 
+static int stream_json(int fd, FILE *out, const DefineSet *defines) {
+    DOCUNATION *doc = calloc(1, sizeof(DOCUNATION));
     Parser *parser = calloc(1, sizeof(Parser));
-    if (!parser) {
+    char *window = malloc(STREAM_CHUNK);
+    if (!doc || !parser || !window) {
         fprintf(stderr, "Error: Cannot allocate memory\n");
         free(doc);
-        fclose(fp);
-        return NULL;
+        free(parser);
+        free(window);
+        return -1;
     }
-    parser->fp = fp;
+    safe_strcpy(doc->filepath, "-", sizeof(doc->filepath));
+    safe_strcpy(doc->module_name, "stdin", sizeof(doc->module_name));
+    stamp_document(doc);
+    doc->src = window;
+    doc->src_moving = 1;
+    doc->defines = defines;
+
+    SourceStream stream = { fd, 0, STREAM_CHUNK, 0 };
+    OutBuf ob = { 0 };
+    ob_bind(&ob, out);
+    NdjsonSink sink = { &ob, 0 };
     parser->doc = doc;
+    parser->cur = parser->end = window;
+    parser->stream = &stream;
+    parser->sink = ndjson_node;
+    parser->sink_ctx = &sink;
     parse_file(parser);
-    fclose(fp);
+    if (!sink.started) ndjson_module(&ob, doc);
+
+    int rc = ob_finish(&ob);
+    ob_free(&ob);
+    if (rc != 0) fprintf(stderr, "Error: Cannot write output\n");
     free(parser);
-    return doc;
+    free_document(doc);
+    return rc;
 }
 
-static int write_outputs(DOCUNATION *doc, const char *txt_path,
-                         const char *json_path, const char *html_path) {
-    int prev_color = use_color;
+/* ═══════════════════════════════════════════════════════════════════════════
+ * LIBRARY API
+ *
+ * The interface declared in docunation.h. A dn_parser embeds the document,
+ * the parser state and an output buffer, and parsing resets them in place:
+ * the arena, node vector, section order and buffer all keep their capacity
+ * from one call to the next. Sources are parsed where the caller keeps
+ * them, exactly as a mapped file is.
+ * ═══════════════════════════════════════════════════════════════════════════ */
 
-    FILE *out = fopen(txt_path, "w");
-    if (!out) {
-        fprintf(stderr, "Error: Cannot write '%s'\n", txt_path);
-        return -1;
-    }
-    use_color = 0;
-    output_text(doc, out);
-    fclose(out);
-    use_color = prev_color;
+struct dn_parser {
+    DOCUNATION doc;
+    Parser parser;
+    OutBuf out;
+    DefineSet defines;   /* dn_define, dn_undefine, dn_skip_inactive */
+    int parsed;          /* doc holds a parse of the caller's source */
+};
 
-    out = fopen(json_path, "w");
-    if (!out) {
-        fprintf(stderr, "Error: Cannot write '%s'\n", json_path);
-        return -1;
-    }
-    output_json(doc, out);
-    fclose(out);
+const char *dn_version(void) {
+    return DOCUNATION_VERSION;
+}
 
-    out = fopen(html_path, "w");
-    if (!out) {
-        fprintf(stderr, "Error: Cannot write '%s'\n", html_path);
+dn_parser *dn_parser_create(void) {
+    dn_parser *p = calloc(1, sizeof(dn_parser));
+    if (!p) fprintf(stderr, "Error: Cannot allocate memory\n");
+    return p;
+}
+
+void dn_parser_reset(dn_parser *p) {
+    DOCUNATION *doc = &p->doc;
+    doc->src = NULL;     /* the caller's, never ours to free */
+    doc->src_len = 0;
+    doc->docstring = (Slice){ 0, 0, 0 };
+    doc->node_count = 0;
+    doc->arena.len = 0;
+    doc->truncated = 0;
+    p->out.len = 0;
+    p->parsed = 0;
+}
+
+void dn_parser_destroy(dn_parser *p) {
+    if (!p) return;
+    arena_free(&p->doc.arena);
+    free(p->doc.nodes);
+    free(p->doc.order);
+    free(p->doc.newlines);
+    ob_free(&p->out);
+    define_set_free(&p->defines);
+    free(p);
+}
+
+int dn_define(dn_parser *p, const char *def) {
+    return define_add(&p->defines, def, 1);
+}
+
+int dn_undefine(dn_parser *p, const char *name) {
+    return define_add(&p->defines, name, 0);
+}
+
+void dn_skip_inactive(dn_parser *p, int on) {
+    p->defines.skip_inactive = on != 0;
+}
+
+int dn_parse_buffer(dn_parser *p, const char *src, size_t len, const char *name) {
+    dn_parser_reset(p);
+    if (!src && len) return -1;
+    if (len > INT32_MAX) {
+        fprintf(stderr, "Error: '%s' is too large\n", name ? name : "buffer");
         return -1;
     }
-    output_html(doc, out);
-    fclose(out);
+    DOCUNATION *doc = &p->doc;
+    doc->src = src;
+    doc->src_len = len;
+    doc->defines = &p->defines;
+    if (!name) name = "buffer";
+    safe_strcpy(doc->filepath, name, MAX_LINE);
+    doc->truncated += strlen(name) >= MAX_LINE;
+    extract_module_name(name, doc->module_name, MAX_NAME);
+    stamp_document(doc);
+
+    Parser *parser = &p->parser;
+    memset(parser, 0, sizeof(*parser));
+    parser->cur = src;
+    parser->end = src + len;
+    parser->doc = doc;
+    parse_file(parser);
+    if (locate_nodes(doc) != 0 || index_sections(doc) != 0) return -1;
+    p->parsed = 1;
     return 0;
 }
 
-static int bulk_process_file(BulkContext *ctx, const char *filepath) {
-    const char *rel = filepath;
-    if (strncmp(filepath, ctx->root, ctx->root_len) == 0) {
-        rel += ctx->root_len;
-        if (*rel == '/' || *rel == '\\') rel++;
+int dn_node_count(const dn_parser *p) {
+    return p->parsed ? p->doc.node_count : 0;
+}
+
+/* Render into the context's buffer: 0=text, 1=json, 2=html, 3=binary */
+static const char *dn_render(dn_parser *p, size_t *len, int format, int color) {
+    if (!p->parsed) return NULL;
+    OutBuf *out = &p->out;
+    ob_bind(out, NULL);
+    switch (format) {
+        case 1: output_json(&p->doc, out); break;
+        case 2: output_html(&p->doc, out, NULL); break;
+        case 3:
+            if (bin_encode(&p->doc, fnv1a64(p->doc.src, p->doc.src_len), out) != 0) out->failed = 1;
+            break;
+        default: output_text(&p->doc, out, color); break;
     }
-    if (!*rel) rel = filepath;
+    if (ob_reserve(out, 1) != 0) return NULL;
+    out->data[out->len] = '\0';
+    if (len) *len = out->len;
+    return out->data;
+}
 
-    char safe[MAX_PATH_LEN];
-    sanitize_rel_path(rel, safe, sizeof(safe));
-    if (!safe[0]) safe_strcpy(safe, "file", sizeof(safe));
+const char *dn_render_json(dn_parser *p, size_t *len) {
+    return dn_render(p, len, 1, 0);
+}
 
-    char base[MAX_PATH_LEN];
-    safe_strcpy(base, safe, sizeof(base));
-    char *dot = strrchr(base, '.');
-    if (dot) *dot = '\0';
+const char *dn_render_html(dn_parser *p, size_t *len) {
+    return dn_render(p, len, 2, 0);
+}
 
-    char txt_path[MAX_PATH_LEN];
-    char json_path[MAX_PATH_LEN];
-    char html_path[MAX_PATH_LEN];
-    snprintf(txt_path, sizeof(txt_path), "%s/txt/%s.txt", ctx->out_dir, base);
-    snprintf(json_path, sizeof(json_path), "%s/json/%s.json", ctx->out_dir, base);
-    snprintf(html_path, sizeof(html_path), "%s/html/%s.html", ctx->out_dir, base);
+const char *dn_render_text(dn_parser *p, size_t *len, int color) {
+    return dn_render(p, len, 0, color);
+}
 
-    DOCUNATION *doc = parse_document(filepath);
-    if (!doc) return -1;
-    int rc = write_outputs(doc, txt_path, json_path, html_path);
-    free(doc);
-    if (rc != 0) {
-        fprintf(stderr, "Error: Failed documenting %s\n", filepath);
-        return -1;
-    }
+const char *dn_render_binary(dn_parser *p, size_t *len) {
+    return dn_render(p, len, 3, 0);
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * BENCHMARK
+ *
+ * --bench generates a synthetic corpus of a named shape and times the
+ * pipeline over it one phase at a time, on one thread, so that each phase
+ * is measured alone: discover walks the tree, parse loads and parses every
+ * file, render produces all three formats in memory, and write puts them
+ * on disk. A bulk run with --jobs follows for the end-to-end figure, where
+ * the phases overlap. Results are a table, or with -j one JSON object to
+ * keep and compare across versions.
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+typedef struct {
+    const char *name;
+    const char *about;
+    int files;           /* at scale 1 */
+    int per_dir;         /* files per directory */
+    int depth;           /* directories nest up to this deep */
+    int functions;       /* per file */
+    int macros;          /* per file */
+    int types;           /* per file */
+} BenchShape;
+
+static const BenchShape bench_shapes[] = {
+    { "small", "many small files", 2000, 50, 2, 12, 4, 2 },
+    { "huge", "a few huge files", 4, 4, 1, 20000, 2000, 1000 },
+    { "macro", "macro-heavy files", 400, 20, 2, 4, 200, 2 },
+    { "deep", "deeply nested directories", 1000, 2, 24, 8, 2, 1 },
+};
+
+#define BENCH_SHAPE_COUNT (sizeof(bench_shapes) / sizeof(bench_shapes[0]))
+
+typedef struct {
+    const char *name;
+    double seconds;
+    size_t files;
+    uint64_t bytes;      /* source read, or output produced */
+    long peak_rss_kb;    /* of the process so far */
+} BenchPhase;
+
+enum { BENCH_GENERATE, BENCH_DISCOVER, BENCH_PARSE, BENCH_RENDER, BENCH_WRITE, BENCH_BULK,
+       BENCH_PHASES };
+
+static const char *const bench_phase_names[] = {
+    "generate", "discover", "parse", "render", "write", "bulk"
+};
+
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t cap;
+    uint64_t bytes;
+} BenchFiles;
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static long bench_peak_rss(void) {
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0;
+}
 
-    fprintf(ctx->index,
-            "<tr><td>%s</td><td><a href=\"html/%s.html\">HTML</a></td><td><a href=\"txt/%s.txt\">Text</a></td><td><a href=\"json/%s.json\">JSON</a></td></tr>\n",
-            rel, base, base, base);
-    ctx->file_count++;
+static int bench_files_add(BenchFiles *l, const char *path, uint64_t size) {
+    if (l->count == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 256;
+        char **paths = realloc(l->paths, cap * sizeof(char *));
+        if (!paths) return -1;
+        l->paths = paths;
+        l->cap = cap;
+    }
+    if (!(l->paths[l->count] = strdup(path))) return -1;
+    l->count++;
+    l->bytes += size;
     return 0;
 }
 
-static void walk_directory(BulkContext *ctx, const char *dir_path) {
-    DIR *dir = opendir(dir_path);
-    if (!dir) {
-        fprintf(stderr, "Error: Cannot open directory '%s'\n", dir_path);
-        return;
+static void bench_files_free(BenchFiles *l) {
+    for (size_t i = 0; i < l->count; i++) free(l->paths[i]);
+    free(l->paths);
+    memset(l, 0, sizeof(*l));
+}
+
+/* Deterministic pseudo-random numbers, so every run sees the same corpus */
+static uint32_t bench_rand(uint64_t *state) {
+    *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+    return (uint32_t)(*state >> 33);
+}
+
+/* One synthetic source: documented macros, types, globals and functions
+ * with bodies of varying length */
+static void bench_source(OutBuf *ob, const BenchShape *shape, size_t file) {
+    uint64_t rng = file + 1;
+    ob_printf(ob, "/**\n * Synthetic module %zu (%s).\n */\n\n", file, shape->name);
+    OB_LIT(ob, "#include <stdio.h>\n#include <stdlib.h>\n");
+    ob_printf(ob, "#include \"bench_%zu.h\"\n\n", file);
+    for (int i = 0; i < shape->macros; i++) {
+        switch (bench_rand(&rng) % 3) {
+            case 0:
+                ob_printf(ob, "/* Limit %d */\n#define BENCH_%zu_LIMIT_%d %u\n", i, file, i,
+                          bench_rand(&rng) % 4096);
+                break;
+            case 1:
+                ob_printf(ob, "/* Combine two values */\n#define BENCH_%zu_MIX_%d(a, b) \\\n"
+                          "    (((a) << %u) ^ \\\n     ((b) >> %u))\n", file, i,
+                          bench_rand(&rng) % 16, bench_rand(&rng) % 16);
+                break;
+            default:
+                ob_printf(ob, "#ifndef BENCH_%zu_FLAG_%d\n/* Feature flag */\n"
+                          "#define BENCH_%zu_FLAG_%d 1\n#endif\n", file, i, file, i);
+                break;
+        }
     }
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+    OB_LIT(ob, "\n");
+    for (int i = 0; i < shape->types; i++) {
+        ob_printf(ob, "/* Record %d */\ntypedef struct bench_%zu_%d {\n    int id;\n"
+                  "    double weight;\n    char name[32];\n} bench_%zu_%d_t;\n\n",
+                  i, file, i, file, i);
+        ob_printf(ob, "/* States of record %d */\nenum bench_%zu_%d_state { B%zu_%d_IDLE, "
+                  "B%zu_%d_BUSY };\n\n", i, file, i, file, i, file, i);
+    }
+    ob_printf(ob, "/* Calls made so far */\nstatic int bench_%zu_calls = 0;\n\n", file);
+    for (int i = 0; i < shape->functions; i++) {
+        ob_printf(ob, "/**\n * Function %d of module %zu.\n * @param n  number of steps\n"
+                  " * @param s  input text\n */\n", i, file);
+        ob_printf(ob, "%sint bench_%zu_fn%d(int n, const char *s) {\n    int total = 0;\n",
+                  bench_rand(&rng) % 2 ? "static " : "", file, i);
+        unsigned lines = bench_rand(&rng) % 8;
+        for (unsigned k = 0; k < lines; k++) {
+            ob_printf(ob, "    for (int i = 0; i < n; i++) {\n        if (s[i] == '%c') "
+                      "{ total += i * %u; } else { total--; }\n    }\n",
+                      'a' + (int)(bench_rand(&rng) % 26), bench_rand(&rng) % 100);
+        }
+        ob_printf(ob, "    bench_%zu_calls++;\n    return total;\n}\n\n", file);
+    }
+}
+
+/* Write the corpus for shape under root; directory d holds per_dir files
+ * and sits d % depth levels below its top-level directory */
+static int bench_generate(const char *root, const BenchShape *shape, int scale, BenchFiles *out) {
+    if (ensure_dir(root) != 0) return -1;
+    size_t files = (size_t)shape->files * (size_t)scale;
+    OutBuf ob = { 0 };
+    int rc = 0;
+    for (size_t i = 0; i < files && rc == 0; i++) {
+        size_t d = i / (size_t)shape->per_dir;
         char path[MAX_PATH_LEN];
-        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
-        struct stat st;
-        if (stat(path, &st) != 0) continue;
-        if (S_ISDIR(st.st_mode)) {
-            walk_directory(ctx, path);
-        } else if (S_ISREG(st.st_mode) && ends_with(path, ".c")) {
-            bulk_process_file(ctx, path);
+        int n = snprintf(path, sizeof(path), "%s/t%zu", root, d / (size_t)shape->depth);
+        if (n >= (int)sizeof(path) - 32 || ensure_dir(path) != 0) rc = -1;
+        for (size_t level = 1; level <= d % (size_t)shape->depth && rc == 0; level++) {
+            n += snprintf(path + n, sizeof(path) - (size_t)n, "/s%zu", level);
+            if (n >= (int)sizeof(path) - 32 || ensure_dir(path) != 0) rc = -1;
         }
+        if (rc == 0) snprintf(path + n, sizeof(path) - (size_t)n, "/bench_%zu.c", i);
+        ob_bind(&ob, NULL);
+        bench_source(&ob, shape, i);
+        FILE *f = rc == 0 ? fopen(path, "w") : NULL;
+        if (rc == 0 && (!f || fwrite(ob.data, 1, ob.len, f) != ob.len || ob.failed)) rc = -1;
+        if (f && fclose(f) != 0) rc = -1;
+        if (rc != 0) fprintf(stderr, "Error: Cannot write '%s'\n", path);
+        else if (bench_files_add(out, path, ob.len) != 0) rc = -1;
     }
-    closedir(dir);
+    ob_free(&ob);
+    return rc;
 }
 
-static int process_directory(const char *root, const char *out_dir) {
-    struct stat st;
-    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) {
-        fprintf(stderr, "Error: '%s' is not a directory\n", root);
+/* The discover phase: every .c file below dir */
+static int bench_walk(const char *dir, BenchFiles *out) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "Error: Cannot open directory '%s'\n", dir);
         return -1;
     }
+    int rc = 0;
+    struct dirent *e;
+    while (rc == 0 && (e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) rc = bench_walk(path, out);
+        else if (ends_with(e->d_name, ".c")) rc = bench_files_add(out, path, (uint64_t)st.st_size);
+    }
+    closedir(d);
+    return rc;
+}
 
-    if (ensure_dir(out_dir) != 0) return -1;
+/* Remove a generated tree */
+static void bench_remove(const char *dir) {
+    DIR *d = opendir(dir);
+    if (d) {
+        struct dirent *e;
+        while ((e = readdir(d)) != NULL) {
+            if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+            char path[MAX_PATH_LEN];
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+            struct stat st;
+            if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) bench_remove(path);
+            else unlink(path);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
 
-    char txt_dir[MAX_PATH_LEN];
-    char json_dir[MAX_PATH_LEN];
-    char html_dir[MAX_PATH_LEN];
-    snprintf(txt_dir, sizeof(txt_dir), "%s/txt", out_dir);
-    snprintf(json_dir, sizeof(json_dir), "%s/json", out_dir);
-    snprintf(html_dir, sizeof(html_dir), "%s/html", out_dir);
-    if (ensure_dir(txt_dir) != 0) return -1;
-    if (ensure_dir(json_dir) != 0) return -1;
-    if (ensure_dir(html_dir) != 0) return -1;
+static void bench_phase(BenchPhase *p, int which, double start, size_t files, uint64_t bytes) {
+    p->name = bench_phase_names[which];
+    p->seconds = bench_now() - start;
+    p->files = files;
+    p->bytes = bytes;
+    p->peak_rss_kb = bench_peak_rss();
+}
 
-    char index_path[MAX_PATH_LEN];
-    snprintf(index_path, sizeof(index_path), "%s/index.html", out_dir);
-    FILE *index = fopen(index_path, "w");
-    if (!index) {
-        fprintf(stderr, "Error: Cannot write '%s'\n", index_path);
+/* Run every phase over one shape's corpus in work */
+static int bench_shape(const char *work, const BenchShape *shape, int scale, int jobs,
+                       BenchPhase phases[BENCH_PHASES]) {
+    char src[MAX_PATH_LEN];
+    char out[MAX_PATH_LEN];
+    char bulk_out[MAX_PATH_LEN];
+    if (snprintf(src, sizeof(src), "%s/%s", work, shape->name) >= (int)sizeof(src) ||
+        snprintf(out, sizeof(out), "%s/%s-out", work, shape->name) >= (int)sizeof(out) ||
+        snprintf(bulk_out, sizeof(bulk_out), "%s/%s-bulk", work, shape->name) >= (int)sizeof(bulk_out)) {
+        fprintf(stderr, "Error: Path too long under '%s'\n", work);
         return -1;
     }
-    fprintf(index, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>DOCUNATION Index</title></head><body>\n");
-    fprintf(index, "<h1>DOCUNATION Output</h1><p>Root: %s</p>\n", root);
-    fprintf(index, "<table border=1 cellspacing=0 cellpadding=4>\n");
-    fprintf(index, "<tr><th>Source</th><th>HTML</th><th>Text</th><th>JSON</th></tr>\n");
+    bench_remove(src);
+    bench_remove(out);
+    bench_remove(bulk_out);
 
-    BulkContext ctx = { root, strlen(root), out_dir, index, 0 };
-    walk_directory(&ctx, root);
+    BenchFiles generated = { 0 };
+    BenchFiles found = { 0 };
+    DOCUNATION **docs = NULL;
+    size_t *ends = NULL;
+    OutBuf rendered = { 0 };
+    int rc = 0;
 
-    fprintf(index, "</table>\n<p>Total files: %zu</p>\n</body></html>\n", ctx.file_count);
-    fclose(index);
-    return 0;
-}
+    double start = bench_now();
+    if (bench_generate(src, shape, scale, &generated) != 0) rc = -1;
+    bench_phase(&phases[BENCH_GENERATE], BENCH_GENERATE, start, generated.count, generated.bytes);
 
-/* ═══════════════════════════════════════════════════════════════════════════
- * OUTPUT FORMATTERS
- * ═══════════════════════════════════════════════════════════════════════════ */
+    start = bench_now();
+    if (rc == 0 && bench_walk(src, &found) != 0) rc = -1;
+    bench_phase(&phases[BENCH_DISCOVER], BENCH_DISCOVER, start, found.count, found.bytes);
 
-static void output_text(DOCUNATION *doc, FILE *out) {
-#define PTF(...) fprintf(out, __VA_ARGS__)
-#define PTC(ch) fputc((ch), out)
-    PTF("%s%s", C(COL_BOLD), C(COL_MAGENTA));
-    for (int i = 0; i < 70; i++) PTC('=');
-    PTF("%s\n", C(COL_RESET));
-    PTF("%sModule: %s%s\n", C(COL_BOLD), doc->module_name, C(COL_RESET));
-    PTF("File: %s\n", doc->filepath);
-    PTF("Generated: %s\n", doc->timestamp);
-    PTF("%s%s", C(COL_MAGENTA), C(COL_BOLD));
-    for (int i = 0; i < 70; i++) PTC('=');
-    PTF("%s\n", C(COL_RESET));
-
-    if (doc->docstring[0]) {
-        PTF("\n%sDESCRIPTION%s\n", C(COL_CYAN), C(COL_RESET));
-        PTF("    %s\n", doc->docstring);
-    }
-
-    PTF("\n%sINCLUDES%s\n", C(COL_BLUE), C(COL_RESET));
-    for (int i = 0; i < doc->node_count; i++) {
-        if (doc->nodes[i].type == NODE_INCLUDE) {
-            PTF("    %s%s%s\n", C(COL_GREEN), doc->nodes[i].name, C(COL_RESET));
-        }
+    size_t count = found.count;
+    docs = calloc(count + 1, sizeof(DOCUNATION *));
+    ends = calloc(count * 3 + 1, sizeof(size_t));
+    if (!docs || !ends) {
+        fprintf(stderr, "Error: Cannot allocate memory\n");
+        rc = -1;
     }
 
-    int has_macros = 0;
-    for (int i = 0; i < doc->node_count; i++) {
-        if (doc->nodes[i].type == NODE_MACRO) {
-            if (!has_macros) {
-                PTF("\n%sMACROS%s\n", C(COL_BLUE), C(COL_RESET));
-                has_macros = 1;
-            }
-            PTF("    %s%s%s\n", C(COL_GREEN), doc->nodes[i].name, C(COL_RESET));
-            if (doc->nodes[i].docstring[0]) {
-                PTF("        %s%s%s\n", C(COL_CYAN), doc->nodes[i].docstring, C(COL_RESET));
-            }
-        }
+    start = bench_now();
+    for (size_t i = 0; i < count && rc == 0; i++) {
+        docs[i] = load_document(found.paths[i]);
+        if (!docs[i] || parse_loaded(docs[i]) != 0) rc = -1;
     }
+    bench_phase(&phases[BENCH_PARSE], BENCH_PARSE, start, count, found.bytes);
 
-    int has_vars = 0;
-    for (int i = 0; i < doc->node_count; i++) {
-        if (doc->nodes[i].type == NODE_VARIABLE) {
-            if (!has_vars) {
-                PTF("\n%sDATA%s\n", C(COL_BLUE), C(COL_RESET));
-                has_vars = 1;
-            }
-            DocNode *n = &doc->nodes[i];
-            PTF("    %s%s%s", C(COL_GREEN), n->name, C(COL_RESET));
-            if (n->is_static) PTF(" [static]");
-            PTF("\n");
-            PTF("        %s\n", n->signature);
-            if (n->docstring[0]) {
-                PTF("        %s%s%s\n", C(COL_CYAN), n->docstring, C(COL_RESET));
-            }
-        }
+    /* Every output goes into one buffer; ends[] marks where each stops */
+    start = bench_now();
+    ob_bind(&rendered, NULL);
+    for (size_t i = 0; i < count && rc == 0; i++) {
+        output_text(docs[i], &rendered, 0);
+        ends[i * 3] = rendered.len;
+        output_json(docs[i], &rendered);
+        ends[i * 3 + 1] = rendered.len;
+        output_html(docs[i], &rendered, NULL);
+        ends[i * 3 + 2] = rendered.len;
     }
-
-    int has_types = 0;
-    for (int i = 0; i < doc->node_count; i++) {
-        if (doc->nodes[i].type == NODE_TYPEDEF ||
-            doc->nodes[i].type == NODE_STRUCT ||
-            doc->nodes[i].type == NODE_UNION ||
-            doc->nodes[i].type == NODE_ENUM) {
-            if (!has_types) {
-                PTF("\n%sTYPES%s\n", C(COL_BLUE), C(COL_RESET));
-                has_types = 1;
-            }
-            PTF("    %s%s%s (%s)\n", C(COL_GREEN), doc->nodes[i].name, C(COL_RESET),
-                node_type_names[doc->nodes[i].type]);
-            if (doc->nodes[i].docstring[0]) {
-                PTF("        %s%s%s\n", C(COL_CYAN), doc->nodes[i].docstring, C(COL_RESET));
-            }
-        }
+    if (rendered.failed) rc = -1;
+    bench_phase(&phases[BENCH_RENDER], BENCH_RENDER, start, count, rendered.len);
+    for (size_t i = 0; i < count; i++) {
+        if (docs[i]) free_document(docs[i]);
     }
 
-    int has_funcs = 0;
-    for (int i = 0; i < doc->node_count; i++) {
-        if (doc->nodes[i].type == NODE_FUNCTION) {
-            if (!has_funcs) {
-                PTF("\n%sFUNCTIONS%s\n", C(COL_BLUE), C(COL_RESET));
-                has_funcs = 1;
-            }
-            DocNode *n = &doc->nodes[i];
-            PTF("    %s%s%s", C(COL_GREEN), n->name, C(COL_RESET));
-            if (n->is_static) PTF(" [static]");
-            if (n->is_inline) PTF(" [inline]");
-            if (n->is_extern) PTF(" [extern]");
-            PTF("\n");
-            PTF("        %s\n", n->signature);
-            if (n->docstring[0]) {
-                PTF("        %s%s%s\n", C(COL_CYAN), n->docstring, C(COL_RESET));
-            }
-        }
+    start = bench_now();
+    char dirs[3][MAX_PATH_LEN];
+    if (rc == 0 && ensure_dir(out) != 0) rc = -1;
+    for (int k = 0; k < 3; k++) {
+        if (snprintf(dirs[k], sizeof(dirs[k]), "%s/%s", out, format_exts[k]) >= (int)sizeof(dirs[k]) ||
+            (rc == 0 && ensure_dir(dirs[k]) != 0)) rc = -1;
+    }
+    for (size_t i = 0; i < count * 3 && rc == 0; i++) {
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "%s/f%zu.%s", dirs[i % 3], i / 3, format_exts[i % 3]);
+        size_t begin = i ? ends[i - 1] : 0;
+        FILE *f = fopen(path, "w");
+        if (!f || fwrite(rendered.data + begin, 1, ends[i] - begin, f) != ends[i] - begin) rc = -1;
+        if (f && fclose(f) != 0) rc = -1;
+        if (rc != 0) fprintf(stderr, "Error: Cannot write '%s'\n", path);
     }
+    bench_phase(&phases[BENCH_WRITE], BENCH_WRITE, start, count, rendered.len);
+    ob_free(&rendered);
+    free(docs);
+    free(ends);
 
-    PTF("\n%s%s", C(COL_MAGENTA), C(COL_BOLD));
-    for (int i = 0; i < 70; i++) PTC('=');
-    PTF("%s\n", C(COL_RESET));
-#undef PTF
-#undef PTC
-}
+    BulkOptions opts = { 0 };
+    opts.jobs = jobs;
+    opts.formats = FORMAT_DEFAULT;
+    start = bench_now();
+    if (rc == 0 && process_directory(src, bulk_out, &opts) != 0) rc = -1;
+    bench_phase(&phases[BENCH_BULK], BENCH_BULK, start, count, found.bytes);
 
-static void output_json(DOCUNATION *doc, FILE *out) {
-    fprintf(out, "{\n");
-    fprintf(out, "  \"filepath\": \"%s\",\n", doc->filepath);
-    fprintf(out, "  \"module_name\": \"%s\",\n", doc->module_name);
-    fprintf(out, "  \"timestamp\": \"%s\",\n", doc->timestamp);
+    bench_files_free(&generated);
+    bench_files_free(&found);
+    return rc;
+}
 
-    fprintf(out, "  \"docstring\": \"");
-    for (char *p = doc->docstring; *p; p++) {
-        if (*p == '"') fprintf(out, "\\\"");
-        else if (*p == '\n') fprintf(out, "\\n");
-        else if (*p == '\\') fprintf(out, "\\\\");
-        else fputc(*p, out);
+static void bench_report_text(const BenchShape *shape, int scale, int jobs,
+                              const BenchPhase phases[BENCH_PHASES]) {
+    printf("%s: %s, scale %d, %zu files, %.1f MB\n", shape->name, shape->about, scale,
+           phases[BENCH_GENERATE].files, (double)phases[BENCH_GENERATE].bytes / 1e6);
+    printf("  %-9s %10s %12s %10s %12s\n", "phase", "seconds", "files/s", "MB/s", "peak RSS KB");
+    for (int p = BENCH_DISCOVER; p < BENCH_PHASES; p++) {
+        const BenchPhase *ph = &phases[p];
+        double secs = ph->seconds > 0 ? ph->seconds : 1e-9;
+        printf("  %-9s %10.4f %12.0f %10.1f %12ld%s\n", ph->name, ph->seconds,
+               (double)ph->files / secs, (double)ph->bytes / 1e6 / secs, ph->peak_rss_kb,
+               p == BENCH_BULK && jobs > 1 ? " (parallel)" : "");
     }
-    fprintf(out, "\",\n");
+}
 
-    fprintf(out, "  \"nodes\": [\n");
-    for (int i = 0; i < doc->node_count; i++) {
-        DocNode *n = &doc->nodes[i];
-        fprintf(out, "    {\n");
-        fprintf(out, "      \"name\": \"%s\",\n", n->name);
-        fprintf(out, "      \"type\": \"%s\",\n", node_type_names[n->type]);
-        fprintf(out, "      \"line\": %d,\n", n->line);
-        fprintf(out, "      \"signature\": \"");
-        for (char *p = n->signature; *p; p++) {
-            if (*p == '"') fprintf(out, "\\\"");
-            else if (*p == '\n') fprintf(out, "\\n");
-            else if (*p == '\\') fprintf(out, "\\\\");
-            else fputc(*p, out);
-        }
-        fprintf(out, "\",\n");
-        fprintf(out, "      \"docstring\": \"");
-        for (char *p = n->docstring; *p; p++) {
-            if (*p == '"') fprintf(out, "\\\"");
-            else if (*p == '\n') fprintf(out, "\\n");
-            else if (*p == '\\') fprintf(out, "\\\\");
-            else fputc(*p, out);
-        }
-        fprintf(out, "    }%s\n", i < doc->node_count-1 ? "," : "");
-    }
-    fprintf(out, "  ]\n");
-    fprintf(out, "}\n");
-}
-
-static void output_html(DOCUNATION *doc, FILE *out) {
-    fprintf(out, "<!DOCTYPE html>\n<html>\n<head>\n");
-    fprintf(out, "<meta charset=\"UTF-8\">\n<title>%s</title>\n", doc->module_name);
-    fprintf(out, "</head>\n<body bgcolor=\"#f0f0f0\">\n");
-
-    fprintf(out, "<table width=\"100%%\" cellspacing=0 cellpadding=2 border=0>\n");
-    fprintf(out, "<tr bgcolor=\"#7799ee\"><td>&nbsp;</td>\n");
-    fprintf(out, "<td><font face=\"helvetica, arial\" size=\"+1\"><strong>%s</strong></font></td></tr></table>\n",
-            doc->module_name);
-    fprintf(out, "<p><tt>%s</tt></p>\n", doc->filepath);
-
-    if (doc->docstring[0]) {
-        fprintf(out, "<p><table width=\"100%%\" cellspacing=0 cellpadding=2 border=0>\n");
-        fprintf(out, "<tr bgcolor=\"#eeaa77\"><td>&nbsp;</td>\n");
-        fprintf(out, "<td><strong>Description</strong></td></tr></table>\n");
-        fprintf(out, "<pre>%s</pre>\n", doc->docstring);
-    }
-
-    int has_includes = 0;
-    for (int i = 0; i < doc->node_count; i++) {
-        if (doc->nodes[i].type == NODE_INCLUDE) {
-            if (!has_includes) {
-                fprintf(out, "<p><table width=\"100%%\" cellspacing=0 cellpadding=2 border=0>\n");
-                fprintf(out, "<tr bgcolor=\"#aa55cc\"><td>&nbsp;</td>\n");
-                fprintf(out, "<td><strong>Includes</strong></td></tr></table>\n");
-                fprintf(out, "<dl>\n");
-                has_includes = 1;
-            }
-            fprintf(out, "<dt><tt>%s</tt></dt>\n", doc->nodes[i].signature);
-        }
+static void bench_report_json(OutBuf *ob, const BenchShape *shape, const BenchPhase phases[BENCH_PHASES]) {
+    ob_printf(ob, "    {\"shape\": \"%s\", \"files\": %zu, \"bytes\": %llu, \"phases\": [\n",
+              shape->name, phases[BENCH_GENERATE].files,
+              (unsigned long long)phases[BENCH_GENERATE].bytes);
+    for (int p = BENCH_DISCOVER; p < BENCH_PHASES; p++) {
+        const BenchPhase *ph = &phases[p];
+        double secs = ph->seconds > 0 ? ph->seconds : 1e-9;
+        ob_printf(ob, "      {\"phase\": \"%s\", \"seconds\": %.6f, \"files\": %zu, \"bytes\": %llu, "
+                  "\"files_per_s\": %.1f, \"mb_per_s\": %.3f, \"peak_rss_kb\": %ld}%s\n",
+                  ph->name, ph->seconds, ph->files, (unsigned long long)ph->bytes,
+                  (double)ph->files / secs, (double)ph->bytes / 1e6 / secs, ph->peak_rss_kb,
+                  p + 1 < BENCH_PHASES ? "," : "");
     }
-    if (has_includes) fprintf(out, "</dl>\n");
+    OB_LIT(ob, "    ]}");
+}
 
-    int has_macros = 0;
-    for (int i = 0; i < doc->node_count; i++) {
-        DocNode *n = &doc->nodes[i];
-        if (n->type == NODE_MACRO) {
-            if (!has_macros) {
-                fprintf(out, "<p><table width=\"100%%\" cellspacing=0 cellpadding=2 border=0>\n");
-                fprintf(out, "<tr bgcolor=\"#aa55cc\"><td>&nbsp;</td>\n");
-                fprintf(out, "<td><strong>Macros</strong></td></tr></table>\n");
-                fprintf(out, "<dl>\n");
-                has_macros = 1;
-            }
-            fprintf(out, "<dt><a name=\"%s\"><strong>%s</strong></a></dt>\n", n->name, n->name);
-            fprintf(out, "<dd><tt>%s</tt></dd>\n", n->signature);
-            if (n->docstring[0]) fprintf(out, "<dd>%s</dd>\n", n->docstring);
+/* Benchmark one shape, or every shape for "all"; the corpus is generated
+ * under dir, or a temporary directory removed afterwards */
+static int run_bench(const char *which, int scale, int jobs, const char *dir, int json) {
+    const BenchShape *only = NULL;
+    if (strcmp(which, "all") != 0) {
+        for (size_t i = 0; i < BENCH_SHAPE_COUNT; i++) {
+            if (strcmp(which, bench_shapes[i].name) == 0) only = &bench_shapes[i];
         }
-    }
-    if (has_macros) fprintf(out, "</dl>\n");
-
-    int has_vars = 0;
-    for (int i = 0; i < doc->node_count; i++) {
-        DocNode *n = &doc->nodes[i];
-        if (n->type == NODE_VARIABLE) {
-            if (!has_vars) {
-                fprintf(out, "<p><table width=\"100%%\" cellspacing=0 cellpadding=2 border=0>\n");
-                fprintf(out, "<tr bgcolor=\"#aa55cc\"><td>&nbsp;</td>\n");
-                fprintf(out, "<td><strong>Data</strong></td></tr></table>\n");
-                fprintf(out, "<dl>\n");
-                has_vars = 1;
-            }
-            fprintf(out, "<dt><a name=\"%s\"><strong>%s</strong></a></dt>\n", n->name, n->name);
-            fprintf(out, "<dd><tt>%s</tt></dd>\n", n->signature);
-            if (n->docstring[0]) fprintf(out, "<dd>%s</dd>\n", n->docstring);
+        if (!only) {
+            fprintf(stderr, "Error: Unknown benchmark shape '%s'\n", which);
+            return -1;
         }
     }
-    if (has_vars) fprintf(out, "</dl>\n");
+    if (scale < 1) scale = 1;
 
-    int has_types = 0;
-    for (int i = 0; i < doc->node_count; i++) {
-        DocNode *n = &doc->nodes[i];
-        if (n->type == NODE_TYPEDEF || n->type == NODE_STRUCT ||
-            n->type == NODE_UNION || n->type == NODE_ENUM) {
-            if (!has_types) {
-                fprintf(out, "<p><table width=\"100%%\" cellspacing=0 cellpadding=2 border=0>\n");
-                fprintf(out, "<tr bgcolor=\"#aa55cc\"><td>&nbsp;</td>\n");
-                fprintf(out, "<td><strong>Types</strong></td></tr></table>\n");
-                fprintf(out, "<dl>\n");
-                has_types = 1;
-            }
-            fprintf(out, "<dt><a name=\"%s\"><strong>%s</strong></a> (%s)</dt>\n",
-                    n->name, n->name, node_type_names[n->type]);
-            fprintf(out, "<dd><tt>%s</tt></dd>\n", n->signature);
-            if (n->docstring[0]) fprintf(out, "<dd>%s</dd>\n", n->docstring);
+    char work[MAX_PATH_LEN];
+    if (dir && strlen(dir) > MAX_PATH_LEN / 2) {
+        fprintf(stderr, "Error: Path too long '%s'\n", dir);
+        return -1;
+    }
+    if (dir) {
+        safe_strcpy(work, dir, sizeof(work));
+        if (ensure_dir(work) != 0) return -1;
+    } else {
+        const char *tmp = getenv("TMPDIR");
+        snprintf(work, sizeof(work), "%s/docunation-bench-XXXXXX", tmp && *tmp ? tmp : "/tmp");
+        if (!mkdtemp(work)) {
+            fprintf(stderr, "Error: Cannot create '%s': %s\n", work, strerror(errno));
+            return -1;
         }
     }
-    if (has_types) fprintf(out, "</dl>\n");
 
-    int has_funcs = 0;
-    for (int i = 0; i < doc->node_count; i++) {
-        DocNode *n = &doc->nodes[i];
-        if (n->type == NODE_FUNCTION) {
-            if (!has_funcs) {
-                fprintf(out, "<p><table width=\"100%%\" cellspacing=0 cellpadding=2 border=0>\n");
-                fprintf(out, "<tr bgcolor=\"#aa55cc\"><td>&nbsp;</td>\n");
-                fprintf(out, "<td><strong>Functions</strong></td></tr></table>\n");
-                fprintf(out, "<dl>\n");
-                has_funcs = 1;
-            }
-            fprintf(out, "<dt><a name=\"%s\"><strong>%s</strong></a>(", n->name, n->name);
-            char *paren = strchr(n->signature, '(');
-            if (paren) {
-                char *end = strrchr(n->signature, ')');
-                if (end) {
-                    int len = end - paren - 1;
-                    if (len > 0) fprintf(out, "%.*s", len, paren + 1);
-                }
-            }
-            fprintf(out, ")</dt>\n");
-            fprintf(out, "<dd><tt>%s</tt></dd>\n", n->signature);
-            if (n->docstring[0]) fprintf(out, "<dd>%s</dd>\n", n->docstring);
+    OutBuf ob = { 0 };
+    if (json) {
+        ob_bind(&ob, stdout);
+        ob_printf(&ob, "{\n  \"version\": \"%s\",\n  \"scale\": %d,\n  \"jobs\": %d,\n"
+                  "  \"results\": [\n", DOCUNATION_VERSION, scale, jobs);
+    }
+    int rc = 0;
+    int first = 1;
+    for (size_t i = 0; i < BENCH_SHAPE_COUNT && rc == 0; i++) {
+        const BenchShape *shape = &bench_shapes[i];
+        if (only && only != shape) continue;
+        BenchPhase phases[BENCH_PHASES] = { { 0 } };
+        if (bench_shape(work, shape, scale, jobs, phases) != 0) {
+            rc = -1;
+            break;
+        }
+        if (json) {
+            if (!first) OB_LIT(&ob, ",\n");
+            bench_report_json(&ob, shape, phases);
+        } else {
+            bench_report_text(shape, scale, jobs, phases);
+            fflush(stdout);
         }
+        first = 0;
     }
-    if (has_funcs) fprintf(out, "</dl>\n");
-
-    fprintf(out, "<hr>\n<p><small>Generated by DOCUNATION.C - Ring 1</small></p>\n");
-    fprintf(out, "</body>\n</html>\n");
+    if (json) {
+        OB_LIT(&ob, "\n  ]\n}\n");
+        if (ob_finish(&ob) != 0) rc = -1;
+    }
+    ob_free(&ob);
+    if (!dir) bench_remove(work);
+    return rc;
 }
 
-
 /* ═══════════════════════════════════════════════════════════════════════════
  * MAIN
  * ═══════════════════════════════════════════════════════════════════════════ */
 
+#ifndef DOCUNATION_LIBRARY
+
 static void print_usage(const char *prog) {
     printf("DOCUNATION %s - Documentation Generator for C\n\n", DOCUNATION_VERSION);
-    printf("Usage: %s [options] <file.c>\n", prog);
+    printf("Usage: %s [options] <file.c | ->\n", prog);
     printf("       %s -R <root> -O <output>\n\n", prog);
     printf("Options:\n");
     printf("  -j          Output JSON format\n");
     printf("  -h          Output HTML format\n");
+    printf("  -b          Output the binary document format\n");
     printf("  -n          No color output\n");
     printf("  -R <dir>    Recursively document .c files under <dir>\n");
     printf("  -O <dir>    Output directory for bulk mode\n");
+    printf("  --jobs <n>  Parallel workers for bulk mode (0 = one per CPU)\n");
+    printf("  --incremental  Regenerate only sources changed since the last run\n");
+    printf("  --diff <old>       With -R: print the symbols added, removed or changed since the\n");
+    printf("                     run whose output directory, manifest or pack is <old>\n");
+    printf("  --max-mem <size>   Bulk mode: keep memory in flight under <size>, e.g. 512M or 2G\n");
+    printf("  --cache-dir <dir>  Reuse parses of identical sources across runs\n");
+    printf("  --include <glob>   Bulk mode: document only matching files (repeatable)\n");
+    printf("  --exclude <glob>   Bulk mode: skip matching files and directories (repeatable)\n");
+    printf("  --ext <list>       Bulk mode: source extensions, e.g. c,h (default c)\n");
+    printf("  --formats <list>   Bulk mode: per-file outputs, any of txt,json,html,bin (default txt,json,html)\n");
+    printf("  --single-json      Bulk mode: write every source into one %s\n", CORPUS_NAME);
+    printf("  --pack             Bulk mode: write outputs into one %s with a sorted index\n", PACK_NAME);
+    printf("  --pack-get <dir> <name>  Print an entry of the pack in <dir>, e.g. json/main.json\n");
+    printf("  --link             Bulk mode: link HTML signatures to symbols in other files\n");
+    printf("  --search           Bulk mode: add a symbol search to index.html (read over HTTP)\n");
+    printf("  --merge            Bulk mode: list each function once with its declarations in %s\n",
+           MERGE_NAME);
+    printf("  --watch            Bulk mode: stay running and update outputs as sources change\n");
+    printf("  --stats            Bulk mode: report time per phase and thread, slowest files\n");
+    printf("  --stats-json <file>  Bulk mode: write that report as JSON\n");
+    printf("  --bench <shape>    Time each phase on a generated corpus: small, huge, macro,\n");
+    printf("                     deep or all (-j for JSON; --scale <n> multiplies the files;\n");
+    printf("                     --bench-dir <dir> keeps the corpus there)\n");
+    printf("  -D <name>[=<v>]    Treat <name> as defined (as <v>, default 1) in #if\n");
+    printf("  -U <name>          Treat <name> as undefined in #if\n");
+    printf("  --skip-inactive    Leave out code that -D/-U rule out instead of marking it\n");
     printf("  -v          Show version\n");
     printf("  --help      Show this help\n\n");
     printf("Examples:\n");
     printf("  %s myfile.c           # Document a C file\n", prog);
     printf("  %s -j myfile.c        # Output JSON\n", prog);
     printf("  %s -h myfile.c > doc.html  # Output HTML\n", prog);
+    printf("  %s -j - < big.c       # Stream NDJSON, one node per line\n", prog);
     printf("  %s -R src -O docs     # Document an entire tree\n", prog);
+    printf("  %s -R src -O docs --jobs 0  # ...using every CPU\n", prog);
+    printf("  %s -R src -O docs --incremental  # ...redoing only what changed\n", prog);
+    printf("  %s -R src -O docs --watch        # ...and again on every save\n", prog);
+    printf("  %s -R . -O docs --ext c,h --exclude 'build/' --exclude third_party/\n", prog);
+    printf("  %s -R src -O docs --formats json  # JSON only\n", prog);
+    printf("  %s -R src --diff release-docs > changes.json  # API changes since then\n", prog);
+    printf("  %s -R src -O docs --single-json   # One NDJSON file for the tree\n", prog);
+    printf("  %s -DNDEBUG -U_WIN32 --skip-inactive file.c  # One configuration\n", prog);
+    printf("  %s --bench all -j --jobs 0 > bench.json  # Benchmark every shape\n", prog);
 }
 
 int main(int argc, char **argv) {
     char *filename = NULL;
-    int format = 0;  /* 0=text, 1=json, 2=html */
+    int format = 0;  /* 0=text, 1=json, 2=html, 3=binary */
     const char *bulk_root = NULL;
     const char *bulk_out = NULL;
+    int use_color = 1;
+    BulkOptions bulk = { 0 };
+    bulk.jobs = 1;
+    int formats_given = 0;
+    const char *bench = NULL;
+    const char *bench_dir = NULL;
+    int bench_scale = 1;
+    int watch = 0;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-j") == 0) {
             format = 1;
         } else if (strcmp(argv[i], "-h") == 0) {
             format = 2;
+        } else if (strcmp(argv[i], "-b") == 0) {
+            format = 3;
         } else if (strcmp(argv[i], "-n") == 0) {
             use_color = 0;
         } else if (strcmp(argv[i], "-v") == 0) {
@@ -1280,20 +8979,106 @@ int main(int argc, char **argv) {
             if (i + 1 < argc) bulk_root = argv[++i];
         } else if (strcmp(argv[i], "-O") == 0) {
             if (i + 1 < argc) bulk_out = argv[++i];
+        } else if (strcmp(argv[i], "--jobs") == 0) {
+            if (i + 1 < argc) bulk.jobs = atoi(argv[++i]);
+            if (bulk.jobs <= 0) {
+                long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+                bulk.jobs = ncpu > 0 ? (int)ncpu : 1;
+            }
+        } else if (strcmp(argv[i], "--incremental") == 0) {
+            bulk.incremental = 1;
+        } else if (strcmp(argv[i], "--diff") == 0) {
+            if (i + 1 < argc) bulk.diff = argv[++i];
+        } else if (strcmp(argv[i], "--max-mem") == 0) {
+            if (i + 1 < argc && parse_size(argv[++i], &bulk.max_mem) != 0) return 1;
+        } else if (strcmp(argv[i], "--cache-dir") == 0) {
+            if (i + 1 < argc) bulk.cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--include") == 0 || strcmp(argv[i], "--exclude") == 0) {
+            GlobSet *set = argv[i][2] == 'i' ? &bulk.include : &bulk.exclude;
+            if (i + 1 < argc && globset_add(set, argv[++i]) != 0) return 1;
+        } else if (strcmp(argv[i], "--formats") == 0) {
+            if (i + 1 < argc && parse_formats(argv[++i], &bulk.formats) != 0) return 1;
+            formats_given = 1;
+        } else if (strcmp(argv[i], "--single-json") == 0) {
+            bulk.single_json = 1;
+        } else if (strcmp(argv[i], "--pack") == 0) {
+            bulk.pack = 1;
+        } else if (strcmp(argv[i], "--link") == 0) {
+            bulk.link = 1;
+        } else if (strcmp(argv[i], "--search") == 0) {
+            bulk.search = 1;
+        } else if (strcmp(argv[i], "--merge") == 0) {
+            bulk.merge = 1;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watch = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            bulk.stats = 1;
+        } else if (strcmp(argv[i], "--stats-json") == 0) {
+            if (i + 1 < argc) bulk.stats_json = argv[++i];
+        } else if (strcmp(argv[i], "--pack-get") == 0) {
+            if (i + 2 >= argc) {
+                fprintf(stderr, "Error: --pack-get needs <dir> and <name>\n");
+                return 1;
+            }
+            return pack_get(argv[i + 1], argv[i + 2], stdout) == 0 ? 0 : 1;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            if (i + 1 < argc) bench = argv[++i];
+        } else if (strcmp(argv[i], "--scale") == 0) {
+            if (i + 1 < argc) bench_scale = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-dir") == 0) {
+            if (i + 1 < argc) bench_dir = argv[++i];
+        } else if (strcmp(argv[i], "--ext") == 0) {
+            if (i + 1 < argc && add_extensions(&bulk, argv[++i]) != 0) return 1;
+        } else if (strncmp(argv[i], "-D", 2) == 0 || strncmp(argv[i], "-U", 2) == 0) {
+            int defined = argv[i][1] == 'D';
+            const char *arg = argv[i][2] ? argv[i] + 2 : i + 1 < argc ? argv[++i] : "";
+            if (define_add(&bulk.defines, arg, defined) != 0) return 1;
+        } else if (strcmp(argv[i], "--skip-inactive") == 0) {
+            bulk.defines.skip_inactive = 1;
         } else if (strcmp(argv[i], "--help") == 0) {
             print_usage(argv[0]);
             return 0;
-        } else if (argv[i][0] != '-') {
+        } else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0) {
             filename = argv[i];
         }
     }
 
+    if (bench) {
+        int rc = run_bench(bench, bench_scale, bulk.jobs, bench_dir, format == 1);
+        bulk_options_free(&bulk);
+        return rc == 0 ? 0 : 1;
+    }
+
+    /* Below this the render buffers alone would overrun the budget */
+    uint64_t min_mem = (uint64_t)bulk.jobs * BUDGET_MIN_BUFFER * 8;
+    if (bulk_root && bulk.max_mem && bulk.max_mem < min_mem) {
+        fprintf(stderr, "Error: --max-mem must be at least %lluK with %d jobs\n",
+                (unsigned long long)(min_mem >> 10), bulk.jobs);
+        bulk_options_free(&bulk);
+        return 1;
+    }
+
+    if (bulk_root && bulk.diff) {
+        int rc = diff_directory(bulk_root, bulk.diff, &bulk);
+        bulk_options_free(&bulk);
+        return rc == 0 ? 0 : 1;
+    }
+
     if (bulk_root) {
         if (!bulk_out) {
             fprintf(stderr, "Error: -O <output_dir> required with -R\n");
             return 1;
         }
-        return process_directory(bulk_root, bulk_out) == 0 ? 0 : 1;
+        /* The corpus replaces the per-file outputs unless both were asked for */
+        if (!formats_given) bulk.formats = bulk.single_json ? 0 : FORMAT_DEFAULT;
+        if (!bulk.formats && !bulk.single_json && !bulk.merge) {
+            fprintf(stderr, "Error: No output formats selected\n");
+            return 1;
+        }
+        int rc = watch ? watch_directory(bulk_root, bulk_out, &bulk)
+                       : process_directory(bulk_root, bulk_out, &bulk);
+        bulk_options_free(&bulk);
+        return rc == 0 ? 0 : 1;
     }
 
     if (!filename) {
@@ -1301,17 +9086,48 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    DOCUNATION *doc = parse_document(filename);
+    /* JSON from a pipe goes out node by node in constant memory */
+    if (format == 1 && strcmp(filename, "-") == 0) {
+        int rc = stream_json(STDIN_FILENO, stdout, &bulk.defines);
+        bulk_options_free(&bulk);
+        return rc == 0 ? 0 : 1;
+    }
+
+    DOCUNATION *doc = load_document(filename);
     if (!doc) {
+        bulk_options_free(&bulk);
+        return 1;
+    }
+    doc->defines = &bulk.defines;
+    /* Binary documents record the hash the cache is keyed by */
+    uint64_t hash = bulk.cache_dir || format == 3 ? fnv1a64(doc->src, doc->src_len) : 0;
+    int parsed = -1;
+    if (!bulk.cache_dir) parsed = parse_loaded(doc);
+    else if (ensure_dir(bulk.cache_dir) == 0) parsed = parse_cached(bulk.cache_dir, doc, hash);
+    if (parsed != 0) {
+        free_document(doc);
+        bulk_options_free(&bulk);
         return 1;
     }
 
+    OutBuf out = { 0 };
+    ob_bind(&out, stdout);
     switch (format) {
-        case 1: output_json(doc, stdout); break;
-        case 2: output_html(doc, stdout); break;
-        default: output_text(doc, stdout); break;
+        case 1: output_json(doc, &out); break;
+        case 2: output_html(doc, &out, NULL); break;
+        case 3: if (bin_encode(doc, hash, &out) != 0) out.failed = 1; break;
+        default: output_text(doc, &out, use_color); break;
     }
+    int rc = ob_finish(&out);
+    ob_free(&out);
 
-    free(doc);
+    free_document(doc);
+    bulk_options_free(&bulk);
+    if (rc != 0) {
+        fprintf(stderr, "Error: Cannot write output\n");
+        return 1;
+    }
     return 0;
 }
+
+#endif /* DOCUNATION_LIBRARY */
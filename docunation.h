@@ -0,0 +1,79 @@
+/**
+ * DOCUNATION.H - Embedding interface to the DOCUNATION parser
+ *
+ * Build docunation.c with -DDOCUNATION_LIBRARY to leave out main() and the
+ * command line, then link the object statically or into a shared library.
+ *
+ * A dn_parser owns one document's arena, node vector and output buffer.
+ * Parsing resets it and reuses that memory, so a long-lived parser stops
+ * allocating once it has seen its largest input. A parser is not shared:
+ * give each thread its own.
+ *
+ *     dn_parser *p = dn_parser_create();
+ *     if (dn_parse_buffer(p, src, len, "foo.c") == 0) {
+ *         size_t n;
+ *         const char *json = dn_render_json(p, &n);
+ *         ...
+ *     }
+ *     dn_parser_destroy(p);
+ *
+ * (c) 2026 Triple A Family Holdings LLC
+ */
+
+#ifndef DOCUNATION_H
+#define DOCUNATION_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct dn_parser dn_parser;
+
+/* Version of the parser and its output formats */
+const char *dn_version(void);
+
+/* New parser context; returns NULL when out of memory */
+dn_parser *dn_parser_create(void);
+
+void dn_parser_destroy(dn_parser *p);
+
+/* Drop the current document but keep its memory for the next parse */
+void dn_parser_reset(dn_parser *p);
+
+/* Settings for #if evaluation, kept across parses: def is NAME or
+ * NAME=VALUE as with -D, name as with -U. Names given neither way are
+ * unknown, and conditions on them stay open. Returns 0, or -1 on a bad name
+ * or when out of memory. */
+int dn_define(dn_parser *p, const char *def);
+int dn_undefine(dn_parser *p, const char *name);
+
+/* Leave out code the definitions rule out instead of marking it inactive */
+void dn_skip_inactive(dn_parser *p, int on);
+
+/* Parse len bytes of C source. name is reported as the file path and gives
+ * the module name; NULL means "buffer". The source is parsed in place and
+ * must stay valid and unchanged until the next parse or reset. Returns 0 on
+ * success, -1 on failure. */
+int dn_parse_buffer(dn_parser *p, const char *src, size_t len, const char *name);
+
+/* Number of nodes in the parsed document */
+int dn_node_count(const dn_parser *p);
+
+/* Render the parsed document. The result is NUL-terminated, its length is
+ * stored in *len when len is not NULL, and it stays valid until the next
+ * render, parse or reset. Returns NULL when nothing is parsed or out of
+ * memory. */
+const char *dn_render_json(dn_parser *p, size_t *len);
+const char *dn_render_html(dn_parser *p, size_t *len);
+const char *dn_render_text(dn_parser *p, size_t *len, int color);
+
+/* The binary document format described in the README, as -b writes it */
+const char *dn_render_binary(dn_parser *p, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DOCUNATION_H */